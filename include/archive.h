@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "counter_mode.h"
+#include "file_engine.h"
+
+// Зашифрованный архив для пакетов мелких файлов.
+//
+// Мелкие файлы по отдельности дают на FAT/exFAT по нескольку обновлений
+// каталога и таблицы размещения на каждый файл, а порции записи получаются
+// короткими. В архиве все файлы идут одним потоком, запись ведется полными
+// порциями, а носитель назначения получает один файл.
+//
+// Формат:
+//   заголовок (HEADER_SIZE байт, открытый):
+//     MAGIC (8) | версия (4) | число файлов (4) | смещение оглавления (8) |
+//     размер оглавления (8) | синхропосылка оглавления (16) | резерв (16)
+//   данные файлов подряд, каждый зашифрован в режиме гаммирования со своей
+//   синхропосылкой
+//   оглавление, зашифрованное со своей синхропосылкой, и его имитовставка
+//
+// Запись оглавления: длина имени (2) | имя | смещение (8) | размер (8) |
+// синхропосылка (16) | имитовставка открытых данных файла (16).
+// Числа — little-endian. Оглавление позволяет извлечь или проверить один
+// файл, не расшифровывая остальные.
+namespace archive {
+
+constexpr char MAGIC[8] = {'S', 'H', 'F', 'R', 'A', 'R', 'C', '1'};
+constexpr uint32_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 64;
+
+// Пакет из стольких мелких файлов упаковывается в архив
+constexpr size_t MIN_FILES = 32;
+
+// Исходный файл для упаковки
+struct Entry {
+    std::string source;  // Путь к файлу
+    std::string name;    // Имя внутри архива
+};
+
+// Запись оглавления
+struct Member {
+    std::string name;
+    uint64_t offset;                     // Смещение данных от начала архива
+    uint64_t size;                       // Размер данных (равен размеру файла)
+    uint8_t iv[counter_mode::IV_SIZE];
+    uint8_t mac[file_engine::MAC_SIZE];  // CMAC открытых данных
+};
+
+// Является ли файл архивом (по заголовку)
+bool isArchive(const std::string& path);
+
+// Проверка заголовка архива без ключа. false, если это не архив или
+// заголовок не согласуется с размером файла. data_size — суммарный размер
+// упакованных файлов (данные идут подряд до оглавления)
+bool describe(const std::string& path, uint64_t& data_size);
+
+// Размер архива для набора файлов заданных размеров и имен
+uint64_t archiveSize(const std::vector<Entry>& entries);
+
+// Упаковка файлов в архив. Результат пишется во временный файл и переименовывается
+void create(const std::string& archive_path, const std::vector<Entry>& entries,
+            const file_engine::Key& key, const file_engine::Options& options = file_engine::Options());
+
+// Чтение оглавления с проверкой его имитовставки
+std::vector<Member> readIndex(const std::string& archive_path, const file_engine::Key& key);
+
+// Извлечение одного файла с проверкой имитовставки
+void extract(const std::string& archive_path, const Member& member, const std::string& dest_file,
+             const file_engine::Key& key, const file_engine::Options& options = file_engine::Options());
+
+// Проверка имитовставки одного файла без записи на носитель
+bool verify(const std::string& archive_path, const Member& member, const file_engine::Key& key);
+
+// Смена ключа архива за один проход: каждый файл получает новую
+// синхропосылку и имитовставку, оглавление зашифровывается заново.
+// Раскладка архива не меняется. Имитовставки под старым ключом проверяются
+// до публикации результата. dest_file может совпадать с archive_path
+void rekey(const std::string& archive_path, const std::string& dest_file,
+           const file_engine::Key& old_key, const file_engine::Key& new_key,
+           const file_engine::Options& options = file_engine::Options());
+
+// Извлечение всех файлов в каталог. Файлы с ошибками пропускаются,
+// после обработки остальных выбрасывается исключение
+void extractAll(const std::string& archive_path, const std::string& dest_dir,
+                const file_engine::Key& key, const file_engine::Options& options = file_engine::Options());
+
+} // namespace archive
@@ -69,7 +69,7 @@ const uint8_t basic_font[] = {
 #define RUS_YERU 20 // ы
 
 // Функция для преобразования UTF-8 в индекс для базового шрифта
-uint8_t basic_utf8_to_index(unsigned char c1, unsigned char c2) {
+inline uint8_t basic_utf8_to_index(unsigned char c1, unsigned char c2) {
     // Специальные символы (кириллические)
     if (c1 == 0xD0) {
         switch (c2) {
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Запись и чтение чисел в little-endian для служебных структур на носителе
+namespace byte_order {
+
+inline void putLe(uint8_t* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint64_t getLe(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+// Дописывание числа в конец буфера
+inline void appendLe(std::vector<uint8_t>& out, uint64_t value, size_t bytes) {
+    out.resize(out.size() + bytes);
+    putLe(out.data() + out.size() - bytes, value, bytes);
+}
+
+} // namespace byte_order
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+#include "file_engine.h"
+
+// Журнал контрольных точек пакетной обработки на носителе назначения.
+//
+// Для каждого обрабатываемого файла хранится последняя контрольная точка
+// (см. file_engine::Checkpoint), для обработанных — отметка о завершении.
+// Вместе с ними запоминаются размер и время изменения исходного файла:
+// если он изменился, точка не используется. После прерванного пакета
+// (извлечена флешка, перезагрузка) обработанные файлы пропускаются,
+// а начатые дописываются с последней точки. Журнал зашифрован тем же
+// ключом, что и файлы: в точках есть состояние имитовставки.
+namespace checkpoint {
+
+// Имя файла журнала в каталоге назначения
+constexpr char FILE_NAME[] = ".shifro_checkpoint";
+
+class Journal {
+public:
+    // Загрузка журнала из каталога назначения. Отсутствующий или
+    // поврежденный журнал считается пустым
+    Journal(const std::string& dest_dir, const file_engine::Key& key);
+
+    // Файл обработан в прерванном пакете, исходный файл с тех пор
+    // не менялся и результат на месте
+    bool isFinished(const std::string& output, const std::string& source_path) const;
+
+    // Контрольная точка незавершенного файла. false, если ее нет
+    // или исходный файл изменился
+    bool find(const std::string& output, const std::string& source_path, file_engine::Checkpoint& point) const;
+
+    // Новая контрольная точка файла. Журнал сохраняется сразу.
+    // Может вызываться из нескольких потоков
+    void update(const std::string& output, const std::string& source_path, const file_engine::Checkpoint& point);
+
+    // Файл обработан целиком. Журнал сохраняется, только если у файла были
+    // контрольные точки: мелкие файлы дешевле обработать заново, чем
+    // переписывать журнал после каждого
+    void finished(const std::string& output, const std::string& source_path);
+
+    // Сохранение через временный файл
+    void save() const;
+
+    // Пакет завершен без ошибок: журнал больше не нужен
+    void remove();
+
+private:
+    struct Entry {
+        uint64_t size;      // Размер исходного файла
+        int64_t mtime;      // Время изменения исходного файла, нс
+        bool finished;
+        file_engine::Checkpoint point;
+    };
+
+    void saveLocked() const;
+
+    std::string dest_dir;
+    file_engine::Key key;
+
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> entries;
+};
+
+} // namespace checkpoint
@@ -27,6 +27,33 @@ void xorBlocks(uint8_t* dst, const uint8_t* src);
 // Генерирует подключи для CMAC
 CMACKeys generateSubkeys(const uint8_t* key);
 
+// Потоковое вычисление CMAC: данные подаются порциями, результат
+// совпадает с calculateCMAC для той же последовательности байт
+class Context {
+public:
+    explicit Context(const uint8_t* roundKeys);
+
+    // Добавление очередной порции данных
+    void update(const uint8_t* data, size_t length);
+
+    // Обработка последнего блока и получение имитовставки
+    std::vector<uint8_t> finalize();
+
+    // Промежуточное состояние (цепочка и необработанный блок) для продолжения
+    // вычисления после перезапуска. Ключи в состояние не входят
+    static constexpr size_t STATE_SIZE = 2 * BLOCK_SIZE + 1;
+    void saveState(uint8_t* out) const;
+    // false, если состояние некорректно
+    bool restoreState(const uint8_t* in);
+
+private:
+    uint8_t keys[160];            // Раундовые ключи
+    CMACKeys subkeys;             // Подключи K1, K2
+    uint8_t mac[BLOCK_SIZE];      // Текущее значение цепочки
+    uint8_t pending[BLOCK_SIZE];  // Последний (еще не обработанный) блок
+    size_t pending_length;        // Количество байт в pending
+};
+
 // Вычисляет CMAC для заданных данных
 std::vector<uint8_t> calculateCMAC(const std::vector<char>& data, 
                                  const uint8_t* key, 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Сжатие перед шифрованием.
+//
+// Сжатый поток — последовательность кадров:
+//   размер сохраненных данных (4) | размер исходных данных (4) | данные
+// Каждый кадр соответствует FRAME_SIZE байтам исходного файла (последний
+// может быть короче). Если кадр не сжимается, он сохраняется как есть
+// (размеры совпадают). Сжатие — zlib уровня 1; без zlib (SHIFRO_HAVE_ZLIB
+// не определен) сжатие недоступно.
+namespace compression {
+
+constexpr size_t FRAME_SIZE = 256 * 1024;
+constexpr size_t FRAME_HEADER_SIZE = 8;
+
+// Файлы меньше этого не сжимаются: выигрыш меньше заголовка
+constexpr uint64_t MIN_FILE_SIZE = 4096;
+
+// Выборка с энтропией выше этой (бит на байт) считается уже сжатой
+constexpr double MAX_ENTROPY = 7.5;
+
+// Сжатая выборка должна быть не больше этой доли исходной
+constexpr double MAX_RATIO = 0.9;
+
+// Собрана ли программа со сжатием
+bool available();
+
+// Энтропия Шеннона выборки, бит на байт
+double entropy(const uint8_t* data, size_t length);
+
+// Стоит ли сжимать файл, судя по выборке из его начала: низкая энтропия
+// и пробное сжатие выборки дает заметный выигрыш
+bool worthCompressing(const uint8_t* sample, size_t length);
+
+// Максимальный размер кадра со сжатыми данными FRAME_SIZE байт
+size_t frameBound();
+
+// Формирование кадра в out (не меньше frameBound() байт). Возвращает размер кадра
+size_t compressFrame(const uint8_t* data, size_t length, uint8_t* out);
+
+// Распаковка данных кадра в out (plain_length байт). Исключение при ошибке
+void decompressFrame(const uint8_t* data, size_t stored_length, uint8_t* out, size_t plain_length);
+
+} // namespace compression
@@ -39,6 +39,10 @@ void generate_gamma(uint8_t* gamma, Counter& ctr, const uint8_t* roundKeys);
 // Наложение гаммы на блок данных
 void apply_gamma(uint8_t* data, const uint8_t* gamma, size_t length);
 
+// Зашифрование/расшифрование порции данных. Неполным может быть только
+// последний блок потока, поэтому порции должны быть кратны BLOCK_SIZE
+void apply_ctr(uint8_t* data, size_t length, Counter& ctr, const uint8_t* roundKeys);
+
 } // namespace counter_mode
 
 #endif 
\ No newline at end of file
@@ -179,5 +179,5 @@ const struct AppFont CYRILLIC_FONT = {
     5,               // Ширина символа
     8,               // Высота символа
     32,              // Первый символ (пробел)
-    192              // Последний символ (русская я)
+    191              // Последний символ (русская я)
 }; 
\ No newline at end of file
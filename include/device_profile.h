@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <mutex>
+
+namespace device_profile {
+
+// Границы размера порции. Размер всегда степень двойки, поэтому кратен
+// и блоку шифра, и выравниванию O_DIRECT
+constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+constexpr size_t MAX_CHUNK_SIZE = 8 * 1024 * 1024;
+constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+// Границы глубины конвейера (порций в процессе записи на носитель)
+constexpr size_t MIN_PIPELINE_DEPTH = 1;
+constexpr size_t MAX_PIPELINE_DEPTH = 4;
+constexpr size_t DEFAULT_PIPELINE_DEPTH = 1;
+
+// Количество порций, по которым измеряется скорость носителя
+constexpr size_t CALIBRATION_CHUNKS = 4;
+
+// Желаемое время обработки одной порции и объем данных «в полете»
+constexpr double TARGET_CHUNK_SECONDS = 0.1;
+constexpr double TARGET_INFLIGHT_SECONDS = 0.25;
+
+// Параметры носителя
+struct Profile {
+    double read_bandwidth = 0;    // Скорость чтения, байт/с (0 — неизвестна)
+    double write_bandwidth = 0;   // Скорость записи, байт/с (0 — неизвестна)
+    double write_latency = 0;     // Постоянные затраты на запись порции, с
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    size_t pipeline_depth = DEFAULT_PIPELINE_DEPTH;
+};
+
+// UUID файловой системы, на которой находится path (пустая строка, если не найден)
+std::string filesystemUuid(const std::string& path);
+
+// Загрузка сохраненного профиля носителя. false, если профиля нет
+bool load(const std::string& uuid, Profile& profile);
+
+// Сохранение профиля носителя
+void save(const std::string& uuid, const Profile& profile);
+
+// Верхняя граница размера порции с учетом объема памяти платы
+size_t maxChunkSize();
+
+// Подстройка размера порции и глубины конвейера по измеренной скорости.
+// Один объект используется на весь пакет файлов между парой носителей
+// и может вызываться из нескольких потоков
+class Tuner {
+public:
+    Tuner(const Profile& source, const Profile& dest);
+
+    // Текущие параметры
+    size_t chunkSize() const;
+    size_t pipelineDepth() const;
+
+    // Замеры: объем порции и время ее чтения/записи
+    void recordRead(size_t bytes, double seconds);
+    void recordWrite(size_t bytes, double seconds);
+
+    // Профили для сохранения после окончания пакета
+    Profile sourceProfile() const;
+    Profile destProfile() const;
+
+private:
+    void retune();
+
+    mutable std::mutex mutex;
+    Profile source;
+    Profile dest;
+
+    size_t read_samples;
+    double read_bytes;
+    double read_seconds;
+
+    size_t write_samples;
+    double write_bytes;
+    double write_seconds;
+    double min_write_overhead;
+};
+
+} // namespace device_profile
@@ -3,7 +3,12 @@
 #include <cstdint>
 #include <vector>
 #include <string>
-#include "spi_pi.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include "display_sink.h"
+#include "render_profiler.h"
 #include "colors.h"
 #include "commands.h"
 
@@ -15,6 +20,12 @@
 #define ST7735_XSTART 0
 #define ST7735_YSTART 0
 
+// Не больше стольких отдельных областей выводится за один flush()
+#define MAX_DIRTY_RECTS 8
+
+// Не чаще стольких кадров в секунду поток вывода отправляет кадр на дисплей
+#define MAX_FPS 30
+
 // Настройки поворота дисплея
 enum class DisplayRotation {
     ROTATION_0   = 0,  // Нормальная ориентация
@@ -32,12 +43,17 @@ struct AppFont {
     int last_char;           // Последний символ в наборе
 };
 
-// Основной класс для работы с TFT дисплеем
+// Основной класс для работы с TFT дисплеем.
+// Рисование идет в буфер кадра в памяти, изменившиеся области запоминаются.
+// flush() снимает копию кадра и кладет ее в почтовый ящик без блокировок;
+// на дисплей кадры выводит отдельный поток не чаще MAX_FPS раз в секунду,
+// по одной записи RAMWR на область. Рисующий поток на SPI не ждет
 class TFTDisplay {
 public:
-    // Конструктор с параметрами подключения
-    TFTDisplay(int channel = 0, int reset_pin = 25, int dc_pin = 24, 
-               int width = ST7735_WIDTH, int height = ST7735_HEIGHT);
+    // Конструктор с приемником вывода: SPIDevice для панели на SPI
+    // или VirtualPanel для работы без устройства
+    explicit TFTDisplay(std::unique_ptr<DisplaySink> sink,
+                        int width = ST7735_WIDTH, int height = ST7735_HEIGHT);
     ~TFTDisplay();
 
     // Основные функции управления дисплеем
@@ -53,9 +69,16 @@ public:
     void drawCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color);  // Окружность
     void fillCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color);  // Закрашенный круг
 
+    // Прокрутка прямоугольника на dy строк (dy > 0 — вниз) с заливкой
+    // открывшейся полосы цветом fill. Аппаратная прокрутка ST7735 (VSCRDEF)
+    // идет вдоль длинной стороны панели, а в альбомной ориентации это
+    // горизонталь экрана, поэтому строки сдвигаются в буфере кадра
+    void scrollRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t dy, uint16_t fill);
+
     // Работа с текстом
     void setFont(const AppFont& font);  // Установка шрифта
-    void drawChar(int16_t x, int16_t y, uint8_t character, uint16_t color);  // Вывод одного символа
+    // Вывод одного символа; жирный — с повтором символа на точку правее
+    void drawChar(int16_t x, int16_t y, uint8_t character, uint16_t color, bool bold = false);
     void drawText(int16_t x, int16_t y, const std::string& text, uint16_t color);  // Вывод текста
 
     // Работа с изображениями
@@ -65,6 +88,15 @@ public:
     void setColor(uint16_t color);  // Установка текущего цвета
     uint16_t getColor() const;      // Получение текущего цвета
 
+    // Передача изменившихся с прошлого вызова областей потоку вывода
+    void flush();
+
+    // Ожидание вывода на дисплей всех кадров, переданных flush()
+    void waitPresented();
+
+    // Учет отрисовки по экранам и примитивам (по умолчанию выключен)
+    RenderProfiler& profiler() { return profiling; }
+
     // Получение размеров дисплея
     int getWidth() const { return width; }    // Получить ширину
     int getHeight() const { return height; }   // Получить высоту
@@ -74,15 +106,61 @@ private:
     void writeCommand(uint8_t cmd);   // Отправка команды
     void writeData(const uint8_t* data, size_t length);  // Отправка данных
     void writeData(uint8_t data);  // Отправка одного байта данных
-    void setAddressWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);  // Установка области рисования
+    void submit();  // Отправка очереди SPI (ошибки передачи игнорируются, как и раньше)
+    // Установка области рисования: команды только ставятся в очередь SPI
+    void setAddressWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+
+    // Прямоугольная область экрана, границы включительно
+    struct Rect {
+        int16_t x0, y0, x1, y1;
+    };
+
+    void rasterizeFont();  // Построение атласа символов текущего шрифта
+    void putPixel(int16_t x, int16_t y, uint16_t color);  // Точка в буфере кадра, без отметки
+    void markDirty(int16_t x0, int16_t y0, int16_t x1, int16_t y1);  // Отметка области для flush()
+    static void addDirty(std::vector<Rect>& regions, Rect rect);  // Добавление области с объединением
+
+    // Снимок буфера кадра для потока вывода
+    struct Frame {
+        std::vector<uint16_t> pixels;
+        std::vector<Rect> dirty;
+        int16_t width = 0;
+        uint64_t sequence = 0;  // Номер вызова flush()
+        uint16_t screen = 0;    // Экран учета, в котором вызван flush()
+    };
+
+    // Почтовый ящик — тройной буфер: у рисующего потока и у потока вывода по
+    // своему кадру, третий лежит в ящике. Обмен — atomic exchange индекса,
+    // бит FRAME_FRESH отмечает еще не выведенный кадр
+    static constexpr uint8_t FRAME_FRESH = 0x4;
+    static constexpr uint8_t FRAME_INDEX = 0x3;
+
+    void renderLoop();             // Поток вывода
+    void present(Frame& frame);    // Вывод областей кадра на дисплей
 
     // Параметры подключения и состояния
-    SPIDevice spi;              // SPI интерфейс
-    int reset_pin;              // Пин сброса
-    int dc_pin;                 // Пин выбора данные/команда
+    std::unique_ptr<DisplaySink> sink;  // Приемник вывода (SPI или виртуальная панель)
     int width;                  // Текущая ширина
     int height;                 // Текущая высота
     DisplayRotation rotation;   // Текущий поворот
     uint16_t current_color;     // Текущий цвет
     AppFont current_font;       // Текущий шрифт
+    // Атлас символов текущего шрифта: по height + 1 строк на символ, в строке
+    // бит i — точка в столбце i - 1 (с выступающими элементами русских букв)
+    std::vector<uint32_t> glyph_atlas;
+    std::vector<uint16_t> framebuffer;  // Буфер кадра, точки в порядке байт дисплея
+    std::vector<Rect> dirty;            // Изменившиеся области
+    std::vector<Rect> unpresented;      // Переданные в ящик, но, возможно, не выведенные
+    std::vector<uint8_t> flush_buffer;  // Строки областей, собранные для вывода (поток вывода)
+
+    Frame frames[3];
+    std::atomic<uint8_t> mailbox;       // Индекс кадра в ящике | FRAME_FRESH
+    uint8_t back_frame;                 // Кадр рисующего потока
+    uint8_t front_frame;                // Кадр потока вывода
+    std::atomic<bool> rendering;
+    uint64_t published_frames;          // Кадров передано flush()
+    std::atomic<uint64_t> presented_frames;  // Номер последнего выведенного кадра
+    std::thread render_thread;
+    std::mutex spi_mutex;               // Команды вне потока вывода (поворот, выключение)
+    RenderProfiler profiling;
 }; 
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Счетчики обмена приемника с панелью с начала работы
+struct SinkStats {
+    uint64_t submits = 0;        // Отправок очереди
+    uint64_t transfers = 0;      // ioctl (для VirtualPanel — сколько выполнил бы SPIDevice)
+    uint64_t dc_switches = 0;    // Переключений линии DC
+    uint64_t command_bytes = 0;  // Байт команд
+    uint64_t data_bytes = 0;     // Байт данных
+    uint64_t busy_ns = 0;        // Время передачи (для VirtualPanel — расчетное по частоте SPI)
+
+    // Обмен между снимком earlier и этим
+    SinkStats since(const SinkStats& earlier) const {
+        SinkStats delta;
+        delta.submits = submits - earlier.submits;
+        delta.transfers = transfers - earlier.transfers;
+        delta.dc_switches = dc_switches - earlier.dc_switches;
+        delta.command_bytes = command_bytes - earlier.command_bytes;
+        delta.data_bytes = data_bytes - earlier.data_bytes;
+        delta.busy_ns = busy_ns - earlier.busy_ns;
+        return delta;
+    }
+};
+
+// Приемник команд и данных контроллера дисплея. TFTDisplay ставит в очередь
+// команды ST7735 с их данными и отправляет очередь вызовом submit().
+// Реализации: SPIDevice (панель на SPI) и VirtualPanel (панель в памяти,
+// для запуска и замеров без устройства)
+class DisplaySink {
+public:
+    virtual ~DisplaySink() = default;
+
+    virtual bool init() = 0;
+    virtual void setRST(bool state) = 0;
+
+    // Данные должны оставаться в памяти до submit(): реализация вправе
+    // не копировать их при постановке в очередь
+    virtual void queueCommand(uint8_t cmd) = 0;
+    virtual void queueData(const uint8_t* data, size_t length) = 0;
+    virtual void submit() = 0;
+
+    // Счетчики обмена. Читаются под тем же замком, что и submit()
+    virtual SinkStats stats() const = 0;
+};
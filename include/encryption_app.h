@@ -1,14 +1,17 @@
 #pragma once
 
 #include "display_pi.h"
+#include "ui.h"
 #include "kuznechik.h"
 #include "keyboard.h"
+#include "file_engine.h"
 #include <string>
 #include <vector>
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <atomic>
+#include <memory>
 
 // Пины для подключения
 #define RESET_PIN 25
@@ -16,11 +19,16 @@
 #define DISPLAY_WIDTH 160
 #define DISPLAY_HEIGHT 128
 
+// Ход пакета перерисовывается не чаще раза в столько миллисекунд, как бы
+// часто ни шли порции данных: стоимость отрисовки постоянна
+#define PROGRESS_REFRESH_MS 150
+
 // Структура для хранения информации о файле
 struct FileInfo {
     std::string name;
     bool selected;
     std::string full_path;
+    uint64_t plain_size = 0;  // Размер открытых данных (в режиме расшифрования — по заголовку)
 };
 
 // Структура для хранения информации об устройстве
@@ -43,7 +51,7 @@ public:
     void drawMenuItem(int index, bool is_selected);
     void showMessage(const std::string& message, bool isError, int timeout_seconds);
     void drawCurrentFile(const std::string& fileName, int16_t x, int16_t y, uint16_t color);
-    void drawFileSelectionMenu(bool force_full_redraw = false);
+    void drawFileSelectionMenu();
     void showUsbWaitScreen(const std::string& message);
     
 private:
@@ -55,6 +63,16 @@ private:
     
     // Дисплей
     TFTDisplay display;
+    ui::Stage stage;
+
+    // Экраны интерфейса; строятся в init(), когда известны размеры дисплея
+    struct MenuScreen;
+    struct FileScreen;
+    struct ProgressScreen;
+    std::unique_ptr<MenuScreen> menu_screen;
+    std::unique_ptr<FileScreen> file_screen;
+    std::unique_ptr<ProgressScreen> progress_screen;
+    void buildScreens();
     
     // Мембранная клавиатура
     MembraneKeyboard keyboard;
@@ -66,8 +84,6 @@ private:
     // Файловый менеджер
     std::vector<FileInfo> file_list;
     size_t current_file_index;
-    size_t files_per_page;
-    size_t current_page;
     
     // Клавиатура
     struct termios old_tio;
@@ -87,7 +103,8 @@ private:
     void processSelection(MenuOption option);
     
     // Методы для работы с файлами
-    void loadFilesFromDrive(const std::string& path);
+    // В режиме расшифрования в список попадают только файлы, похожие на зашифрованные
+    void loadFilesFromDrive(const std::string& path, bool decrypting);
     void handleFileSelectionKeypress(int key);
     bool waitForDriveMount(const std::string& prompt);
     void processSelectedFiles(bool encrypting);
@@ -104,8 +121,10 @@ private:
     bool decryptFiles(const std::string& sourceDir, const std::string& targetDir);
     std::vector<char> encryptData(const std::vector<char>& data, const std::string& key);
     std::vector<char> decryptData(const std::vector<char>& data, const std::string& key);
-    void encryptFile(const std::string& source_file, const std::string& dest_file);
-    void decryptFile(const std::string& source_file, const std::string& dest_file);
+    void encryptFile(const std::string& source_file, const std::string& dest_file,
+                     const file_engine::Options& options = file_engine::Options());
+    void decryptFile(const std::string& source_file, const std::string& dest_file,
+                     const file_engine::Options& options = file_engine::Options());
     
     std::vector<unsigned char> calculateHMAC(const std::vector<char>& data, const std::string& key);
     std::vector<unsigned char> simpleHash(const std::vector<unsigned char>& data);
@@ -117,4 +136,22 @@ private:
     
     // Флаг ожидания нажатия кнопки
     std::atomic<bool> waiting_for_key;
+
+    // Упаковка мелких файлов большого пакета в один архив (SHIFRO_ARCHIVE=1).
+    // По умолчанию каждый файл шифруется в свой .enc
+    bool pack_small_files = false;
+
+    // Сжатие перед шифрованием (SHIFRO_COMPRESS=1). По умолчанию выключено:
+    // сжатый файл нельзя расшифровать старой версией программы
+    bool compress_files = false;
+
+    // Проверка записанного чтением с носителя (SHIFRO_VERIFY=1). По умолчанию
+    // выключена: повторное чтение занимает шину накопителя
+    bool verify_writes = false;
+
+    // Учет отрисовки: файлы отчета и трассы (SHIFRO_PROFILE, SHIFRO_TRACE),
+    // пустые — не записываются
+    std::string profile_report_path;
+    std::string profile_trace_path;
+    void writeProfile();
 }; 
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include "counter_mode.h"
+#include "cmac.h"
+#include "device_profile.h"
+#include "file_io.h"
+
+namespace file_engine {
+
+// Размер имитовставки в конце файла
+constexpr size_t MAC_SIZE = 16;
+
+// Файлы больше этого размера пишутся с O_DIRECT в режиме DirectIo::AUTO
+constexpr uint64_t DIRECT_IO_THRESHOLD = 64ULL * 1024 * 1024;
+
+// Файл шифруется как разреженный, если дыры в нем занимают не меньше этого
+constexpr uint64_t SPARSE_MIN_HOLE_BYTES = 1024 * 1024;
+
+// Максимум участков в карте разреженного файла (иначе он шифруется целиком)
+constexpr uint64_t MAX_EXTENTS = 65536;
+
+// Объем обработанных данных между контрольными точками
+constexpr uint64_t CHECKPOINT_INTERVAL = 256ULL * 1024 * 1024;
+
+// Контрольная точка обработки файла: сколько обработано и состояние
+// гаммирования и имитовставки на этот момент. Выход до output_offset
+// уже сброшен на носитель.
+//
+// В формате с заголовком (flags != 0) точка приходится на середину кадра
+// сжатия или порции, и при продолжении этот кадр обрабатывается заново
+// с начала, а уже учтенная его часть пропускается. frame_offset — начало
+// кадра в зашифрованном файле; при шифровании input_offset — начало кадра
+// в данных исходного файла (без дыр), при расшифровании output_offset —
+// начало его открытых данных
+struct Checkpoint {
+    uint64_t input_offset = 0;
+    uint64_t output_offset = 0;
+    uint8_t counter[counter_mode::BLOCK_SIZE] = {};
+    uint8_t mac_state[cmac::Context::STATE_SIZE] = {};
+    uint32_t flags = 0;          // Флаги формата с заголовком, 0 — исходный формат
+    uint64_t frame_offset = 0;
+};
+
+// Режим прямого (мимо страничного кэша) вывода
+enum class DirectIo {
+    AUTO,    // По размеру файла (DIRECT_IO_THRESHOLD)
+    ALWAYS,  // Всегда
+    NEVER    // Никогда
+};
+
+// Параметры обработки файла
+struct Options {
+    DirectIo direct_io = DirectIo::AUTO;
+
+    // Подстройка размера порции и глубины конвейера под носители.
+    // Без него используются значения по умолчанию. Все порции, кроме
+    // последней, кратны размеру блока, поэтому гамма от размера порции не зависит
+    device_profile::Tuner* tuner = nullptr;
+
+    // Вызывается после каждой порции с количеством обработанных байт исходного файла
+    std::function<void(uint64_t)> progress;
+
+    // Сжимать данные перед шифрованием (если выборка из начала файла сжимается)
+    bool compress = false;
+
+    // Вызывать sync() после каждого зашифрованного файла. При пакетной
+    // обработке выгоднее один sync() в конце пакета
+    bool sync_each_file = true;
+
+    // Продолжение прерванной обработки с контрольной точки (nullptr — с начала).
+    // Точка другого формата (Checkpoint::flags) не используется; если выход
+    // прерванной обработки пропал или короче точки, файл обрабатывается заново
+    const Checkpoint* resume = nullptr;
+
+    // Вызывается примерно каждые CHECKPOINT_INTERVAL байт исходных данных
+    std::function<void(const Checkpoint&)> on_checkpoint;
+
+    // Проверять записанное чтением с носителя и переписывать испорченные
+    // порции (см. file_io::ReadBackVerifier). Дешевые флешки портят данные
+    // молча, и без проверки это обнаруживается только при расшифровании
+    bool verify = false;
+};
+
+// Мастер-ключ и развернутые раундовые ключи
+struct Key {
+    uint8_t master[32];
+    uint8_t round[160];
+};
+
+// Формирование мастер-ключа из строки и развертывание раундовых ключей
+Key expandKey(const std::string& key);
+
+// Размер зашифрованного файла: синхропосылка + данные + имитовставка
+inline uint64_t encryptedSize(uint64_t plain_size) {
+    return counter_mode::IV_SIZE + plain_size + MAC_SIZE;
+}
+
+// Размер расшифрованного файла (0, если файл слишком мал)
+inline uint64_t decryptedSize(uint64_t encrypted_size) {
+    if (encrypted_size < counter_mode::IV_SIZE + MAC_SIZE) {
+        return 0;
+    }
+    return encrypted_size - counter_mode::IV_SIZE - MAC_SIZE;
+}
+
+// Шифрование небольшого буфера в памяти в том же формате, что и файлы
+std::vector<uint8_t> encryptBuffer(const std::vector<uint8_t>& plain, const Key& key);
+
+// Расшифрование буфера. false, если буфер испорчен или MAC не совпадает
+bool decryptBuffer(const std::vector<uint8_t>& encrypted, const Key& key, std::vector<uint8_t>& plain);
+
+// Наибольший размер зашифрованного файла: исходный формат или, если
+// включено сжатие, формат с заголовком, в котором ни один кадр не сжался.
+// Разреженный файл получается меньше
+uint64_t maxEncryptedSize(uint64_t plain_size, const Options& options);
+
+// Текущий размер порции
+size_t chunkSize(const Options& options);
+
+// Нужен ли O_DIRECT для выходного файла заданного размера
+bool useDirectIo(const Options& options, uint64_t output_size);
+
+// Чтение порции исходных данных целиком с замером скорости и упреждающим чтением следующей
+void readChunk(int fd, uint8_t* buffer, size_t length, uint64_t offset, const Options& options);
+
+// Запись выходного файла порциями. В режиме O_DIRECT выровненная часть порции
+// пишется напрямую на носитель, невыровненный хвост (обычно только в конце
+// файла) — через страничный кэш с отложенной записью, и дальше файл пишется
+// в обычном режиме. В канал или сокет порции пишутся последовательно,
+// пропущенные диапазоны (дыры) заполняются нулями. При Options::verify
+// записанные порции проверяются чтением в фоне
+class ChunkWriter {
+public:
+    ChunkWriter(int fd, const Options& options);
+
+    void write(const uint8_t* data, size_t length, uint64_t offset);
+
+    // Доведение вывода до размера size: дыра в конце файла
+    void fillTo(uint64_t size);
+
+    // Сброс записанного на носитель (после проверки, если она включена)
+    void sync();
+
+    // Дожидается записи (и проверки) всех порций
+    void finish();
+
+private:
+    // Запись нулей в поток до смещения offset
+    void fillStream(uint64_t offset);
+
+    int fd;
+    bool stream;
+    bool direct;
+    uint64_t position;
+    file_io::WriteBehind write_behind;
+    std::unique_ptr<file_io::ReadBackVerifier> verifier;
+    device_profile::Tuner* tuner;
+};
+
+// Перемещение готового временного файла на место целевого
+void publishFile(const std::string& temp_file, const std::string& dest_file);
+
+// Шифрование файла. Результат пишется во временный файл и переименовывается
+void encryptFile(const std::string& source_file, const std::string& dest_file, const Key& key,
+                 const Options& options = Options());
+
+// Расшифрование файла с проверкой имитовставки
+void decryptFile(const std::string& source_file, const std::string& dest_file, const Key& key,
+                 const Options& options = Options());
+
+// Быстрая проверка по первым байтам, без ключа и расшифрования: похож ли
+// файл на зашифрованный и каков размер открытых данных. Формат с заголовком
+// опознается по MAGIC и известным флагам; у исходного формата заголовка
+// нет, поэтому от него требуется расширение .enc и размер не меньше
+// синхропосылки с имитовставкой
+bool describeFile(const std::string& path, uint64_t& plain_size);
+
+// Шифрование потока неизвестной длины (канал, stdin, сокет) в исходном
+// формате: синхропосылка пишется сразу, имитовставка — по концу потока.
+// Выход может быть каналом. Возвращает число зашифрованных байт
+uint64_t encryptStream(int in_fd, int out_fd, const Key& key, const Options& options = Options());
+
+// Расшифрование потока любого формата. Конец потока заранее неизвестен,
+// поэтому последние MAC_SIZE байт придерживаются до EOF. Открытые данные
+// выводятся до проверки имитовставки: при несовпадении бросается исключение,
+// и результат должен быть отброшен вызывающим. Возвращает размер открытых данных
+uint64_t decryptStream(int in_fd, int out_fd, const Key& key, const Options& options = Options());
+
+// Смена ключа зашифрованного файла за один проход без записи открытого
+// текста на носитель: каждая порция расшифровывается старым ключом и сразу
+// зашифровывается новым с новой синхропосылкой. Старая имитовставка проверяется
+// до публикации результата. dest_file может совпадать с source_file
+void rekeyFile(const std::string& source_file, const std::string& dest_file,
+               const Key& old_key, const Key& new_key, const Options& options = Options());
+
+} // namespace file_engine
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "counter_mode.h"
+
+// Форматы зашифрованных файлов.
+//
+// Исходный формат: синхропосылка (16) | данные | CMAC открытых данных (16).
+// Заголовка нет, поэтому он по-прежнему используется, когда расширения
+// не нужны, и читается всеми версиями программы.
+//
+// Формат с заголовком: заголовок (HEADER_SIZE, открытый) | поток | CMAC (16).
+//   MAGIC (8) | флаги (4) | резерв (4) | размер исходного файла (8) |
+//   синхропосылка (16) | резерв (24)
+// Поток зашифрован в режиме гаммирования, его содержимое определяется
+// флагами. Имитовставка считается по заголовку и открытому потоку, так что
+// подмена флагов или размера обнаруживается.
+//
+// Поток: [карта участков] данные
+//   карта (FLAG_SPARSE): число участков (4) | по участку: смещение (8) | длина (8).
+//     Участки упорядочены, между ними и после последнего — дыры.
+//     Карта зашифрована вместе с потоком, чтобы не раскрывать структуру файла
+//   данные: содержимое участков подряд (без карты — весь файл), при
+//     FLAG_COMPRESSED — в виде сжатых кадров
+namespace file_format {
+
+constexpr char MAGIC[8] = {'S', 'H', 'F', 'R', 'E', 'N', 'C', '2'};
+constexpr size_t HEADER_SIZE = 64;
+constexpr size_t IV_OFFSET = 24;
+
+// Флаги содержимого потока
+enum Flags : uint32_t {
+    FLAG_COMPRESSED = 1 << 0,  // Данные — сжатые кадры (см. compression.h)
+    FLAG_SPARSE = 1 << 1       // Поток начинается с карты участков с данными
+};
+
+// Все флаги, известные этой версии
+constexpr uint32_t KNOWN_FLAGS = FLAG_COMPRESSED | FLAG_SPARSE;
+
+enum class Format {
+    LEGACY,  // Без заголовка
+    HEADER   // С заголовком
+};
+
+struct Header {
+    uint32_t flags = 0;
+    uint64_t plain_size = 0;
+    uint8_t iv[counter_mode::IV_SIZE] = {};
+};
+
+void encodeHeader(const Header& header, uint8_t* out);
+
+// Разбор заголовка. false, если это не заголовок нового формата
+bool decodeHeader(const uint8_t* in, Header& header);
+
+// Определение формата открытого файла. Для Format::HEADER заполняет header
+Format probe(int fd, Header& header);
+
+} // namespace file_format
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <deque>
+#include <utility>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+
+namespace file_io {
+
+// Выравнивание адреса, смещения и длины для O_DIRECT
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+// Владелец файлового дескриптора (закрывает его в деструкторе)
+class FileDescriptor {
+public:
+    FileDescriptor() : fd(-1) {}
+    explicit FileDescriptor(int fd) : fd(fd) {}
+    ~FileDescriptor();
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    FileDescriptor(FileDescriptor&& other) noexcept;
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept;
+
+    int get() const { return fd; }
+    bool valid() const { return fd >= 0; }
+    void close();
+
+private:
+    int fd;
+};
+
+// Открытие файла на чтение
+FileDescriptor openForRead(const std::string& path);
+
+// Создание (с усечением) файла на запись. При direct = true файл открывается
+// с O_DIRECT; если файловая система его не поддерживает, открывается обычным образом
+FileDescriptor openForWrite(const std::string& path, bool direct = false);
+
+// Открытие существующего файла на запись без усечения — для продолжения
+// прерванной записи. direct — как у openForWrite
+FileDescriptor openForResume(const std::string& path, bool direct = false);
+
+// Повторное открытие уже открытого файла на чтение и запись, без O_DIRECT
+// (через /proc/self/fd, работает и для удаленного или переименованного файла)
+FileDescriptor reopenReadWrite(int fd);
+
+// Включение/выключение O_DIRECT у открытого файла
+bool setDirect(int fd, bool enable);
+
+// Открыт ли файл с O_DIRECT
+bool isDirect(int fd);
+
+// Размер открытого файла
+uint64_t fileSize(int fd);
+
+// Резервирование места под файл заданного размера.
+// На FAT/exFAT поддерживается только FALLOC_FL_KEEP_SIZE, поэтому пробуем оба режима.
+// Возвращает false, если файловая система не умеет резервировать место.
+bool preallocate(int fd, uint64_t size);
+
+// Установка размера файла (отрезает зарезервированный, но не записанный хвост)
+void truncate(int fd, uint64_t size);
+
+// Участок файла с данными
+struct Extent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Участки с данными (между ними — дыры) по SEEK_DATA/SEEK_HOLE. Если файловая
+// система их не поддерживает, возвращается один участок на весь файл
+std::vector<Extent> dataExtents(int fd, uint64_t size);
+
+// Освобождение места под диапазоном без изменения размера файла (дыра).
+// false, если файловая система этого не умеет
+bool punchHole(int fd, uint64_t offset, uint64_t length);
+
+// Чтение length байт со смещения offset (меньше только при достижении конца файла)
+size_t readAt(int fd, void* buffer, size_t length, uint64_t offset);
+
+// Запись length байт по смещению offset целиком, иначе исключение
+void writeAt(int fd, const void* buffer, size_t length, uint64_t offset);
+
+// Можно ли позиционироваться в файле (false для каналов, сокетов, терминалов)
+bool isSeekable(int fd);
+
+// Последовательное чтение length байт (меньше только при достижении конца потока)
+size_t readStream(int fd, void* buffer, size_t length);
+
+// Последовательная запись length байт целиком, иначе исключение
+void writeStream(int fd, const void* buffer, size_t length);
+
+// Сброс записанных данных файла на носитель (fdatasync), иначе исключение
+void syncData(int fd);
+
+// Подсказка ядру: файл читается последовательно (увеличенное окно упреждающего чтения)
+void adviseSequential(int fd);
+
+// Асинхронное упреждающее чтение диапазона
+void readAhead(int fd, uint64_t offset, uint64_t length);
+
+// Вытеснение диапазона из страничного кэша (страницы должны быть чистыми)
+void dropCache(int fd, uint64_t offset, uint64_t length);
+
+// Отложенная запись: после каждой порции запускает ее сброс на носитель,
+// а когда в процессе записи оказывается больше depth порций — дожидается
+// самой старой и вытесняет ее из страничного кэша. Так объем грязных
+// страниц ограничен, а запись идет равномерно
+class WriteBehind {
+public:
+    explicit WriteBehind(int fd, size_t depth = 1) : fd(fd), depth(depth) {}
+
+    // Изменение глубины конвейера
+    void setDepth(size_t depth) { this->depth = depth; }
+
+    // Вызывается после записи диапазона [offset, offset + length)
+    void written(uint64_t offset, uint64_t length);
+
+    // Дожидается записи всех порций и вытесняет их из кэша
+    void finish();
+
+private:
+    // Ожидание записи самой старой порции
+    void retire();
+
+    int fd;
+    size_t depth;
+    std::deque<std::pair<uint64_t, uint64_t>> in_flight;
+};
+
+// Буфер, выровненный по DIRECT_IO_ALIGNMENT
+class AlignedBuffer {
+public:
+    AlignedBuffer() : ptr(nullptr), length(0) {}
+    explicit AlignedBuffer(size_t size);
+    ~AlignedBuffer();
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    AlignedBuffer(AlignedBuffer&& other) noexcept;
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+
+    uint8_t* data() { return ptr; }
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t* ptr;
+    size_t length;
+};
+
+// Пул выровненных буферов: буферы переиспользуются между файлами,
+// чтобы не выделять мегабайты памяти на каждый файл
+class BufferPool {
+public:
+    // Буфер, взятый из пула; возвращается в пул в деструкторе
+    class Lease {
+    public:
+        Lease(BufferPool& pool, AlignedBuffer buffer) : pool(&pool), buffer(std::move(buffer)) {}
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : pool(other.pool), buffer(std::move(other.buffer)) {
+            other.pool = nullptr;
+        }
+        Lease& operator=(Lease&& other) noexcept;
+
+        uint8_t* data() { return buffer.data(); }
+        size_t size() const { return buffer.size(); }
+
+    private:
+        BufferPool* pool;
+        AlignedBuffer buffer;
+    };
+
+    static BufferPool& instance();
+
+    // Буфер размером не меньше size (размер округляется до DIRECT_IO_ALIGNMENT)
+    Lease acquire(size_t size);
+
+private:
+    void release(AlignedBuffer buffer);
+
+    static constexpr size_t MAX_CACHED = 8;
+
+    std::mutex mutex;
+    std::vector<AlignedBuffer> free_buffers;
+};
+
+// Проверка записанного чтением с носителя. Копии порций проверяются
+// в отдельном потоке, пока вызывающий готовит следующие: порция сбрасывается
+// на носитель, вытесняется из кэша, читается заново и сравнивается с копией.
+// Несовпавшая порция переписывается (до MAX_REWRITES раз), после чего
+// ошибка передается вызывающему из submit() или finish()
+class ReadBackVerifier {
+public:
+    static constexpr int MAX_REWRITES = 2;
+
+    // depth — сколько порций может ждать проверки, прежде чем submit() заблокируется
+    ReadBackVerifier(int fd, size_t depth);
+    ~ReadBackVerifier();
+
+    ReadBackVerifier(const ReadBackVerifier&) = delete;
+    ReadBackVerifier& operator=(const ReadBackVerifier&) = delete;
+
+    // Порция [offset, offset + length) записана, data копируется
+    void submit(const void* data, size_t length, uint64_t offset);
+
+    // Дожидается проверки всех порций
+    void finish();
+
+    // Сколько порций пришлось переписать
+    size_t rewrites() const { return rewrite_count; }
+
+private:
+    struct Range {
+        uint64_t offset;
+        size_t length;
+        BufferPool::Lease data;
+    };
+
+    void run();
+    void check(Range& range);
+    void throwIfFailed();
+
+    FileDescriptor file;
+    size_t depth;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Range> queue;
+    bool busy;
+    bool stopping;
+    std::string error;
+    std::atomic<size_t> rewrite_count;
+    std::thread worker;
+};
+
+} // namespace file_io
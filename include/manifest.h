@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+#include "file_engine.h"
+
+// Манифест изменений на носителе назначения.
+//
+// Для каждого зашифрованного файла хранится имя исходного файла, его размер,
+// время изменения, быстрый хеш содержимого и имя результата. При повторном
+// шифровании на тот же носитель неизмененные файлы пропускаются.
+// Манифест зашифрован тем же ключом, что и файлы, поэтому имена исходных
+// файлов с носителя не читаются, а подмена обнаруживается по имитовставке.
+namespace manifest {
+
+// Имя файла манифеста в корне носителя назначения
+constexpr char FILE_NAME[] = ".shifro_manifest";
+
+// Объем выборок содержимого для быстрого хеша
+constexpr size_t HASH_SAMPLE_SIZE = 64 * 1024;
+
+// Запись манифеста
+struct Entry {
+    std::string name;    // Имя исходного файла
+    uint64_t size;       // Размер исходного файла
+    int64_t mtime;       // Время изменения, нс
+    uint64_t hash;       // Быстрый хеш содержимого
+    std::string output;  // Имя результата в каталоге назначения
+};
+
+// Быстрый хеш: FNV-1a по размеру и выборкам из начала, середины и конца файла.
+// Дополняет сравнение размера и времени изменения, а не заменяет его
+uint64_t fastHash(const std::string& path);
+
+// Запись для исходного файла (размер, время изменения, хеш)
+Entry describe(const std::string& name, const std::string& source_path, const std::string& output);
+
+class Manifest {
+public:
+    // Загрузка манифеста из каталога назначения. Отсутствующий или
+    // поврежденный манифест считается пустым
+    Manifest(const std::string& dest_dir, const file_engine::Key& key);
+
+    // Запись для исходного файла. false, если ее нет
+    bool find(const std::string& name, Entry& entry) const;
+
+    // Файл не изменился с прошлого шифрования и результат на месте
+    bool isUnchanged(const std::string& name, const std::string& source_path) const;
+
+    // Ссылается ли какая-либо запись на результат
+    bool references(const std::string& output) const;
+
+    // Добавление/замена записи. Может вызываться из нескольких потоков
+    void record(const Entry& entry);
+
+    // Сохранение через временный файл
+    void save() const;
+
+private:
+    std::string dest_dir;
+    file_engine::Key key;
+
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> entries;
+};
+
+} // namespace manifest
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <ostream>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "display_sink.h"
+
+// Не больше стольких событий хранит трасса; остальные только считаются
+#define PROFILER_MAX_TRACE_EVENTS 100000
+
+// Примитивы рисования TFTDisplay, по которым ведется учет
+enum class RenderPrimitive {
+    CLEAR_SCREEN,
+    DRAW_PIXEL,
+    DRAW_LINE,
+    DRAW_RECT,
+    FILL_RECT,
+    DRAW_CIRCLE,
+    FILL_CIRCLE,
+    SCROLL_RECT,
+    DRAW_CHAR,
+    DRAW_TEXT,
+    DRAW_IMAGE,
+    FLUSH,
+    COUNT
+};
+
+// Учет отрисовки по экранам: вызовы и время примитивов, кадры, окна
+// адресации и обмен с панелью. Экран — именованный участок кода (drawMenu,
+// экран прогресса), размеченный RenderProfiler::Screen. Кадр относится к
+// экрану, в котором был вызван flush(), хотя выводит его поток вывода.
+// Время примитивов включает вложенные вызовы (drawRect — четыре drawLine).
+// Выключенный учет стоит одной проверки флага на вызов
+class RenderProfiler {
+public:
+    // Разметка экрана на время жизни объекта. name — строковый литерал
+    class Screen {
+    public:
+        Screen(RenderProfiler& profiler, const char* name);
+        ~Screen();
+        Screen(const Screen&) = delete;
+        Screen& operator=(const Screen&) = delete;
+
+    private:
+        RenderProfiler* profiler;  // nullptr — учет выключен
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Замер вызова примитива на время жизни объекта
+    class Timer {
+    public:
+        Timer(RenderProfiler& profiler, RenderPrimitive primitive);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        RenderProfiler* profiler;
+        RenderPrimitive primitive;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Вывод кадра на панель (поток вывода)
+    struct FrameRecord {
+        uint16_t screen;                             // Экран, в котором вызван flush()
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+        uint32_t windows;                            // Окон адресации (RAMWR)
+        uint64_t pixels;                             // Точек в окнах
+        SinkStats traffic;                           // Обмен с панелью за время вывода
+    };
+
+    RenderProfiler();
+
+    // Включение начинает отсчет времени трассы заново
+    void setEnabled(bool enabled);
+    bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+    // Текущий экран для кадра, переданного flush()
+    uint16_t currentScreen();
+    void framePublished(uint16_t screen);
+    void framePresented(const FrameRecord& record);
+
+    // Сброс накопленного учета (разметка экранов сохраняется)
+    void reset();
+
+    // Отчет в виде таблиц по экранам и примитивам
+    void writeReport(std::ostream& out);
+
+    // Трасса в формате Trace Event (chrome://tracing, Perfetto): экраны —
+    // в потоке 1, выведенные кадры с обменом — в потоке 2
+    void writeTrace(std::ostream& out);
+
+    static const char* primitiveName(RenderPrimitive primitive);
+
+private:
+    struct PrimitiveStats {
+        uint64_t calls = 0;
+        uint64_t ns = 0;
+    };
+
+    struct ScreenStats {
+        explicit ScreenStats(const char* name) : name(name) {}
+
+        const char* name;
+        uint64_t calls = 0;
+        uint64_t ns = 0;                 // Время внутри экрана
+        uint64_t frames_published = 0;   // Вызовов flush() с изменениями
+        uint64_t frames_presented = 0;   // Выведено кадров (остальные поглощены следующими)
+        uint64_t windows = 0;
+        uint64_t pixels = 0;
+        SinkStats traffic;
+        PrimitiveStats primitives[static_cast<size_t>(RenderPrimitive::COUNT)];
+    };
+
+    struct TraceEvent {
+        uint16_t screen;
+        bool frame;                      // Вывод кадра, иначе экран
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        uint32_t windows;
+        uint64_t pixels;
+        SinkStats traffic;
+    };
+
+    uint16_t screenIndex(const char* name);
+    uint64_t sinceOrigin(std::chrono::steady_clock::time_point time) const;
+    void addTrace(const TraceEvent& event);
+
+    std::atomic<bool> active;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point origin;  // Начало отсчета трассы
+    std::vector<ScreenStats> screens;              // [0] — вне размеченных экранов
+    std::vector<uint16_t> screen_stack;            // Вложенные экраны
+    std::vector<TraceEvent> trace;
+    uint64_t dropped_events;
+};
@@ -5,8 +5,13 @@
 #include <gpiod.h>
 #include <linux/spi/spidev.h>
 #include <memory>
+#include <vector>
+#include "display_sink.h"
 
-class SPIDevice {
+// Участки короче этого копируются в очередь передачи
+#define SPI_COPY_THRESHOLD 64
+
+class SPIDevice : public DisplaySink {
 private:
     int spi_fd;                    // File descriptor для SPI
     int spi_channel;
@@ -17,15 +22,42 @@ private:
     struct gpiod_line *rst_line;   // Линия RST
     int dc_pin;                    // Номер пина DC
     int rst_pin;                   // Номер пина RST
+    int dc_state;                  // Последнее выставленное значение DC (-1 — неизвестно)
+    size_t max_transfer;           // Наибольший объем одного ioctl (параметр bufsiz модуля spidev)
+
+    // Участок очереди передачи: команда или данные. Короткие участки
+    // копируются в staging, длинные передаются по указателю без копирования
+    struct Segment {
+        bool data;
+        const uint8_t* external;   // nullptr — участок лежит в staging
+        size_t offset;
+        size_t length;
+    };
+    std::vector<Segment> segments;
+    std::vector<uint8_t> staging;
+    std::vector<struct spi_ioc_transfer> transfers;
+    SinkStats counters;            // Счетчики обмена
+
+    // Отправка одной группы передач за один ioctl
+    void transfer(struct spi_ioc_transfer* batch, size_t count);
     
 public:
     SPIDevice(int channel = 0, uint32_t speed = 8000000);
-    ~SPIDevice();
+    ~SPIDevice() override;
     
-    bool init();
+    bool init() override;
     void write(uint8_t* data, size_t length);
     void setDC(bool state);
-    void setRST(bool state);
+
+    // Очередь передачи. Участки подряд с одним значением DC уходят
+    // цепочками spi_ioc_transfer в одном ioctl (в пределах bufsiz), DC
+    // переключается только на границе команды и данных. Данные длиннее
+    // SPI_COPY_THRESHOLD не копируются и должны жить до submit()
+    void queueCommand(uint8_t cmd) override;
+    void queueData(const uint8_t* data, size_t length) override;
+    void submit() override;
+    void setRST(bool state) override;
+    SinkStats stats() const override { return counters; }
     void delay(uint32_t ms);
     void waitForTransferComplete();
 }; 
\ No newline at end of file
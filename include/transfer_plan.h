@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include "transfer_scheduler.h"
+#include "device_profile.h"
+
+// План пакетной обработки, составляемый до начала работы: объем входа
+// и результата, проверка свободного места на носителе назначения и оценка
+// времени по сохраненным профилям носителей. Пакет, который не помещается,
+// не начинается вовсе, а не обрывается на середине файла.
+namespace transfer_plan {
+
+// Запас свободного места сверх размера результата: временные файлы,
+// манифест, журнал контрольных точек и служебные структуры файловой системы
+constexpr uint64_t FREE_SPACE_RESERVE = 4 * 1024 * 1024;
+
+// Через столько секунд оценка времени переходит с профилей на измеренную скорость
+constexpr double MEASURED_RATE_AFTER = 3.0;
+
+// За столько последних секунд усредняется текущая скорость на дисплее
+constexpr double RATE_WINDOW = 3.0;
+
+struct Plan {
+    std::vector<transfer_scheduler::Job> jobs;
+    uint64_t input_bytes = 0;        // Сумма размеров заданий
+    uint64_t output_bytes = 0;       // Сумма ожидаемых размеров результата
+    uint64_t free_bytes = 0;         // Свободно на носителе назначения
+    uint64_t allocated_bytes = 0;    // Уже занято недописанными файлами продолжаемых заданий
+    double estimated_seconds = 0;    // Оценка времени (0 — профили носителей неизвестны)
+
+    // Помещается ли результат на носитель назначения. Недописанный файл
+    // зарезервирован целиком при первой попытке, и это место уже не свободно
+    bool fits() const { return output_bytes + FREE_SPACE_RESERVE <= free_bytes + allocated_bytes; }
+
+    // Сколько не хватает места (0, если помещается)
+    uint64_t shortage() const {
+        return fits() ? 0 : output_bytes + FREE_SPACE_RESERVE - free_bytes - allocated_bytes;
+    }
+};
+
+// Свободное для пользователя место на файловой системе, где находится path
+uint64_t freeSpace(const std::string& path);
+
+// Место, выделенное файлу на носителе (0, если файла нет)
+uint64_t allocatedSpace(const std::string& path);
+
+// Составление плана. Размеры результата берутся из Job::output_size,
+// скорость чтения и записи — из профилей носителей. allocated_bytes —
+// место, уже выделенное недописанным файлам заданий, продолжаемых
+// с контрольной точки
+Plan make(std::vector<transfer_scheduler::Job> jobs, const std::string& dest_path,
+          const device_profile::Profile& source, const device_profile::Profile& dest,
+          uint64_t allocated_bytes = 0);
+
+// Оставшееся время по ходу выполнения: сначала по оценке плана, затем
+// по средней скорости с начала пакета. Отрицательное значение — неизвестно
+double remainingSeconds(const Plan& plan, const transfer_scheduler::Progress& progress, double elapsed_seconds);
+
+// Короткая запись времени для дисплея: «40 с», «12 мин», «2 ч 05 мин»
+std::string formatDuration(double seconds);
+
+// Текущая скорость по отсчетам хода выполнения за последние RATE_WINDOW
+// секунд: запись на флешку идет рывками, и мгновенная скорость скачет
+class RateMeter {
+public:
+    // Отсчет: секунд с начала пакета и обработано байт к этому моменту
+    void add(double seconds, uint64_t bytes_done);
+
+    // Байт в секунду. Отрицательное значение — отсчетов пока мало
+    double bytesPerSecond() const;
+
+private:
+    std::deque<std::pair<double, uint64_t>> samples;
+};
+
+// Короткая запись скорости для дисплея: «4.2 МБ/с», «37 МБ/с»
+std::string formatRate(double bytes_per_second);
+
+} // namespace transfer_plan
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include "file_engine.h"
+
+namespace transfer_scheduler {
+
+// Файлы меньше этого размера обрабатываются пачками
+constexpr uint64_t SMALL_FILE_LIMIT = 1024 * 1024;
+
+// Максимум файлов в пачке мелких файлов
+constexpr size_t SMALL_BATCH_FILES = 32;
+
+// Максимум рабочих потоков
+constexpr size_t MAX_WORKERS = 4;
+
+// Один файл пакета
+struct Job {
+    std::string source;  // Исходный файл
+    std::string dest;    // Файл назначения
+    std::string name;    // Имя для отображения
+    uint64_t size;       // Размер исходного файла
+    uint64_t output_size = 0;  // Ожидаемый размер результата (для планирования)
+};
+
+// Состояние выполнения пакета
+struct Progress {
+    size_t files_done;
+    size_t files_total;
+    uint64_t bytes_done;
+    uint64_t bytes_total;
+    std::string current_file;  // Последний начатый файл
+};
+
+// Количество рабочих потоков: по числу ядер, но не больше, чем носитель
+// назначения успевает принимать (глубина очереди + 1 поток на шифрование)
+size_t workerCount(size_t queue_depth);
+
+// Порядок обработки: крупные файлы по убыванию размера вперемешку с пачками
+// мелких, чтобы пока один поток пишет большой файл, другие разбирали мелочь
+// и оба носителя были заняты. Каждый элемент — задание для одного потока
+std::vector<std::vector<Job>> orderJobs(std::vector<Job> jobs);
+
+// Параллельная обработка пакета файлов на пуле потоков
+class Scheduler {
+public:
+    // Обработка одного файла; исключение считается ошибкой этого файла
+    using Processor = std::function<void(const Job&, const file_engine::Options&)>;
+    // Вызывается в потоке run() для отображения хода выполнения
+    using TickCallback = std::function<void(const Progress&)>;
+
+    Scheduler(std::vector<Job> jobs, size_t workers);
+
+    // Обработка всех файлов. Блокирует вызывающий поток, периодически вызывая on_tick
+    void run(const Processor& process, const file_engine::Options& options,
+             const TickCallback& on_tick, std::chrono::milliseconds tick_interval);
+
+    Progress progress() const;
+
+    // Ошибки в формате «имя файла: сообщение»
+    std::vector<std::string> errors() const;
+
+private:
+    void workerLoop(const Processor& process, const file_engine::Options& options);
+
+    std::vector<std::vector<Job>> tasks;
+    size_t worker_count;
+    size_t files_total;
+    uint64_t bytes_total;
+
+    std::atomic<size_t> next_task;
+    std::atomic<size_t> files_done;
+    std::atomic<uint64_t> bytes_done;
+
+    mutable std::mutex state_mutex;
+    std::string current_file;
+    std::vector<std::string> error_list;
+};
+
+} // namespace transfer_scheduler
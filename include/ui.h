@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "display_pi.h"
+
+// Интерфейс с сохраняемым состоянием: экран — набор виджетов (надписи,
+// рамки, кнопки, список с отметками, полоса прогресса). Виджет помнит, что
+// на нем нарисовано, и при изменении состояния отмечает себя; Stage
+// перерисовывает только отмеченные виджеты. Смена экрана рисует новый
+// экран целиком, после модального сообщения восстанавливаются только
+// закрытые им виджеты. Текст — шрифтом CYRILLIC_FONT в UTF-8
+namespace ui {
+
+// Расстояние между символами текста
+constexpr int16_t LETTER_SPACING = 2;
+
+// Разметка строк (символы шрифта и их смещения) кэшируется: повторные
+// измерение и вывод той же строки не разбирают UTF-8 и не выделяют память.
+// Строки, которые меняются при каждом обновлении (счетчики, скорость,
+// оставшееся время), кэшируются отдельно, чтобы не вытеснять постоянные
+enum class TextCache {
+    STABLE,
+    TRANSIENT
+};
+
+// Ширина текста в точках
+int16_t textWidth(const std::string& text, TextCache cache = TextCache::STABLE);
+
+// Ширина текста, обрезанного до max_width точек (см. drawText)
+int16_t textWidth(const std::string& text, int16_t max_width, TextCache cache = TextCache::STABLE);
+
+// Вывод текста без очистки фона; x, y — левый верхний угол. Текст шире
+// max_width точек обрезается по символам с «...»
+void drawText(TFTDisplay& display, const std::string& text, int16_t x, int16_t y, uint16_t color,
+              int16_t max_width = INT16_MAX, TextCache cache = TextCache::STABLE);
+
+// Прямоугольник экрана
+struct Rect {
+    int16_t x, y, w, h;
+
+    bool intersects(const Rect& other) const {
+        return x < other.x + other.w && other.x < x + w &&
+               y < other.y + other.h && other.y < y + h;
+    }
+};
+
+enum class Align {
+    LEFT,
+    CENTER
+};
+
+// Базовый виджет. Полная перерисовка нужна после invalidate() (смена
+// экрана, закрытие сообщения), частичная — после изменения состояния
+class Widget {
+public:
+    explicit Widget(const Rect& bounds) : area(bounds) {}
+    virtual ~Widget() = default;
+
+    const Rect& bounds() const { return area; }
+    void invalidate() { damaged = true; }
+
+    // Отрисовка, если виджет отмечен
+    void render(TFTDisplay& display);
+
+protected:
+    // full — область виджета не содержит его прежнего изображения
+    virtual void draw(TFTDisplay& display, bool full) = 0;
+
+    void markChanged() { changed = true; }
+
+    // Новое значение поля; виджет отмечается только при изменении
+    template <typename T>
+    void update(T& field, const T& value) {
+        if (!(field == value)) {
+            field = value;
+            changed = true;
+        }
+    }
+
+private:
+    Rect area;
+    bool damaged = true;
+    bool changed = false;
+};
+
+// Строка текста на своем фоне
+class Label : public Widget {
+public:
+    Label(const Rect& bounds, const std::string& text, uint16_t color,
+          Align align = Align::LEFT, uint16_t background = COLOR_BLACK);
+
+    void setText(const std::string& text) { update(content, text); }
+    void setColor(uint16_t color) { update(text_color, color); }
+
+    // Кэш разметки текста: TRANSIENT — для текста, меняющегося при каждом обновлении
+    void setTextCache(TextCache value) { cache = value; }
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    std::string content;
+    uint16_t text_color;
+    Align alignment;
+    uint16_t background;
+    TextCache cache = TextCache::STABLE;
+};
+
+// Рамка без заливки: содержимое рисуют другие виджеты
+class Box : public Widget {
+public:
+    Box(const Rect& bounds, uint16_t color) : Widget(bounds), color(color) {}
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    uint16_t color;
+};
+
+// Горизонтальная линия
+class Line : public Widget {
+public:
+    Line(int16_t x0, int16_t x1, int16_t y, uint16_t color)
+        : Widget({x0, y, static_cast<int16_t>(x1 - x0 + 1), 1}), color(color) {}
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    uint16_t color;
+};
+
+// Пункт меню: рамка с текстом по центру, выбранный — на синем фоне
+class Button : public Widget {
+public:
+    Button(const Rect& bounds, const std::string& text) : Widget(bounds), text(text) {}
+
+    void setSelected(bool value) { update(selected, value); }
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    std::string text;
+    bool selected = false;
+};
+
+// Список с отметками «[X]» и текущей строкой. Видимая часть сдвигается
+// ровно настолько, чтобы текущая строка была на экране; сдвиг на одну
+// строку прокручивает уже нарисованные строки (TFTDisplay::scrollRect),
+// перерисовываются только строки, которые изменились
+class CheckList : public Widget {
+public:
+    struct Item {
+        std::string text;
+        bool checked;
+    };
+
+    CheckList(const Rect& bounds, int16_t row_height);
+
+    void setItems(std::vector<Item> items);
+    void setChecked(size_t index, bool checked);
+    void setCurrent(size_t index);
+
+    size_t current() const { return current_row; }
+    size_t size() const { return rows.size(); }
+    size_t visibleRows() const;
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    void drawRow(TFTDisplay& display, size_t index);
+    void touch(size_t index);
+
+    int16_t row_height;
+    std::vector<Item> rows;
+    size_t current_row = 0;
+    size_t top = 0;
+    size_t drawn_top = 0;
+    std::vector<size_t> touched;  // Строки, изменившиеся после отрисовки
+};
+
+// Полоса прогресса в рамке: дорисовывается только изменившийся отрезок
+class ProgressBar : public Widget {
+public:
+    ProgressBar(const Rect& bounds, uint16_t color) : Widget(bounds), color(color) {}
+
+    void setProgress(uint64_t done, uint64_t total);
+
+protected:
+    void draw(TFTDisplay& display, bool full) override;
+
+private:
+    uint16_t color;
+    int16_t filled = 0;
+    int16_t drawn = 0;
+};
+
+// Экран: виджеты в порядке отрисовки. Виджеты принадлежат владельцу экрана
+class Screen {
+public:
+    explicit Screen(uint16_t background = COLOR_BLACK) : fill(background) {}
+
+    void add(Widget& widget) { widgets.push_back(&widget); }
+    uint16_t background() const { return fill; }
+
+    // Отметка всех виджетов или только пересекающих область
+    void invalidate();
+    void invalidate(const Rect& area);
+
+    void render(TFTDisplay& display);
+
+private:
+    std::vector<Widget*> widgets;
+    uint16_t fill;
+};
+
+// Показ экранов на дисплее
+class Stage {
+public:
+    explicit Stage(TFTDisplay& display) : display(display) {}
+
+    // Показ экрана и вывод изменений. Другой экран рисуется целиком,
+    // тот же — только изменившимися виджетами и виджетами под сообщением
+    void show(Screen& screen);
+
+    // Дисплей перерисован в обход Stage: следующий show() нарисует экран целиком
+    void release() { active = nullptr; }
+
+    // Модальное сообщение в рамке по центру поверх текущего экрана.
+    // Остается на дисплее до следующего show()
+    void showMessage(const std::vector<std::string>& lines, uint16_t color);
+
+private:
+    TFTDisplay& display;
+    Screen* active = nullptr;
+    bool message_shown = false;
+    Rect message_area{0, 0, 0, 0};
+};
+
+} // namespace ui
@@ -1,103 +1,96 @@
 #pragma once
 
-#include <iostream>
-#include <map>
-#include <string>
+#include <cstddef>
+#include <cstdint>
 
+// Разбор UTF-8 для кириллического шрифта. Русские буквы А..я занимают в
+// Юникоде подряд U+0410..U+044F и в шрифте — подряд индексы 128..191,
+// поэтому индекс вычисляется из кода символа без таблицы и поиска
+namespace utf8 {
 
+// Первый индекс русских букв в шрифте (А)
+constexpr uint8_t CYRILLIC_FIRST_INDEX = 128;
 
-namespace utf8 {
+// Индекс для символа, которого нет в шрифте
+constexpr uint8_t UNKNOWN_INDEX = '?';
 
-uint8_t russian_char_to_index(unsigned char c1, unsigned char c2) {
+// Индекс в шрифте для двухбайтовой последовательности c1 c2 или ASCII c1
+constexpr uint8_t russian_char_to_index(unsigned char c1, unsigned char c2) {
+    if (c1 < 0x80) {
+        return c1;
+    }
+    uint16_t code = static_cast<uint16_t>(((c1 & 0x1F) << 6) | (c2 & 0x3F));
+    if ((c1 & 0xE0) == 0xC0 && (c2 & 0xC0) == 0x80 && code >= 0x410 && code <= 0x44F) {
+        return static_cast<uint8_t>(CYRILLIC_FIRST_INDEX + (code - 0x410));
+    }
+    return UNKNOWN_INDEX;
+}
 
+// Байт продолжения без начального байта: символа нет, байт пропускается
+constexpr uint8_t NO_GLYPH = 0;
 
-    static const std::map<uint16_t, uint8_t> utf8_to_cyrillic = {
-        // Заглавные буквы
-        { 0xD090, 128 }, // А
-        { 0xD091, 129 }, // Б
-        { 0xD092, 130 }, // В
-        { 0xD093, 131 }, // Г
-        { 0xD094, 132 }, // Д
-        { 0xD095, 133 }, // Е
-        { 0xD096, 134 }, // Ж
-        { 0xD097, 135 }, // З
-        { 0xD098, 136 }, // И
-        { 0xD099, 137 }, // Й
-        { 0xD09A, 138 }, // К
-        { 0xD09B, 139 }, // Л
-        { 0xD09C, 140 }, // М
-        { 0xD09D, 141 }, // Н
-        { 0xD09E, 142 }, // О
-        { 0xD09F, 143 }, // П
-        { 0xD0A0, 144 }, // Р
-        { 0xD0A1, 145 }, // С
-        { 0xD0A2, 146 }, // Т
-        { 0xD0A3, 147 }, // У
-        { 0xD0A4, 148 }, // Ф
-        { 0xD0A5, 149 }, // Х
-        { 0xD0A6, 150 }, // Ц
-        { 0xD0A7, 151 }, // Ч
-        { 0xD0A8, 152 }, // Ш
-        { 0xD0A9, 153 }, // Щ
-        { 0xD0AA, 154 }, // Ъ
-        { 0xD0AB, 155 }, // Ы
-        { 0xD0AC, 156 }, // Ь
-        { 0xD0AD, 157 }, // Э
-        { 0xD0AE, 158 }, // Ю
-        { 0xD0AF, 159 }, // Я
-        
-        // Строчные буквы
-        { 0xD0B0, 160 }, // а
-        { 0xD0B1, 161 }, // б
-        { 0xD0B2, 162 }, // в
-        { 0xD0B3, 163 }, // г
-        { 0xD0B4, 164 }, // д
-        { 0xD0B5, 165 }, // е
-        { 0xD0B6, 166 }, // ж
-        { 0xD0B7, 167 }, // з
-        { 0xD0B8, 168 }, // и
-        { 0xD0B9, 169 }, // й
-        { 0xD0BA, 170 }, // к
-        { 0xD0BB, 171 }, // л
-        { 0xD0BC, 172 }, // м
-        { 0xD0BD, 173 }, // н
-        { 0xD0BE, 174 }, // о
-        { 0xD0BF, 175 }, // п
-        { 0xD180, 176 }, // р
-        { 0xD181, 177 }, // с
-        { 0xD182, 178 }, // т
-        { 0xD183, 179 }, // у
-        { 0xD184, 180 }, // ф
-        { 0xD185, 181 }, // х
-        { 0xD186, 182 }, // ц
-        { 0xD187, 183 }, // ч
-        { 0xD188, 184 }, // ш
-        { 0xD189, 185 }, // щ
-        { 0xD18A, 186 }, // ъ
-        { 0xD18B, 187 }, // ы
-        { 0xD18C, 188 }, // ь
-        { 0xD18D, 189 }, // э
-        { 0xD18E, 190 }, // ю
-        { 0xD18F, 191 }  // я
-    };
-    
+// Символ строки: индекс в шрифте и длина в байтах
+struct Glyph {
+    uint8_t index;
+    uint8_t length;
+};
 
-    uint16_t key = ((uint16_t)c1 << 8) | c2;
-    
+constexpr bool isContinuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
 
-    auto it = utf8_to_cyrillic.find(key);
-    if (it != utf8_to_cyrillic.end()) {
-        std::cout << "  Найдено соответствие: индекс шрифта " << (int)it->second << std::endl;
-        return it->second;
+// Длина последовательности по начальному байту; 0 — байт продолжения
+// или недопустимый байт
+constexpr size_t sequenceLength(unsigned char c1) {
+    if (c1 < 0x80) {
+        return 1;
     }
-    
-
-    if (c1 < 128) {
-        return c1;
+    if ((c1 & 0xE0) == 0xC0) {
+        return 2;
     }
+    if ((c1 & 0xF0) == 0xE0) {
+        return 3;
+    }
+    if ((c1 & 0xF8) == 0xF0) {
+        return 4;
+    }
+    return 0;
+}
 
-    std::cout << "  Символ не найден в таблице!" << std::endl;
-    return 0; // Пробел
+// Символ с позиции pos. Последовательность, которой нет в шрифте (или
+// оборванная), дает один символ UNKNOWN_INDEX на все свои байты; байт
+// продолжения без начала дает NO_GLYPH
+constexpr Glyph decode(const char* text, size_t length, size_t pos) {
+    unsigned char c1 = static_cast<unsigned char>(text[pos]);
+    if (c1 < 0x80) {
+        return {c1, 1};
+    }
+    size_t expected = sequenceLength(c1);
+    if (expected == 0) {
+        return {isContinuation(c1) ? NO_GLYPH : UNKNOWN_INDEX, 1};
+    }
+    size_t count = 1;
+    while (count < expected && pos + count < length &&
+           isContinuation(static_cast<unsigned char>(text[pos + count]))) {
+        count++;
+    }
+    if (expected == 2 && count == 2) {
+        return {russian_char_to_index(c1, static_cast<unsigned char>(text[pos + 1])), 2};
+    }
+    return {UNKNOWN_INDEX, static_cast<uint8_t>(count)};
 }
 
-} // namespace utf8 
\ No newline at end of file
+static_assert(russian_char_to_index(0xD0, 0x90) == 128, "А");
+static_assert(russian_char_to_index(0xD0, 0xBF) == 175, "п");
+static_assert(russian_char_to_index(0xD1, 0x80) == 176, "р");
+static_assert(russian_char_to_index(0xD1, 0x8F) == 191, "я");
+static_assert(russian_char_to_index(0xD1, 0x91) == UNKNOWN_INDEX, "ё нет в шрифте");
+static_assert(russian_char_to_index('A', 0) == 'A', "ASCII");
+static_assert(decode("\xD0\xAF", 2, 0).index == 159 && decode("\xD0\xAF", 2, 0).length == 2, "Я");
+static_assert(decode("\xE2\x80\x94", 3, 0).index == UNKNOWN_INDEX &&
+              decode("\xE2\x80\x94", 3, 0).length == 3, "тире — один неизвестный символ");
+static_assert(decode("\xC0\x80", 2, 0).index == UNKNOWN_INDEX, "нет в шрифте");
+static_assert(decode("\xD0" "A", 2, 0).length == 1, "оборванная последовательность");
+static_assert(decode("\x80", 1, 0).index == NO_GLYPH, "байт продолжения");
+
+} // namespace utf8
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "display_sink.h"
+
+// Размер буфера spidev по умолчанию: по нему считается, сколько ioctl
+// понадобилось бы SPIDevice
+#define VIRTUAL_PANEL_BUFSIZ 4096
+
+// Панель ST7735 в памяти: разбирает поток команд так же, как контроллер
+// (CASET, RASET, RAMWR, MADCTL), хранит получившееся изображение и считает
+// обмен так, как его считал бы SPIDevice. Память панели адресуется в текущей ориентации: при смене осей
+// (бит MV в MADCTL) она очищается. Позволяет запускать и замерять
+// отрисовку без дисплея
+class VirtualPanel : public DisplaySink {
+public:
+    // clock_hz — частота SPI для расчета времени передачи
+    explicit VirtualPanel(uint32_t clock_hz = 8000000);
+
+    bool init() override;
+    void setRST(bool state) override;
+    void queueCommand(uint8_t cmd) override;
+    void queueData(const uint8_t* data, size_t length) override;
+    void submit() override;
+    SinkStats stats() const override;
+
+    int width() const;
+    int height() const;
+    uint16_t pixel(int x, int y) const;  // RGB565
+
+    // Запись изображения панели в PPM (P6). false при ошибке записи
+    bool dumpPpm(const std::string& path) const;
+
+private:
+    struct Segment {
+        bool data;
+        std::vector<uint8_t> bytes;
+    };
+
+    void command(uint8_t cmd);
+    void data(uint8_t byte);
+
+    uint32_t clock_hz;
+    mutable std::mutex mutex;
+    std::vector<Segment> queue;
+    SinkStats counters;
+    int dc_state;                // -1 — неизвестно
+
+    int panel_width;
+    int panel_height;
+    std::vector<uint16_t> memory;
+
+    uint8_t current_command;
+    std::vector<uint8_t> arguments;
+    int column_start, column_end;
+    int row_start, row_end;
+    int column, row;
+    bool high_byte;
+    uint8_t pending_byte;
+};
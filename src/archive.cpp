@@ -0,0 +1,612 @@
+#include "archive.h"
+#include "file_io.h"
+#include "cmac.h"
+#include "byte_order.h"
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <unistd.h>
+
+namespace archive {
+
+namespace {
+
+// Постоянная часть записи оглавления (без имени)
+constexpr size_t RECORD_FIXED_SIZE = 2 + 8 + 8 + counter_mode::IV_SIZE + file_engine::MAC_SIZE;
+
+// Оглавление больше этого считается испорченным
+constexpr uint64_t MAX_INDEX_SIZE = 64ULL * 1024 * 1024;
+
+using byte_order::putLe;
+using byte_order::getLe;
+
+struct Header {
+    uint32_t member_count;
+    uint64_t index_offset;
+    uint64_t index_size;
+    uint8_t index_iv[counter_mode::IV_SIZE];
+};
+
+void encodeHeader(const Header& header, uint8_t* out) {
+    std::memset(out, 0, HEADER_SIZE);
+    std::memcpy(out, MAGIC, sizeof(MAGIC));
+    putLe(out + 8, VERSION, 4);
+    putLe(out + 12, header.member_count, 4);
+    putLe(out + 16, header.index_offset, 8);
+    putLe(out + 24, header.index_size, 8);
+    std::memcpy(out + 32, header.index_iv, counter_mode::IV_SIZE);
+}
+
+bool decodeHeader(const uint8_t* in, Header& header) {
+    if (std::memcmp(in, MAGIC, sizeof(MAGIC)) != 0 || getLe(in + 8, 4) != VERSION) {
+        return false;
+    }
+    header.member_count = static_cast<uint32_t>(getLe(in + 12, 4));
+    header.index_offset = getLe(in + 16, 8);
+    header.index_size = getLe(in + 24, 8);
+    std::memcpy(header.index_iv, in + 32, counter_mode::IV_SIZE);
+    return true;
+}
+
+Header readHeader(int fd, uint64_t file_size) {
+    uint8_t raw[HEADER_SIZE];
+    Header header;
+    if (file_io::readAt(fd, raw, sizeof(raw), 0) != sizeof(raw) || !decodeHeader(raw, header)) {
+        throw std::runtime_error("Файл не является архивом");
+    }
+    if (header.index_size > MAX_INDEX_SIZE || header.index_offset < HEADER_SIZE ||
+        header.index_offset + header.index_size + file_engine::MAC_SIZE != file_size) {
+        throw std::runtime_error("Заголовок архива поврежден");
+    }
+    return header;
+}
+
+uint64_t indexSize(const std::vector<Member>& members) {
+    uint64_t size = 0;
+    for (const auto& member : members) {
+        size += RECORD_FIXED_SIZE + member.name.size();
+    }
+    return size;
+}
+
+std::vector<uint8_t> encodeIndex(const std::vector<Member>& members) {
+    std::vector<uint8_t> out(indexSize(members));
+    uint8_t* p = out.data();
+    for (const auto& member : members) {
+        putLe(p, member.name.size(), 2);
+        p += 2;
+        std::memcpy(p, member.name.data(), member.name.size());
+        p += member.name.size();
+        putLe(p, member.offset, 8);
+        putLe(p + 8, member.size, 8);
+        p += 16;
+        std::memcpy(p, member.iv, counter_mode::IV_SIZE);
+        p += counter_mode::IV_SIZE;
+        std::memcpy(p, member.mac, file_engine::MAC_SIZE);
+        p += file_engine::MAC_SIZE;
+    }
+    return out;
+}
+
+std::vector<Member> decodeIndex(const std::vector<uint8_t>& data, const Header& header) {
+    std::vector<Member> members;
+    size_t pos = 0;
+    for (uint32_t i = 0; i < header.member_count; i++) {
+        if (data.size() - pos < RECORD_FIXED_SIZE) {
+            throw std::runtime_error("Оглавление архива повреждено");
+        }
+        size_t name_length = getLe(data.data() + pos, 2);
+        pos += 2;
+        if (data.size() - pos < RECORD_FIXED_SIZE - 2 + name_length) {
+            throw std::runtime_error("Оглавление архива повреждено");
+        }
+        Member member;
+        member.name.assign(reinterpret_cast<const char*>(data.data() + pos), name_length);
+        pos += name_length;
+        member.offset = getLe(data.data() + pos, 8);
+        member.size = getLe(data.data() + pos + 8, 8);
+        pos += 16;
+        std::memcpy(member.iv, data.data() + pos, counter_mode::IV_SIZE);
+        pos += counter_mode::IV_SIZE;
+        std::memcpy(member.mac, data.data() + pos, file_engine::MAC_SIZE);
+        pos += file_engine::MAC_SIZE;
+
+        if (member.offset < HEADER_SIZE || member.size > header.index_offset - member.offset ||
+            member.offset > header.index_offset) {
+            throw std::runtime_error("Оглавление архива повреждено");
+        }
+        members.push_back(std::move(member));
+    }
+    // Число записей берется из открытого заголовка, а имитовставка покрывает
+    // только оглавление: лишние байты значат, что число записей изменено
+    if (pos != data.size()) {
+        throw std::runtime_error("Оглавление архива повреждено");
+    }
+    return members;
+}
+
+// Имя файла внутри архива без каталогов, чтобы при извлечении
+// нельзя было выйти за пределы каталога назначения
+std::string safeName(const std::string& name) {
+    std::string result = std::filesystem::path(name).filename().string();
+    if (result.empty() || result == "." || result == "..") {
+        throw std::runtime_error("Недопустимое имя файла в архиве: " + name);
+    }
+    return result;
+}
+
+// Вывод архива полными порциями: данные мелких файлов накапливаются
+// в буфере и пишутся по выровненным смещениям. Буфер на блок шифра
+// длиннее порции, чтобы порции данных файла оставались кратны блоку
+class OutputStream {
+public:
+    OutputStream(int fd, const file_engine::Options& options)
+        : writer(fd, options), options(options),
+          chunk(file_engine::chunkSize(options)),
+          buffer(file_io::BufferPool::instance().acquire(chunk + counter_mode::BLOCK_SIZE)),
+          fill(0), out_offset(0) {}
+
+    // Свободное место в буфере
+    uint8_t* tail() { return buffer.data() + fill; }
+    size_t available() const { return chunk + counter_mode::BLOCK_SIZE - fill; }
+
+    // Учесть данные, записанные в tail()
+    void commit(size_t length) {
+        fill += length;
+        if (fill >= chunk) {
+            flush();
+        }
+    }
+
+    void append(const uint8_t* data, size_t length) {
+        while (length > 0) {
+            size_t part = std::min(length, available());
+            std::memcpy(tail(), data, part);
+            commit(part);
+            data += part;
+            length -= part;
+        }
+    }
+
+    // Запись остатка и ожидание записи всех порций
+    void finish() {
+        if (fill > 0) {
+            writer.write(buffer.data(), fill, out_offset);
+            out_offset += fill;
+            fill = 0;
+        }
+        writer.finish();
+    }
+
+private:
+    void flush() {
+        writer.write(buffer.data(), chunk, out_offset);
+        out_offset += chunk;
+        size_t rest = fill - chunk;
+
+        // После замеров размер следующей порции может измениться
+        chunk = file_engine::chunkSize(options);
+        if (buffer.size() < chunk + counter_mode::BLOCK_SIZE) {
+            auto larger = file_io::BufferPool::instance().acquire(chunk + counter_mode::BLOCK_SIZE);
+            std::memcpy(larger.data(), buffer.data() + fill - rest, rest);
+            buffer = std::move(larger);
+        } else {
+            std::memmove(buffer.data(), buffer.data() + fill - rest, rest);
+        }
+        fill = rest;
+    }
+
+    file_engine::ChunkWriter writer;
+    const file_engine::Options& options;
+    size_t chunk;
+    file_io::BufferPool::Lease buffer;
+    size_t fill;
+    uint64_t out_offset;
+};
+
+// Упаковка одного файла: чтение, имитовставка, гаммирование прямо в буфере вывода
+void packMember(OutputStream& out, const Entry& entry, Member& member,
+                const file_engine::Key& key, const file_engine::Options& options) {
+    file_io::FileDescriptor in;
+    try {
+        in = file_io::openForRead(entry.source);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось открыть исходный файл: " + entry.source);
+    }
+    file_io::adviseSequential(in.get());
+
+    cmac::Context mac_ctx(key.round);
+    counter_mode::Counter ctr;
+    ctr.setValue(member.iv);
+
+    uint64_t done = 0;
+    while (done < member.size) {
+        uint64_t remaining = member.size - done;
+        size_t part = std::min<uint64_t>(remaining, out.available());
+        // Неполным может быть только последний блок файла
+        if (part < remaining) {
+            part -= part % counter_mode::BLOCK_SIZE;
+        }
+
+        uint8_t* data = out.tail();
+        file_engine::readChunk(in.get(), data, part, done, options);
+        mac_ctx.update(data, part);
+        counter_mode::apply_ctr(data, part, ctr, key.round);
+        file_io::dropCache(in.get(), done, part);
+        out.commit(part);
+
+        done += part;
+        if (options.progress) {
+            options.progress(part);
+        }
+    }
+
+    auto mac = mac_ctx.finalize();
+    std::memcpy(member.mac, mac.data(), file_engine::MAC_SIZE);
+}
+
+// Расшифрование данных файла из архива порциями с проверкой имитовставки.
+// sink получает каждую расшифрованную порцию и ее смещение в файле
+bool unpackMember(int fd, const Member& member, const file_engine::Key& key,
+                  const file_engine::Options& options,
+                  const std::function<void(const uint8_t*, size_t, uint64_t)>& sink) {
+    cmac::Context mac_ctx(key.round);
+    counter_mode::Counter ctr;
+    ctr.setValue(member.iv);
+
+    size_t chunk = file_engine::chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(std::min<uint64_t>(chunk, member.size));
+    uint64_t done = 0;
+    while (done < member.size) {
+        size_t part = std::min<uint64_t>(chunk, member.size - done);
+        if (buffer.size() < part) {
+            buffer = file_io::BufferPool::instance().acquire(part);
+        }
+        file_engine::readChunk(fd, buffer.data(), part, member.offset + done, options);
+        counter_mode::apply_ctr(buffer.data(), part, ctr, key.round);
+        mac_ctx.update(buffer.data(), part);
+        if (sink) {
+            sink(buffer.data(), part, done);
+        }
+        file_io::dropCache(fd, member.offset + done, part);
+
+        done += part;
+        chunk = file_engine::chunkSize(options);
+        if (options.progress) {
+            options.progress(part);
+        }
+    }
+
+    auto mac = mac_ctx.finalize();
+    return std::equal(mac.begin(), mac.end(), member.mac);
+}
+
+// Смена ключа одного файла: порция расшифровывается старым ключом и сразу
+// зашифровывается новым в буфере вывода. Открытый текст существует только
+// между двумя наложениями гаммы
+void rekeyMember(int fd, OutputStream& out, Member& member,
+                 const file_engine::Key& old_key, const file_engine::Key& new_key,
+                 const file_engine::Options& options) {
+    cmac::Context old_mac(old_key.round);
+    cmac::Context new_mac(new_key.round);
+    counter_mode::Counter old_ctr;
+    old_ctr.setValue(member.iv);
+    auto new_iv = counter_mode::generate_iv();
+    counter_mode::Counter new_ctr;
+    new_ctr.setValue(new_iv.data());
+
+    uint64_t done = 0;
+    while (done < member.size) {
+        uint64_t remaining = member.size - done;
+        size_t part = std::min<uint64_t>(remaining, out.available());
+        // Неполным может быть только последний блок файла
+        if (part < remaining) {
+            part -= part % counter_mode::BLOCK_SIZE;
+        }
+
+        uint8_t* data = out.tail();
+        file_engine::readChunk(fd, data, part, member.offset + done, options);
+        counter_mode::apply_ctr(data, part, old_ctr, old_key.round);
+        old_mac.update(data, part);
+        new_mac.update(data, part);
+        counter_mode::apply_ctr(data, part, new_ctr, new_key.round);
+        file_io::dropCache(fd, member.offset + done, part);
+        out.commit(part);
+
+        done += part;
+        if (options.progress) {
+            options.progress(part);
+        }
+    }
+
+    auto mac = old_mac.finalize();
+    if (!std::equal(mac.begin(), mac.end(), member.mac)) {
+        throw std::runtime_error("MAC не совпадает: " + member.name);
+    }
+    mac = new_mac.finalize();
+    std::memcpy(member.iv, new_iv.data(), counter_mode::IV_SIZE);
+    std::memcpy(member.mac, mac.data(), file_engine::MAC_SIZE);
+}
+
+// Запись зашифрованного оглавления и его имитовставки
+void appendIndex(OutputStream& stream, const std::vector<Member>& members, const Header& header,
+                 const file_engine::Key& key) {
+    auto index = encodeIndex(members);
+    cmac::Context mac_ctx(key.round);
+    mac_ctx.update(index.data(), index.size());
+    auto index_mac = mac_ctx.finalize();
+    counter_mode::Counter ctr;
+    ctr.setValue(header.index_iv);
+    counter_mode::apply_ctr(index.data(), index.size(), ctr, key.round);
+    stream.append(index.data(), index.size());
+    stream.append(index_mac.data(), index_mac.size());
+}
+
+} // namespace
+
+bool isArchive(const std::string& path) {
+    try {
+        file_io::FileDescriptor fd = file_io::openForRead(path);
+        uint8_t raw[HEADER_SIZE];
+        Header header;
+        return file_io::readAt(fd.get(), raw, sizeof(raw), 0) == sizeof(raw) && decodeHeader(raw, header);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool describe(const std::string& path, uint64_t& data_size) {
+    try {
+        file_io::FileDescriptor fd = file_io::openForRead(path);
+        Header header = readHeader(fd.get(), file_io::fileSize(fd.get()));
+        data_size = header.index_offset - HEADER_SIZE;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+uint64_t archiveSize(const std::vector<Entry>& entries) {
+    uint64_t size = HEADER_SIZE + file_engine::MAC_SIZE;
+    for (const auto& entry : entries) {
+        size += std::filesystem::file_size(entry.source) + RECORD_FIXED_SIZE + entry.name.size();
+    }
+    return size;
+}
+
+void create(const std::string& archive_path, const std::vector<Entry>& entries,
+            const file_engine::Key& key, const file_engine::Options& options) {
+    // Оглавление без имитовставок файлов известно заранее, поэтому заголовок
+    // пишется первым, а итоговый размер резервируется целиком
+    std::vector<Member> members;
+    uint64_t offset = HEADER_SIZE;
+    for (const auto& entry : entries) {
+        Member member;
+        member.name = entry.name;
+        if (member.name.size() > UINT16_MAX) {
+            throw std::runtime_error("Слишком длинное имя файла: " + entry.name);
+        }
+        member.offset = offset;
+        member.size = std::filesystem::file_size(entry.source);
+        auto iv = counter_mode::generate_iv();
+        std::memcpy(member.iv, iv.data(), counter_mode::IV_SIZE);
+        std::memset(member.mac, 0, file_engine::MAC_SIZE);
+        offset += member.size;
+        members.push_back(std::move(member));
+    }
+
+    Header header;
+    header.member_count = static_cast<uint32_t>(members.size());
+    header.index_offset = offset;
+    header.index_size = indexSize(members);
+    auto index_iv = counter_mode::generate_iv();
+    std::memcpy(header.index_iv, index_iv.data(), counter_mode::IV_SIZE);
+    uint64_t total_size = header.index_offset + header.index_size + file_engine::MAC_SIZE;
+
+    std::string temp_file = archive_path + ".tmp";
+    file_io::FileDescriptor out;
+    try {
+        out = file_io::openForWrite(temp_file, file_engine::useDirectIo(options, total_size));
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось создать временный файл: " + temp_file);
+    }
+    file_io::preallocate(out.get(), total_size);
+
+    try {
+        OutputStream stream(out.get(), options);
+
+        uint8_t raw_header[HEADER_SIZE];
+        encodeHeader(header, raw_header);
+        stream.append(raw_header, sizeof(raw_header));
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            packMember(stream, entries[i], members[i], key, options);
+        }
+
+        // Оглавление с имитовставками файлов
+        appendIndex(stream, members, header, key);
+        stream.finish();
+    } catch (const std::exception&) {
+        out.close();
+        std::filesystem::remove(temp_file);
+        throw;
+    }
+    out.close();
+
+    if (std::filesystem::file_size(temp_file) != total_size) {
+        std::filesystem::remove(temp_file);
+        throw std::runtime_error("Некорректный размер архива");
+    }
+
+    file_engine::publishFile(temp_file, archive_path);
+
+    if (options.sync_each_file) {
+        sync();
+    }
+}
+
+std::vector<Member> readIndex(const std::string& archive_path, const file_engine::Key& key) {
+    file_io::FileDescriptor in = file_io::openForRead(archive_path);
+    Header header = readHeader(in.get(), file_io::fileSize(in.get()));
+
+    std::vector<uint8_t> index(header.index_size);
+    uint8_t stored_mac[file_engine::MAC_SIZE];
+    if (file_io::readAt(in.get(), index.data(), index.size(), header.index_offset) != index.size() ||
+        file_io::readAt(in.get(), stored_mac, sizeof(stored_mac),
+                        header.index_offset + header.index_size) != sizeof(stored_mac)) {
+        throw std::runtime_error("Не удалось прочитать оглавление архива");
+    }
+
+    counter_mode::Counter ctr;
+    ctr.setValue(header.index_iv);
+    counter_mode::apply_ctr(index.data(), index.size(), ctr, key.round);
+
+    cmac::Context mac_ctx(key.round);
+    mac_ctx.update(index.data(), index.size());
+    auto mac = mac_ctx.finalize();
+    if (!std::equal(mac.begin(), mac.end(), stored_mac)) {
+        throw std::runtime_error("MAC оглавления не совпадает");
+    }
+    return decodeIndex(index, header);
+}
+
+void rekey(const std::string& archive_path, const std::string& dest_file,
+           const file_engine::Key& old_key, const file_engine::Key& new_key,
+           const file_engine::Options& options) {
+    // Оглавление проверяется старым ключом до чтения данных
+    std::vector<Member> members = readIndex(archive_path, old_key);
+
+    file_io::FileDescriptor in = file_io::openForRead(archive_path);
+    uint64_t file_size = file_io::fileSize(in.get());
+    Header header = readHeader(in.get(), file_size);
+
+    // Поток вывода пишет данные подряд, поэтому файлы должны занимать
+    // область данных без промежутков, как их раскладывает create()
+    // (порядок записей оглавления сохраняется)
+    std::vector<Member*> layout;
+    for (auto& member : members) {
+        layout.push_back(&member);
+    }
+    std::sort(layout.begin(), layout.end(),
+              [](const Member* a, const Member* b) { return a->offset < b->offset; });
+    uint64_t offset = HEADER_SIZE;
+    for (const Member* member : layout) {
+        if (member->offset != offset) {
+            throw std::runtime_error("Оглавление архива повреждено");
+        }
+        offset += member->size;
+    }
+    if (offset != header.index_offset) {
+        throw std::runtime_error("Оглавление архива повреждено");
+    }
+
+    auto index_iv = counter_mode::generate_iv();
+    std::memcpy(header.index_iv, index_iv.data(), counter_mode::IV_SIZE);
+
+    // Временный файл рядом с целевым: переименование атомарно
+    // и при dest_file == archive_path
+    std::string temp_file = dest_file + ".tmp";
+    file_io::FileDescriptor out;
+    try {
+        out = file_io::openForWrite(temp_file, file_engine::useDirectIo(options, file_size));
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось создать временный файл: " + temp_file);
+    }
+    file_io::preallocate(out.get(), file_size);
+    file_io::adviseSequential(in.get());
+
+    try {
+        OutputStream stream(out.get(), options);
+
+        uint8_t raw_header[HEADER_SIZE];
+        encodeHeader(header, raw_header);
+        stream.append(raw_header, sizeof(raw_header));
+
+        for (Member* member : layout) {
+            rekeyMember(in.get(), stream, *member, old_key, new_key, options);
+        }
+        appendIndex(stream, members, header, new_key);
+        stream.finish();
+    } catch (const std::exception&) {
+        out.close();
+        std::filesystem::remove(temp_file);
+        throw;
+    }
+    in.close();
+    out.close();
+
+    if (std::filesystem::file_size(temp_file) != file_size) {
+        std::filesystem::remove(temp_file);
+        throw std::runtime_error("Некорректный размер архива");
+    }
+
+    file_engine::publishFile(temp_file, dest_file);
+
+    if (options.sync_each_file) {
+        sync();
+    }
+}
+
+void extract(const std::string& archive_path, const Member& member, const std::string& dest_file,
+             const file_engine::Key& key, const file_engine::Options& options) {
+    file_io::FileDescriptor in = file_io::openForRead(archive_path);
+    file_io::adviseSequential(in.get());
+
+    file_io::FileDescriptor out = file_io::openForWrite(dest_file, file_engine::useDirectIo(options, member.size));
+    file_io::preallocate(out.get(), member.size);
+
+    bool mac_ok;
+    try {
+        file_engine::ChunkWriter writer(out.get(), options);
+        mac_ok = unpackMember(in.get(), member, key, options,
+                              [&](const uint8_t* data, size_t length, uint64_t offset) {
+                                  writer.write(data, length, offset);
+                              });
+        writer.finish();
+    } catch (const std::exception&) {
+        out.close();
+        std::filesystem::remove(dest_file);
+        throw;
+    }
+    out.close();
+
+    if (!mac_ok) {
+        std::filesystem::remove(dest_file);
+        throw std::runtime_error("MAC не совпадает");
+    }
+}
+
+bool verify(const std::string& archive_path, const Member& member, const file_engine::Key& key) {
+    file_io::FileDescriptor in = file_io::openForRead(archive_path);
+    file_io::adviseSequential(in.get());
+    return unpackMember(in.get(), member, key, file_engine::Options(), nullptr);
+}
+
+void extractAll(const std::string& archive_path, const std::string& dest_dir,
+                const file_engine::Key& key, const file_engine::Options& options) {
+    auto members = readIndex(archive_path, key);
+
+    size_t failed = 0;
+    std::string first_error;
+    for (const auto& member : members) {
+        try {
+            std::string dest_file = dest_dir + "/" + safeName(member.name);
+            if (std::filesystem::exists(dest_file)) {
+                std::filesystem::remove(dest_file);
+            }
+            extract(archive_path, member, dest_file, key, options);
+        } catch (const std::exception& e) {
+            if (failed++ == 0) {
+                first_error = member.name + ": " + e.what();
+            }
+        }
+    }
+
+    if (failed > 0) {
+        throw std::runtime_error("Ошибок при извлечении: " + std::to_string(failed) + " (" + first_error + ")");
+    }
+}
+
+} // namespace archive
@@ -0,0 +1,190 @@
+#include "checkpoint.h"
+#include "file_io.h"
+#include "byte_order.h"
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace checkpoint {
+
+namespace {
+
+constexpr uint32_t VERSION = 2;
+
+// Размер записи без имени: размер, время, признак, смещения, счетчик,
+// состояние CMAC, флаги формата и начало кадра
+constexpr size_t ENTRY_SIZE = 8 + 8 + 1 + 8 + 8 + counter_mode::BLOCK_SIZE + cmac::Context::STATE_SIZE + 4 + 8;
+
+bool statFile(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string journalPath(const std::string& dest_dir) {
+    return dest_dir + "/" + FILE_NAME;
+}
+
+} // namespace
+
+Journal::Journal(const std::string& dest_dir, const file_engine::Key& key)
+    : dest_dir(dest_dir), key(key) {
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(journalPath(dest_dir), ec);
+    if (ec) {
+        return;
+    }
+
+    std::vector<uint8_t> encrypted(file_size);
+    std::vector<uint8_t> data;
+    try {
+        file_io::FileDescriptor fd = file_io::openForRead(journalPath(dest_dir));
+        if (file_io::readAt(fd.get(), encrypted.data(), encrypted.size(), 0) != encrypted.size()) {
+            return;
+        }
+    } catch (const std::exception&) {
+        return;
+    }
+    if (!file_engine::decryptBuffer(encrypted, key, data) || data.size() < 8 ||
+        byte_order::getLe(data.data(), 4) != VERSION) {
+        return;
+    }
+
+    size_t count = byte_order::getLe(data.data() + 4, 4);
+    size_t pos = 8;
+    std::map<std::string, Entry> loaded;
+    for (size_t i = 0; i < count; i++) {
+        if (data.size() - pos < 2) {
+            return;
+        }
+        size_t name_length = byte_order::getLe(data.data() + pos, 2);
+        pos += 2;
+        if (data.size() - pos < name_length + ENTRY_SIZE) {
+            return;
+        }
+        std::string output(reinterpret_cast<const char*>(data.data() + pos), name_length);
+        const uint8_t* p = data.data() + pos + name_length;
+        Entry entry;
+        entry.size = byte_order::getLe(p, 8);
+        entry.mtime = static_cast<int64_t>(byte_order::getLe(p + 8, 8));
+        entry.finished = p[16] != 0;
+        entry.point.input_offset = byte_order::getLe(p + 17, 8);
+        entry.point.output_offset = byte_order::getLe(p + 25, 8);
+        std::memcpy(entry.point.counter, p + 33, sizeof(entry.point.counter));
+        p += 33 + sizeof(entry.point.counter);
+        std::memcpy(entry.point.mac_state, p, sizeof(entry.point.mac_state));
+        p += sizeof(entry.point.mac_state);
+        entry.point.flags = static_cast<uint32_t>(byte_order::getLe(p, 4));
+        entry.point.frame_offset = byte_order::getLe(p + 4, 8);
+        pos += name_length + ENTRY_SIZE;
+        loaded[output] = entry;
+    }
+    entries = std::move(loaded);
+}
+
+bool Journal::isFinished(const std::string& output, const std::string& source_path) const {
+    uint64_t size;
+    int64_t mtime;
+    if (!statFile(source_path, size, mtime) || !std::filesystem::exists(dest_dir + "/" + output)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(output);
+    return it != entries.end() && it->second.finished && it->second.size == size && it->second.mtime == mtime;
+}
+
+bool Journal::find(const std::string& output, const std::string& source_path,
+                   file_engine::Checkpoint& point) const {
+    uint64_t size;
+    int64_t mtime;
+    if (!statFile(source_path, size, mtime)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(output);
+    if (it == entries.end() || it->second.finished || it->second.size != size || it->second.mtime != mtime) {
+        return false;
+    }
+    point = it->second.point;
+    return true;
+}
+
+void Journal::update(const std::string& output, const std::string& source_path,
+                     const file_engine::Checkpoint& point) {
+    Entry entry;
+    if (!statFile(source_path, entry.size, entry.mtime)) {
+        return;
+    }
+    entry.finished = false;
+    entry.point = point;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[output] = entry;
+    saveLocked();
+}
+
+void Journal::finished(const std::string& output, const std::string& source_path) {
+    Entry entry;
+    if (!statFile(source_path, entry.size, entry.mtime)) {
+        return;
+    }
+    entry.finished = true;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(output);
+    bool had_checkpoint = it != entries.end() && !it->second.finished;
+    entries[output] = entry;
+    if (had_checkpoint) {
+        saveLocked();
+    }
+}
+
+void Journal::save() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    saveLocked();
+}
+
+void Journal::remove() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    std::error_code ec;
+    std::filesystem::remove(journalPath(dest_dir), ec);
+}
+
+void Journal::saveLocked() const {
+    std::vector<uint8_t> data;
+    byte_order::appendLe(data, VERSION, 4);
+    byte_order::appendLe(data, entries.size(), 4);
+    for (const auto& item : entries) {
+        const Entry& entry = item.second;
+        byte_order::appendLe(data, item.first.size(), 2);
+        data.insert(data.end(), item.first.begin(), item.first.end());
+        byte_order::appendLe(data, entry.size, 8);
+        byte_order::appendLe(data, static_cast<uint64_t>(entry.mtime), 8);
+        data.push_back(entry.finished ? 1 : 0);
+        byte_order::appendLe(data, entry.point.input_offset, 8);
+        byte_order::appendLe(data, entry.point.output_offset, 8);
+        data.insert(data.end(), entry.point.counter, entry.point.counter + sizeof(entry.point.counter));
+        data.insert(data.end(), entry.point.mac_state, entry.point.mac_state + sizeof(entry.point.mac_state));
+        byte_order::appendLe(data, entry.point.flags, 4);
+        byte_order::appendLe(data, entry.point.frame_offset, 8);
+    }
+    auto encrypted = file_engine::encryptBuffer(data, key);
+
+    // Журнал должен пережить внезапное отключение: пишем во временный файл,
+    // сбрасываем на носитель и только потом переименовываем
+    std::string temp_path = journalPath(dest_dir) + ".tmp";
+    {
+        file_io::FileDescriptor fd = file_io::openForWrite(temp_path);
+        file_io::writeAt(fd.get(), encrypted.data(), encrypted.size(), 0);
+        file_io::syncData(fd.get());
+    }
+    std::filesystem::rename(temp_path, journalPath(dest_dir));
+}
+
+} // namespace checkpoint
@@ -0,0 +1,175 @@
+#include "file_engine.h"
+#include "archive.h"
+#include "transfer_scheduler.h"
+#include <iostream>
+#include <filesystem>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Служебная утилита для обработки файлов без дисплея и клавиатуры.
+// Ключи передаются через переменные окружения, чтобы не попадать
+// в список процессов:
+//   SHIFRO_KEY     — текущий ключ (по умолчанию тот же, что у приложения)
+//   SHIFRO_NEW_KEY — новый ключ для rekey
+//
+// enc и dec работают и в конвейерах: "-" или отсутствующий аргумент
+// означает stdin/stdout, например
+//   tar c dir | shifro-cli enc > dir.tar.enc
+//   shifro-cli dec dir.tar.enc | tar x
+
+namespace {
+
+const char* DEFAULT_KEY = "TEST_KEY";
+
+void printUsage() {
+    std::cerr << "Использование:" << std::endl;
+    std::cerr << "  shifro-cli enc [ВХОД [ВЫХОД]]   шифрование файла или потока (- — stdin/stdout)" << std::endl;
+    std::cerr << "  shifro-cli enc -z ВХОД ВЫХОД    шифрование файла со сжатием" << std::endl;
+    std::cerr << "  shifro-cli dec [ВХОД [ВЫХОД]]   расшифрование файла или потока" << std::endl;
+    std::cerr << "  shifro-cli rekey ФАЙЛ...        смена ключа зашифрованных файлов на месте" << std::endl;
+}
+
+std::string envKey(const char* name, const char* fallback) {
+    const char* value = std::getenv(name);
+    return value ? value : (fallback ? fallback : "");
+}
+
+bool isStdio(const std::string& path) {
+    return path.empty() || path == "-";
+}
+
+// Шифрование (encrypt) или расшифрование. Файлы обрабатываются целиком
+// (с атомарной заменой, разреженностью и, если задано compress, сжатием),
+// остальное — как поток
+int transform(bool encrypt, bool compress, const std::vector<std::string>& args) {
+    std::string input = args.size() > 0 ? args[0] : "";
+    std::string output = args.size() > 1 ? args[1] : "";
+    if (encrypt && isStdio(output) && isatty(STDOUT_FILENO)) {
+        std::cerr << "Ошибка: зашифрованные данные не выводятся в терминал" << std::endl;
+        return 2;
+    }
+    const file_engine::Key key = file_engine::expandKey(envKey("SHIFRO_KEY", DEFAULT_KEY));
+    file_engine::Options options;
+    options.compress = compress;
+
+    if (!isStdio(input) && !isStdio(output) && std::filesystem::is_regular_file(input)) {
+        if (encrypt) {
+            file_engine::encryptFile(input, output, key, options);
+        } else {
+            file_engine::decryptFile(input, output, key, options);
+        }
+        return 0;
+    }
+
+    file_io::FileDescriptor in_file;
+    file_io::FileDescriptor out_file;
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+    if (!isStdio(input)) {
+        in_file = file_io::openForRead(input);
+        in_fd = in_file.get();
+    }
+    if (!isStdio(output)) {
+        out_file = file_io::openForWrite(output, false);
+        out_fd = out_file.get();
+    }
+
+    try {
+        if (encrypt) {
+            file_engine::encryptStream(in_fd, out_fd, key, options);
+        } else {
+            file_engine::decryptStream(in_fd, out_fd, key, options);
+        }
+    } catch (const std::exception&) {
+        // Непроверенный результат не оставляем
+        if (!isStdio(output)) {
+            out_file.close();
+            std::filesystem::remove(output);
+        }
+        throw;
+    }
+    return 0;
+}
+
+int rekey(const std::vector<std::string>& files) {
+    std::string new_key_string = envKey("SHIFRO_NEW_KEY", nullptr);
+    if (new_key_string.empty()) {
+        std::cerr << "Ошибка: не задан SHIFRO_NEW_KEY" << std::endl;
+        return 1;
+    }
+    const file_engine::Key old_key = file_engine::expandKey(envKey("SHIFRO_KEY", DEFAULT_KEY));
+    const file_engine::Key new_key = file_engine::expandKey(new_key_string);
+
+    std::vector<transfer_scheduler::Job> jobs;
+    for (const auto& file : files) {
+        // Размер открытых данных из заголовка: у сжатых файлов и архивов он
+        // не выводится из размера файла
+        uint64_t size = 0;
+        if (!archive::describe(file, size) && !file_engine::describeFile(file, size)) {
+            size = 0;
+        }
+        jobs.push_back({file, file, file, size});
+    }
+
+    file_engine::Options options;
+    options.sync_each_file = false;
+
+    auto process = [&](const transfer_scheduler::Job& job, const file_engine::Options& job_options) {
+        // Архиву пакета мелких файлов нужны новые синхропосылки каждого файла
+        if (archive::isArchive(job.source)) {
+            archive::rekey(job.source, job.dest, old_key, new_key, job_options);
+        } else {
+            file_engine::rekeyFile(job.source, job.dest, old_key, new_key, job_options);
+        }
+    };
+    auto report = [](const transfer_scheduler::Progress& p) {
+        std::cerr << "\r" << p.files_done << "/" << p.files_total << " файлов, "
+                  << p.bytes_done / (1024 * 1024) << "/" << p.bytes_total / (1024 * 1024) << " МБ" << std::flush;
+    };
+
+    transfer_scheduler::Scheduler scheduler(std::move(jobs),
+                                            transfer_scheduler::workerCount(device_profile::MAX_PIPELINE_DEPTH));
+    scheduler.run(process, options, report, std::chrono::milliseconds(500));
+    std::cerr << std::endl;
+    sync();
+
+    auto errors = scheduler.errors();
+    for (const auto& error : errors) {
+        std::cerr << "Ошибка: " << error << std::endl;
+    }
+    return errors.empty() ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 2;
+    }
+
+    std::string command = argv[1];
+    std::vector<std::string> args(argv + 2, argv + argc);
+    bool compress = false;
+    if (command == "enc" && !args.empty() && args[0] == "-z") {
+        compress = true;
+        args.erase(args.begin());
+    }
+
+    try {
+        if ((command == "enc" || command == "dec") && args.size() <= 2) {
+            return transform(command == "enc", compress, args);
+        }
+        if (command == "rekey" && !args.empty()) {
+            return rekey(args);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Ошибка: " << e.what() << std::endl;
+        return 1;
+    }
+
+    printUsage();
+    return 2;
+}
@@ -1,5 +1,6 @@
 #include "cmac.h"
 #include "kuznechik.h"
+#include <algorithm>
 
 namespace cmac {
 
@@ -50,47 +51,72 @@ CMACKeys generateSubkeys(const uint8_t* key) {
     return subkeys;
 }
 
-// вычисление CMAC
-std::vector<uint8_t> calculateCMAC(const std::vector<char>& data, 
-                                 const uint8_t* key, 
-                                 const uint8_t* roundKeys) {
-    std::vector<uint8_t> mac(BLOCK_SIZE, 0);
-    uint8_t temp_keys[160]; 
-    
-    // раундовые ключи
-    std::memcpy(temp_keys, roundKeys, 160);
-    
-    CMACKeys subkeys = generateSubkeys(roundKeys);
-    
-    // количество полных блоков
-    size_t n = (data.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    bool is_complete = (data.size() % BLOCK_SIZE == 0);
-    
-    // все блоки кроме последнего
-    uint8_t block[BLOCK_SIZE] = {0};
-    for (size_t i = 0; i < n - 1; i++) {
-        std::memcpy(block, &data[i * BLOCK_SIZE], BLOCK_SIZE);
-        xorBlocks(mac.data(), block);
-        kuznechik_encrypt(mac.data(), mac.data(), temp_keys);
+Context::Context(const uint8_t* roundKeys) : pending_length(0) {
+    std::memcpy(keys, roundKeys, sizeof(keys));
+    subkeys = generateSubkeys(roundKeys);
+    std::memset(mac, 0, BLOCK_SIZE);
+    std::memset(pending, 0, BLOCK_SIZE);
+}
+
+void Context::update(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        // Полный блок обрабатываем только когда за ним есть еще данные:
+        // последний блок шифруется с подключом в finalize()
+        if (pending_length == BLOCK_SIZE) {
+            xorBlocks(mac, pending);
+            kuznechik_encrypt(mac, mac, keys);
+            pending_length = 0;
+        }
+        size_t n = std::min(BLOCK_SIZE - pending_length, length);
+        std::memcpy(pending + pending_length, data, n);
+        pending_length += n;
+        data += n;
+        length -= n;
     }
-    
-    // последний блок
-    size_t last_block_size = data.size() - (n - 1) * BLOCK_SIZE;
-    std::memset(block, 0, BLOCK_SIZE);
-    std::memcpy(block, &data[(n - 1) * BLOCK_SIZE], last_block_size);
-    
-    if (!is_complete) {
+}
+
+std::vector<uint8_t> Context::finalize() {
+    uint8_t block[BLOCK_SIZE] = {0};
+    std::memcpy(block, pending, pending_length);
+
+    if (pending_length < BLOCK_SIZE) {
         // padding
-        block[last_block_size] = 0x80;
+        block[pending_length] = 0x80;
         xorBlocks(block, subkeys.K2);
     } else {
         xorBlocks(block, subkeys.K1);
     }
-    
-    xorBlocks(mac.data(), block);
-    kuznechik_encrypt(mac.data(), mac.data(), temp_keys);
-    
-    return mac;
+
+    xorBlocks(mac, block);
+    kuznechik_encrypt(mac, mac, keys);
+
+    return std::vector<uint8_t>(mac, mac + BLOCK_SIZE);
+}
+
+void Context::saveState(uint8_t* out) const {
+    std::memcpy(out, mac, BLOCK_SIZE);
+    std::memcpy(out + BLOCK_SIZE, pending, BLOCK_SIZE);
+    out[2 * BLOCK_SIZE] = static_cast<uint8_t>(pending_length);
+}
+
+bool Context::restoreState(const uint8_t* in) {
+    if (in[2 * BLOCK_SIZE] > BLOCK_SIZE) {
+        return false;
+    }
+    std::memcpy(mac, in, BLOCK_SIZE);
+    std::memcpy(pending, in + BLOCK_SIZE, BLOCK_SIZE);
+    pending_length = in[2 * BLOCK_SIZE];
+    return true;
+}
+
+// вычисление CMAC
+std::vector<uint8_t> calculateCMAC(const std::vector<char>& data, 
+                                 const uint8_t* key, 
+                                 const uint8_t* roundKeys) {
+    (void)key;
+    Context ctx(roundKeys);
+    ctx.update(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    return ctx.finalize();
 }
 
-} // namespace cmac 
\ No newline at end of file
+} // namespace cmac 
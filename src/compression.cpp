@@ -0,0 +1,98 @@
+#include "compression.h"
+#include "byte_order.h"
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#ifdef SHIFRO_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace compression {
+
+namespace {
+
+// Уровень zlib: самый быстрый, узкое место — запись на флешку, а не сжатие
+constexpr int ZLIB_LEVEL = 1;
+
+} // namespace
+
+bool available() {
+#ifdef SHIFRO_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+double entropy(const uint8_t* data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    size_t counts[256] = {};
+    for (size_t i = 0; i < length; i++) {
+        counts[data[i]]++;
+    }
+    double result = 0;
+    for (size_t count : counts) {
+        if (count > 0) {
+            double p = static_cast<double>(count) / length;
+            result -= p * std::log2(p);
+        }
+    }
+    return result;
+}
+
+bool worthCompressing(const uint8_t* sample, size_t length) {
+    if (!available() || length == 0 || entropy(sample, length) > MAX_ENTROPY) {
+        return false;
+    }
+    std::vector<uint8_t> frame(frameBound());
+    size_t frame_length = compressFrame(sample, length, frame.data());
+    return frame_length - FRAME_HEADER_SIZE <= length * MAX_RATIO;
+}
+
+size_t frameBound() {
+#ifdef SHIFRO_HAVE_ZLIB
+    return FRAME_HEADER_SIZE + std::max<size_t>(FRAME_SIZE, compressBound(FRAME_SIZE));
+#else
+    return FRAME_HEADER_SIZE + FRAME_SIZE;
+#endif
+}
+
+size_t compressFrame(const uint8_t* data, size_t length, uint8_t* out) {
+    size_t stored = length;
+#ifdef SHIFRO_HAVE_ZLIB
+    uLongf compressed = compressBound(length);
+    if (compress2(out + FRAME_HEADER_SIZE, &compressed, data, length, ZLIB_LEVEL) == Z_OK &&
+        compressed < length) {
+        stored = compressed;
+    }
+#endif
+    // Несжимаемый кадр сохраняется как есть
+    if (stored == length) {
+        std::memcpy(out + FRAME_HEADER_SIZE, data, length);
+    }
+    byte_order::putLe(out, stored, 4);
+    byte_order::putLe(out + 4, length, 4);
+    return FRAME_HEADER_SIZE + stored;
+}
+
+void decompressFrame(const uint8_t* data, size_t stored_length, uint8_t* out, size_t plain_length) {
+    if (stored_length == plain_length) {
+        std::memcpy(out, data, plain_length);
+        return;
+    }
+#ifdef SHIFRO_HAVE_ZLIB
+    uLongf length = plain_length;
+    if (uncompress(out, &length, data, stored_length) != Z_OK || length != plain_length) {
+        throw std::runtime_error("Ошибка распаковки данных");
+    }
+#else
+    (void)out;
+    throw std::runtime_error("Сжатые файлы не поддерживаются этой сборкой");
+#endif
+}
+
+} // namespace compression
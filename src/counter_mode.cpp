@@ -1,6 +1,7 @@
 #include "counter_mode.h"
 #include <random>
 #include <chrono>
+#include <algorithm>
 
 namespace counter_mode {
 
@@ -43,4 +44,13 @@ void apply_gamma(uint8_t* data, const uint8_t* gamma, size_t length) {
     }
 }
 
+void apply_ctr(uint8_t* data, size_t length, Counter& ctr, const uint8_t* roundKeys) {
+    uint8_t gamma[BLOCK_SIZE];
+    for(size_t pos = 0; pos < length; pos += BLOCK_SIZE) {
+        size_t block_size = std::min(BLOCK_SIZE, length - pos);
+        generate_gamma(gamma, ctr, roundKeys);
+        apply_gamma(data + pos, gamma, block_size);
+    }
+}
+
 }
\ No newline at end of file
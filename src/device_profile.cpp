@@ -0,0 +1,234 @@
+#include "device_profile.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <mntent.h>
+#include <unistd.h>
+
+namespace device_profile {
+
+namespace {
+
+// Файл с профилями носителей: по строке «uuid chunk depth read write latency»
+std::string profilesPath() {
+    const char* dir = std::getenv("SHIFRO_STATE_DIR");
+    return std::string(dir ? dir : "/var/lib/shifro") + "/device_profiles";
+}
+
+std::mutex profiles_mutex;
+
+std::map<std::string, Profile> readAll() {
+    std::map<std::string, Profile> profiles;
+    std::ifstream in(profilesPath());
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string uuid;
+        Profile p;
+        if (iss >> uuid >> p.chunk_size >> p.pipeline_depth
+                >> p.read_bandwidth >> p.write_bandwidth >> p.write_latency) {
+            profiles[uuid] = p;
+        }
+    }
+    return profiles;
+}
+
+// Округление вниз до степени двойки
+size_t floorPow2(size_t value) {
+    size_t result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+size_t clampChunk(size_t value) {
+    return floorPow2(std::clamp(value, MIN_CHUNK_SIZE, maxChunkSize()));
+}
+
+} // namespace
+
+std::string filesystemUuid(const std::string& path) {
+    // Устройство точки монтирования с самым длинным совпадающим префиксом
+    std::string device;
+    size_t best_length = 0;
+    FILE* mounts = setmntent("/proc/mounts", "r");
+    if (mounts) {
+        struct mntent* ent;
+        while ((ent = getmntent(mounts)) != nullptr) {
+            std::string dir = ent->mnt_dir;
+            bool matches = path == dir ||
+                (path.compare(0, dir.length(), dir) == 0 &&
+                 (dir == "/" || path[dir.length()] == '/'));
+            if (matches && dir.length() >= best_length) {
+                best_length = dir.length();
+                device = ent->mnt_fsname;
+            }
+        }
+        endmntent(mounts);
+    }
+    if (device.empty()) {
+        return "";
+    }
+
+    std::error_code ec;
+    auto real_device = std::filesystem::canonical(device, ec);
+    if (ec) {
+        return "";
+    }
+    for (const auto& entry : std::filesystem::directory_iterator("/dev/disk/by-uuid", ec)) {
+        std::error_code link_ec;
+        if (std::filesystem::canonical(entry.path(), link_ec) == real_device && !link_ec) {
+            return entry.path().filename().string();
+        }
+    }
+    return "";
+}
+
+bool load(const std::string& uuid, Profile& profile) {
+    if (uuid.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    auto profiles = readAll();
+    auto it = profiles.find(uuid);
+    if (it == profiles.end()) {
+        return false;
+    }
+    profile = it->second;
+    profile.chunk_size = clampChunk(profile.chunk_size);
+    profile.pipeline_depth = std::clamp(profile.pipeline_depth, MIN_PIPELINE_DEPTH, MAX_PIPELINE_DEPTH);
+    return true;
+}
+
+void save(const std::string& uuid, const Profile& profile) {
+    if (uuid.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(profiles_mutex);
+    auto profiles = readAll();
+    profiles[uuid] = profile;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(profilesPath()).parent_path(), ec);
+
+    // Пишем во временный файл и переименовываем, чтобы не потерять профили при сбое
+    std::string temp_path = profilesPath() + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::trunc);
+        if (!out) {
+            return;
+        }
+        for (const auto& item : profiles) {
+            const Profile& p = item.second;
+            out << item.first << ' ' << p.chunk_size << ' ' << p.pipeline_depth << ' '
+                << p.read_bandwidth << ' ' << p.write_bandwidth << ' ' << p.write_latency << '\n';
+        }
+    }
+    std::filesystem::rename(temp_path, profilesPath(), ec);
+}
+
+size_t maxChunkSize() {
+    // Не больше 1/128 оперативной памяти: на платах с 512 МБ это 4 МБ
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return MAX_CHUNK_SIZE;
+    }
+    size_t limit = static_cast<size_t>(pages) / 128 * static_cast<size_t>(page_size);
+    return std::max(MIN_CHUNK_SIZE, std::min(MAX_CHUNK_SIZE, floorPow2(limit)));
+}
+
+Tuner::Tuner(const Profile& source, const Profile& dest)
+    : source(source), dest(dest),
+      read_samples(0), read_bytes(0), read_seconds(0),
+      write_samples(0), write_bytes(0), write_seconds(0),
+      min_write_overhead(0) {
+    this->dest.chunk_size = clampChunk(dest.chunk_size);
+    this->dest.pipeline_depth = std::clamp(dest.pipeline_depth, MIN_PIPELINE_DEPTH, MAX_PIPELINE_DEPTH);
+}
+
+size_t Tuner::chunkSize() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dest.chunk_size;
+}
+
+size_t Tuner::pipelineDepth() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dest.pipeline_depth;
+}
+
+void Tuner::recordRead(size_t bytes, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    read_samples++;
+    read_bytes += bytes;
+    read_seconds += seconds;
+    if (read_seconds > 0) {
+        source.read_bandwidth = read_bytes / read_seconds;
+    }
+}
+
+void Tuner::recordWrite(size_t bytes, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    write_samples++;
+
+    // Первые порции при отложенной записи попадают только в кэш
+    // и скорость носителя не отражают
+    if (write_samples <= dest.pipeline_depth) {
+        return;
+    }
+
+    write_bytes += bytes;
+    write_seconds += seconds;
+    if (write_seconds <= 0) {
+        return;
+    }
+    dest.write_bandwidth = write_bytes / write_seconds;
+
+    // Постоянные затраты на порцию: остаток времени сверх передачи данных
+    double overhead = std::max(0.0, seconds - bytes / dest.write_bandwidth);
+    size_t measured = write_samples - dest.pipeline_depth;
+    min_write_overhead = (measured == 1) ? overhead : std::min(min_write_overhead, overhead);
+
+    if (measured == CALIBRATION_CHUNKS) {
+        dest.write_latency = min_write_overhead;
+        retune();
+    }
+}
+
+void Tuner::retune() {
+    double bandwidth = dest.write_bandwidth;
+    if (source.read_bandwidth > 0) {
+        bandwidth = std::min(bandwidth, source.read_bandwidth);
+    }
+    if (bandwidth <= 0) {
+        return;
+    }
+
+    // Порция должна передаваться ~TARGET_CHUNK_SECONDS, а постоянные
+    // затраты на нее не должны превышать 10% времени передачи
+    double by_time = bandwidth * TARGET_CHUNK_SECONDS;
+    double by_latency = dest.write_latency * bandwidth * 10;
+    dest.chunk_size = clampChunk(static_cast<size_t>(std::max(by_time, by_latency)));
+
+    // В полете держим около TARGET_INFLIGHT_SECONDS записи
+    double inflight = dest.write_bandwidth * TARGET_INFLIGHT_SECONDS / dest.chunk_size;
+    dest.pipeline_depth = std::clamp(static_cast<size_t>(std::ceil(inflight)),
+                                     MIN_PIPELINE_DEPTH, MAX_PIPELINE_DEPTH);
+}
+
+Profile Tuner::sourceProfile() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return source;
+}
+
+Profile Tuner::destProfile() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dest;
+}
+
+} // namespace device_profile
@@ -4,24 +4,60 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Области, объединение которых больше их суммы не более чем на столько
+// точек, выводятся одной: новое окно адресации дороже лишних точек
+constexpr int32_t DIRTY_MERGE_SLACK = 256;
+
+// Цвет RGB565 в порядке байт дисплея (старший байт первым)
+uint16_t toPanel(uint16_t color) {
+    uint16_t panel;
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&panel);
+    bytes[0] = color >> 8;
+    bytes[1] = color & 0xFF;
+    return panel;
+}
+
+int32_t area(int16_t x0, int16_t y0, int16_t x1, int16_t y1) {
+    return static_cast<int32_t>(x1 - x0 + 1) * (y1 - y0 + 1);
+}
 
+} // namespace
 
-TFTDisplay::TFTDisplay(int channel, int reset_pin, int dc_pin, int width, int height)
-    : spi(channel, 8000000),  // Initialize SPI with 8MHz clock
-      reset_pin(reset_pin),
-      dc_pin(dc_pin),
+
+TFTDisplay::TFTDisplay(std::unique_ptr<DisplaySink> sink, int width, int height)
+    : sink(std::move(sink)),
       width(width),
       height(height),
       rotation(DisplayRotation::ROTATION_0),
-      current_color(COLOR_BLACK) {
+      current_color(COLOR_BLACK),
+      framebuffer(ST7735_WIDTH * ST7735_HEIGHT, toPanel(COLOR_BLACK)),
+      mailbox(1),
+      back_frame(0),
+      front_frame(2),
+      rendering(false),
+      published_frames(0),
+      presented_frames(0) {
     
     // Initialize current_font with zeros
     current_font = {nullptr, 0, 0, 0, 0};
     
-
+    for (Frame& frame : frames) {
+        frame.pixels.resize(framebuffer.size());
+    }
 }
 
 TFTDisplay::~TFTDisplay() {
+    // Вывод последнего кадра и остановка потока вывода
+    if (render_thread.joinable()) {
+        rendering = false;
+        render_thread.join();
+    }
+
     // Cleanup
     try {
         // Turn off display
@@ -39,7 +75,7 @@ TFTDisplay::~TFTDisplay() {
 bool TFTDisplay::init() {
     
     // Initialize SPI first
-    if (!spi.init()) {
+    if (!sink->init()) {
         return false;
     }
     
@@ -47,11 +83,11 @@ bool TFTDisplay::init() {
     for (int retry = 0; retry < init_retries; retry++) {
         try {
             // Hardware reset sequence with more conservative timing
-            spi.setRST(1);
+            sink->setRST(1);
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            spi.setRST(0);
+            sink->setRST(0);
             std::this_thread::sleep_for(std::chrono::milliseconds(120));  // Increased reset pulse width
-            spi.setRST(1);
+            sink->setRST(1);
             std::this_thread::sleep_for(std::chrono::milliseconds(120));  // Increased stabilization time
             
             // Software reset
@@ -171,7 +207,12 @@ bool TFTDisplay::init() {
             
             // Clear screen to black
             clearScreen(COLOR_BLACK);
+            flush();
             
+            if (!render_thread.joinable()) {
+                rendering = true;
+                render_thread = std::thread(&TFTDisplay::renderLoop, this);
+            }
             return true;
             
         } catch (const std::exception& e) {
@@ -179,9 +220,9 @@ bool TFTDisplay::init() {
             if (retry < init_retries - 1) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Wait before retry
                 // Perform a hard reset before retrying
-                spi.setRST(0);
+                sink->setRST(0);
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                spi.setRST(1);
+                sink->setRST(1);
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
             }
         }
@@ -222,59 +263,44 @@ void TFTDisplay::setRotation(DisplayRotation rotation) {
     writeData(&madctl, 1);
 
     // Сброс окна адресации на полный размер дисплея
-    setAddressWindow(0, 0, width - 1, height - 1);
+    {
+        std::lock_guard<std::mutex> lock(spi_mutex);
+        setAddressWindow(0, 0, width - 1, height - 1);
+        submit();
+    }
+
+    // Буфер кадра при смене осей читается с другой шириной строки:
+    // содержимое дисплея нужно вывести заново
+    unpresented.clear();
+    markDirty(0, 0, width - 1, height - 1);
 }
 
 void TFTDisplay::clearScreen(uint16_t color) {
-    // Установка окна адресации на весь дисплей
-    setAddressWindow(0, 0, width - 1, height - 1);
-    
-    // Команда записи в память
-    writeCommand(CMD_RAMWR);
-    
-    // Подготовка байтов цвета
-    uint8_t hi = color >> 8;
-    uint8_t lo = color & 0xFF;
-    
-    // Заполнение экрана цветом блоками
-    const size_t chunk_size = 1024;  // Обработка
-    std::vector<uint8_t> buffer(chunk_size);
-    for (size_t i = 0; i < chunk_size; i += 2) {
-        buffer[i] = hi;
-        buffer[i + 1] = lo;
-    }
-    
-    size_t total_pixels = width * height;
-    size_t pixels_written = 0;
-    
-    while (pixels_written < total_pixels) {
-        size_t pixels_to_write = std::min((chunk_size / 2), total_pixels - pixels_written);
-        writeData(buffer.data(), pixels_to_write * 2);
-        pixels_written += pixels_to_write;
-    }
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::CLEAR_SCREEN);
+    std::fill(framebuffer.begin(), framebuffer.end(), toPanel(color));
+    dirty.clear();
+    markDirty(0, 0, width - 1, height - 1);
 }
 
 void TFTDisplay::drawPixel(int16_t x, int16_t y, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_PIXEL);
     if (x < 0 || x >= width || y < 0 || y >= height) {
         return;  // Проверка границ
     }
     
-    setAddressWindow(x, y, x, y);
-    
-    // Преобразование цвета в формат дисплея (RGB565)
-    uint8_t color_bytes[2];
-    color_bytes[0] = color >> 8;    // Старший байт
-    color_bytes[1] = color & 0xFF;  // Младший байт
-    
-    writeData(color_bytes, 2);
+    putPixel(x, y, color);
+    markDirty(x, y, x, y);
 }
 
 void TFTDisplay::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_LINE);
     
     if (color == 0) {
         color = COLOR_RED;
     }
 
+    markDirty(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1));
+
     int16_t dx = abs(x1 - x0);
     int16_t dy = abs(y1 - y0);
     int16_t sx = (x0 < x1) ? 1 : -1;
@@ -283,7 +309,7 @@ void TFTDisplay::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16
     int16_t e2;
 
     while (true) {
-        drawPixel(x0, y0, color);
+        putPixel(x0, y0, color);
         if (x0 == x1 && y0 == y1) break;
         e2 = err;
         if (e2 > -dx) {
@@ -298,6 +324,7 @@ void TFTDisplay::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16
 }
 
 void TFTDisplay::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_RECT);
     drawLine(x, y, x + w - 1, y, color);         // Верхняя линия
     drawLine(x, y + h - 1, x + w - 1, y + h - 1, color); // Нижняя линия
     drawLine(x, y, x, y + h - 1, color);         // Левая линия
@@ -305,30 +332,63 @@ void TFTDisplay::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c
 }
 
 void TFTDisplay::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::FILL_RECT);
     // Проверка границ
     if (x < 0 || y < 0 || w <= 0 || h <= 0) return;
     if (x + w > width) w = width - x;
     if (y + h > height) h = height - y;
 
-    setAddressWindow(x, y, x + w - 1, y + h - 1);
-    
+    if (w <= 0 || h <= 0) return;
+
     // Заполнение прямоугольника
-    uint32_t num_pixels = w * h;
-    std::vector<uint16_t> buffer(num_pixels, color);
-    writeData(reinterpret_cast<uint8_t*>(buffer.data()), num_pixels * 2);
+    uint16_t panel_color = toPanel(color);
+    for (int16_t row = y; row < y + h; row++) {
+        uint16_t* line = framebuffer.data() + row * width;
+        std::fill(line + x, line + x + w, panel_color);
+    }
+    markDirty(x, y, x + w - 1, y + h - 1);
+}
+
+void TFTDisplay::scrollRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t dy, uint16_t fill) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::SCROLL_RECT);
+    // Проверка границ
+    if (x < 0 || y < 0 || w <= 0 || h <= 0) return;
+    if (x + w > width) w = width - x;
+    if (y + h > height) h = height - y;
+    if (w <= 0 || h <= 0) return;
+
+    int16_t shift = std::min<int16_t>(std::abs(dy), h);
+    if (dy > 0) {
+        // Вниз: строки переносятся начиная с нижней, чтобы не затереть источник
+        for (int16_t row = y + h - 1; row >= y + shift; row--) {
+            uint16_t* line = framebuffer.data() + row * width + x;
+            std::copy(line - shift * width, line - shift * width + w, line);
+        }
+        fillRect(x, y, w, shift, fill);
+    } else if (dy < 0) {
+        for (int16_t row = y; row < y + h - shift; row++) {
+            uint16_t* line = framebuffer.data() + row * width + x;
+            std::copy(line + shift * width, line + shift * width + w, line);
+        }
+        fillRect(x, y + h - shift, w, shift, fill);
+    }
+    markDirty(x, y, x + w - 1, y + h - 1);
 }
 
 void TFTDisplay::drawCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_CIRCLE);
     int16_t f = 1 - r;
     int16_t ddF_x = 1;
     int16_t ddF_y = -2 * r;
     int16_t x = 0;
     int16_t y = r;
 
-    drawPixel(x0, y0 + r, color);
-    drawPixel(x0, y0 - r, color);
-    drawPixel(x0 + r, y0, color);
-    drawPixel(x0 - r, y0, color);
+    markDirty(x0 - r, y0 - r, x0 + r, y0 + r);
+
+    putPixel(x0, y0 + r, color);
+    putPixel(x0, y0 - r, color);
+    putPixel(x0 + r, y0, color);
+    putPixel(x0 - r, y0, color);
 
     while (x < y) {
         if (f >= 0) {
@@ -340,18 +400,19 @@ void TFTDisplay::drawCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) {
         ddF_x += 2;
         f += ddF_x;
 
-        drawPixel(x0 + x, y0 + y, color);
-        drawPixel(x0 - x, y0 + y, color);
-        drawPixel(x0 + x, y0 - y, color);
-        drawPixel(x0 - x, y0 - y, color);
-        drawPixel(x0 + y, y0 + x, color);
-        drawPixel(x0 - y, y0 + x, color);
-        drawPixel(x0 + y, y0 - x, color);
-        drawPixel(x0 - y, y0 - x, color);
+        putPixel(x0 + x, y0 + y, color);
+        putPixel(x0 - x, y0 + y, color);
+        putPixel(x0 + x, y0 - y, color);
+        putPixel(x0 - x, y0 - y, color);
+        putPixel(x0 + y, y0 + x, color);
+        putPixel(x0 - y, y0 + x, color);
+        putPixel(x0 + y, y0 - x, color);
+        putPixel(x0 - y, y0 - x, color);
     }
 }
 
 void TFTDisplay::fillCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::FILL_CIRCLE);
     drawLine(x0, y0 - r, x0, y0 - r + 2 * r + 1, color);
     int16_t f = 1 - r;
     int16_t ddF_x = 1;
@@ -378,78 +439,124 @@ void TFTDisplay::fillCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) {
 
 void TFTDisplay::setFont(const AppFont& font) {
     current_font = font;
+    rasterizeFont();
     // std::cout << "Установлен шрифт: ширина=" << font.width 
     //           << ", высота=" << font.height 
     //           << ", первый символ=" << font.first_char 
     //           << ", последний символ=" << font.last_char << std::endl;
 }
 
-void TFTDisplay::drawChar(int16_t x, int16_t y, uint8_t character, uint16_t color) {
+void TFTDisplay::rasterizeFont() {
+    glyph_atlas.clear();
+    if (current_font.data == nullptr) {
+        return;
+    }
+
+    int glyph_rows = current_font.height + 1;
+    int glyph_count = current_font.last_char - current_font.first_char + 1;
+    glyph_atlas.assign(static_cast<size_t>(glyph_count) * glyph_rows, 0);
+
+    for (int char_index = 0; char_index < glyph_count; char_index++) {
+        uint32_t* rows = glyph_atlas.data() + static_cast<size_t>(char_index) * glyph_rows;
+        auto set = [&](int col, int row) {
+            rows[row] |= 1u << (col + 1);
+        };
+
+        // Основной символ
+        int offset = char_index * 5; // 5 байт на символ
+        for (int col = 0; col < current_font.width; col++) {
+            uint8_t column_data = current_font.data[offset + col];
+            
+            for (int row = 0; row < current_font.height; row++) {
+                if (column_data & (1 << row)) {
+                    set(col, row);
+                }
+            }
+        }
+
+        // Специальная обработка для русских букв с выступающими элементами
+        // Для буквы "ь" (код 0xD0 0xAC)
+        if (char_index == 124) {
+            // Рисуем правую часть буквы "ь"
+            set(current_font.width, current_font.height - 4);
+            set(current_font.width, current_font.height - 3);
+            set(current_font.width - 1, current_font.height - 2);
+        }
+        // Для буквы "ы" (код 0xD1 0x8B)
+        else if (char_index == 20) {
+            for (int row = 1; row < current_font.height - 1; row++) {
+                set(current_font.width + 1, row);
+            }
+        }
+        // Для буквы "д" (код 0xD0 0xB4)
+        else if (char_index == 6) {
+            set(-1, current_font.height);
+            set(current_font.width, current_font.height);
+            for (int col = 0; col < current_font.width; col++) {
+                set(col, current_font.height);
+            }
+        }
+        // Для буквы "л" (код 0xD0 0xBB)
+        else if (char_index == 11) {
+            // Рисуем левую ножку буквы "л"
+            set(-1, current_font.height - 1);
+            set(0, current_font.height - 1);
+            set(1, current_font.height - 1);
+            // Добавляем диагональную линию для формы буквы
+            set(1, current_font.height - 2);
+            set(2, current_font.height - 2);
+        }
+    }
+}
+
+void TFTDisplay::drawChar(int16_t x, int16_t y, uint8_t character, uint16_t color, bool bold) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_CHAR);
     // Выход, если шрифт не установлен или символ за пределами поддерживаемого диапазона
-    if (current_font.data == nullptr || 
+    if (glyph_atlas.empty() || 
         character < current_font.first_char || 
         character > current_font.last_char) {
         return;
     }
     
-    // Вычисляем смещение в массиве данных шрифта
-    int offset = (character - current_font.first_char) * 5; // 5 байт на символ
-    
+    // У правого края жирный повтор не помещается — символ рисуется обычным
+    if (bold && x + current_font.width + 3 > width) {
+        bold = false;
+    }
+
     // Проверка границ экрана с учетом дополнительного пространства для выступающих элементов
+    int16_t extra = bold ? 1 : 0;
     if (x < 0 || y < 0 || 
-        x + current_font.width + 2 > width || 
+        x + current_font.width + 2 + extra > width || 
         y + current_font.height + 2 > height) {
         return;
     }
     
-    // Отрисовка основного символа
-    for (int col = 0; col < current_font.width; col++) {
-        uint8_t column_data = current_font.data[offset + col];
-        
-        for (int row = 0; row < current_font.height; row++) {
-            if (column_data & (1 << row)) {
-                drawPixel(x + col, y + row, color);
-            }
+    // Растр символа из атласа; бит 0 строки — столбец x - 1
+    int glyph_rows = current_font.height + 1;
+    const uint32_t* rows = glyph_atlas.data() +
+        static_cast<size_t>(character - current_font.first_char) * glyph_rows;
+    uint16_t panel_color = toPanel(color);
+
+    for (int row = 0; row < glyph_rows; row++) {
+        uint32_t bits = bold ? rows[row] | (rows[row] << 1) : rows[row];
+        if (x == 0) {
+            bits &= ~1u;  // Левый выступ за краем экрана
         }
-    }
-    
-    // Специальная обработка для русских букв с выступающими элементами
-    uint8_t char_index = character - current_font.first_char;
-    
-    // Для буквы "ь" (код 0xD0 0xAC)
-    if (char_index == 124) {
-        // Рисуем правую часть буквы "ь"
-        drawPixel(x + current_font.width, y + current_font.height - 4, color);
-        drawPixel(x + current_font.width, y + current_font.height - 3, color);
-        drawPixel(x + current_font.width - 1, y + current_font.height - 2, color);
-    }
-    // Для буквы "ы" (код 0xD1 0x8B)
-    else if (char_index == 20) {
-        for (int row = 1; row < current_font.height - 1; row++) {
-            drawPixel(x + current_font.width + 1, y + row, color);
+        uint16_t* line = framebuffer.data() + (y + row) * width + x - 1;
+
+        // Отрезки подряд идущих точек заполняются целиком
+        while (bits != 0) {
+            int start = __builtin_ctz(bits);
+            int length = __builtin_ctz(~(bits >> start));
+            std::fill(line + start, line + start + length, panel_color);
+            bits &= ~(((1u << length) - 1) << start);
         }
     }
-    // Для буквы "д" (код 0xD0 0xB4)
-    else if (char_index == 6) {
-        drawPixel(x - 1, y + current_font.height, color);
-        drawPixel(x + current_font.width, y + current_font.height, color);
-        for (int col = 0; col < current_font.width; col++) {
-            drawPixel(x + col, y + current_font.height, color);
-        }
-    }
-    // Для буквы "л" (код 0xD0 0xBB)
-    else if (char_index == 11) {
-        // Рисуем левую ножку буквы "л"
-        drawPixel(x - 1, y + current_font.height - 1, color);
-        drawPixel(x, y + current_font.height - 1, color);
-        drawPixel(x + 1, y + current_font.height - 1, color);
-        // Добавляем диагональную линию для формы буквы
-        drawPixel(x + 1, y + current_font.height - 2, color);
-        drawPixel(x + 2, y + current_font.height - 2, color);
-    }
+    markDirty(x - 1, y, x + current_font.width + 1 + extra, y + current_font.height);
 }
 
 void TFTDisplay::drawText(int16_t x, int16_t y, const std::string& text, uint16_t color) {
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_TEXT);
     if (current_font.data == nullptr) {
         return;  // Шрифт не установлен
     }
@@ -481,50 +588,211 @@ void TFTDisplay::drawText(int16_t x, int16_t y, const std::string& text, uint16_
 }
 
 void TFTDisplay::drawImage(int16_t x, int16_t y, int16_t w, int16_t h, const std::vector<uint16_t>& image_data) {
-    if (x >= width || y >= height) return;
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::DRAW_IMAGE);
+    if (x < 0 || y < 0 || x >= width || y >= height) return;
     
     // Clip dimensions to display bounds
     if ((x + w) > width) w = width - x;
     if ((y + h) > height) h = height - y;
     if (w <= 0 || h <= 0) return;
 
-    // Set the address window
-    setAddressWindow(x, y, x + w - 1, y + h - 1);
+    // Copy rows into the framebuffer in display format
+    for (int row = 0; row < h; row++) {
+        for (int col = 0; col < w; col++) {
+            size_t i = static_cast<size_t>(row) * w + col;
+            if (i >= image_data.size()) break;
+            framebuffer[(y + row) * width + x + col] = toPanel(image_data[i]);
+        }
+    }
+    markDirty(x, y, x + w - 1, y + h - 1);
+}
 
-    // Convert all pixels to display format
-    std::vector<uint8_t> buffer(w * h * 2);
-    for (int i = 0; i < w * h && i < image_data.size(); i++) {
-        uint16_t pixel = image_data[i];
-        buffer[i * 2] = pixel >> 8;        // High byte
-        buffer[i * 2 + 1] = pixel & 0xFF;  // Low byte
+void TFTDisplay::flush() {
+    if (dirty.empty()) {
+        return;
     }
+    RenderProfiler::Timer timer(profiling, RenderPrimitive::FLUSH);
 
-    // Send all data at once
-    writeData(buffer.data(), buffer.size());
+    // В кадр попадают все области, не выведенные наверняка: прежний кадр
+    // из ящика мог быть заменен этим, так и не попав на дисплей
+    for (const Rect& rect : dirty) {
+        addDirty(unpresented, rect);
+    }
+    Frame& frame = frames[back_frame];
+    std::copy(framebuffer.begin(), framebuffer.end(), frame.pixels.begin());
+    frame.width = width;
+    frame.dirty = unpresented;
+    frame.sequence = ++published_frames;
+    frame.screen = 0;
+    if (profiling.enabled()) {
+        frame.screen = profiling.currentScreen();
+        profiling.framePublished(frame.screen);
+    }
+
+    // Без FRAME_FRESH вернулся кадр потока вывода: прежний кадр он забрал,
+    // и не выведенными остаются только области этого вызова
+    uint8_t previous = mailbox.exchange(back_frame | FRAME_FRESH, std::memory_order_acq_rel);
+    back_frame = previous & FRAME_INDEX;
+    if (!(previous & FRAME_FRESH)) {
+        unpresented.swap(dirty);
+    }
+    dirty.clear();
 }
 
-void TFTDisplay::writeCommand(uint8_t cmd) {
-    try {
-        spi.setDC(false);  // Режим команды
-        spi.write(&cmd, 1);
-    } catch (const std::exception& e) {
-        
+void TFTDisplay::waitPresented() {
+    if (!render_thread.joinable()) {
+        return;
+    }
+    while (presented_frames.load(std::memory_order_acquire) < published_frames) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 }
 
-void TFTDisplay::writeData(const uint8_t* data, size_t length) {
-    try {
-        spi.setDC(true);  // Режим данных
-        spi.write(const_cast<uint8_t*>(data), length);
-    } catch (const std::exception& e) {
-        
+void TFTDisplay::renderLoop() {
+    const auto frame_interval = std::chrono::microseconds(1000000 / MAX_FPS);
+    auto next_frame = std::chrono::steady_clock::now();
+    while (true) {
+        // Остановка — только после вывода последнего кадра
+        bool stopping = !rendering;
+        if (mailbox.load(std::memory_order_acquire) & FRAME_FRESH) {
+            front_frame = mailbox.exchange(front_frame, std::memory_order_acq_rel) & FRAME_INDEX;
+            present(frames[front_frame]);
+            presented_frames.store(frames[front_frame].sequence, std::memory_order_release);
+        }
+        if (stopping) {
+            break;
+        }
+        next_frame += frame_interval;
+        auto now = std::chrono::steady_clock::now();
+        if (next_frame < now) {
+            next_frame = now;
+        }
+        std::this_thread::sleep_until(next_frame);
     }
 }
 
+void TFTDisplay::present(Frame& frame) {
+    std::lock_guard<std::mutex> lock(spi_mutex);
+    bool profiled = profiling.enabled();
+    RenderProfiler::FrameRecord record{};
+    if (profiled) {
+        record.start = std::chrono::steady_clock::now();
+        record.traffic = sink->stats();
+    }
+
+    // Области, не занимающие строки целиком, собираются в flush_buffer.
+    // Он размечается заранее: очередь SPI ссылается на данные до submit()
+    size_t gathered = 0;
+    for (const Rect& rect : frame.dirty) {
+        int16_t w = rect.x1 - rect.x0 + 1;
+        if (w != frame.width) {
+            gathered += static_cast<size_t>(w) * (rect.y1 - rect.y0 + 1) * 2;
+        }
+    }
+    flush_buffer.resize(gathered);
+
+    uint8_t* out = flush_buffer.data();
+    for (const Rect& rect : frame.dirty) {
+        int16_t w = rect.x1 - rect.x0 + 1;
+        int16_t h = rect.y1 - rect.y0 + 1;
+        setAddressWindow(rect.x0, rect.y0, rect.x1, rect.y1);
+
+        // Строки во всю ширину лежат в кадре подряд
+        const uint16_t* first = frame.pixels.data() + rect.y0 * frame.width + rect.x0;
+        if (w == frame.width) {
+            sink->queueData(reinterpret_cast<const uint8_t*>(first), static_cast<size_t>(w) * h * 2);
+            continue;
+        }
+        for (int16_t row = 0; row < h; row++) {
+            std::memcpy(out + static_cast<size_t>(row) * w * 2, first + row * frame.width, w * 2);
+        }
+        sink->queueData(out, static_cast<size_t>(w) * h * 2);
+        out += static_cast<size_t>(w) * h * 2;
+    }
+    submit();
+
+    if (profiled) {
+        record.screen = frame.screen;
+        record.end = std::chrono::steady_clock::now();
+        record.traffic = sink->stats().since(record.traffic);
+        record.windows = static_cast<uint32_t>(frame.dirty.size());
+        for (const Rect& rect : frame.dirty) {
+            record.pixels += static_cast<uint64_t>(area(rect.x0, rect.y0, rect.x1, rect.y1));
+        }
+        profiling.framePresented(record);
+    }
+}
+
+void TFTDisplay::putPixel(int16_t x, int16_t y, uint16_t color) {
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return;
+    }
+    framebuffer[y * width + x] = toPanel(color);
+}
+
+void TFTDisplay::markDirty(int16_t x0, int16_t y0, int16_t x1, int16_t y1) {
+    Rect rect{std::max<int16_t>(x0, 0), std::max<int16_t>(y0, 0),
+              std::min<int16_t>(x1, width - 1), std::min<int16_t>(y1, height - 1)};
+    if (rect.x0 > rect.x1 || rect.y0 > rect.y1) {
+        return;
+    }
+
+    addDirty(dirty, rect);
+}
+
+void TFTDisplay::addDirty(std::vector<Rect>& regions, Rect rect) {
+    // Поглощение областей, с которыми выгоднее выводить одним окном.
+    // После объединения область выросла, поэтому список просматривается заново
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < regions.size(); i++) {
+            const Rect& other = regions[i];
+            Rect joined{std::min(rect.x0, other.x0), std::min(rect.y0, other.y0),
+                        std::max(rect.x1, other.x1), std::max(rect.y1, other.y1)};
+            if (area(joined.x0, joined.y0, joined.x1, joined.y1) <=
+                area(rect.x0, rect.y0, rect.x1, rect.y1) +
+                area(other.x0, other.y0, other.x1, other.y1) + DIRTY_MERGE_SLACK) {
+                rect = joined;
+                regions.erase(regions.begin() + i);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    // Слишком много разрозненных областей — выводится охватывающая
+    if (regions.size() >= MAX_DIRTY_RECTS) {
+        for (const Rect& other : regions) {
+            rect = {std::min(rect.x0, other.x0), std::min(rect.y0, other.y0),
+                    std::max(rect.x1, other.x1), std::max(rect.y1, other.y1)};
+        }
+        regions.clear();
+    }
+    regions.push_back(rect);
+}
+
+void TFTDisplay::writeCommand(uint8_t cmd) {
+    std::lock_guard<std::mutex> lock(spi_mutex);
+    sink->queueCommand(cmd);
+    submit();
+}
+
+void TFTDisplay::writeData(const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(spi_mutex);
+    sink->queueData(data, length);
+    submit();
+}
+
 void TFTDisplay::writeData(uint8_t data) {
+    std::lock_guard<std::mutex> lock(spi_mutex);
+    sink->queueData(&data, 1);
+    submit();
+}
+
+void TFTDisplay::submit() {
     try {
-        spi.setDC(true);  // Режим данных
-        spi.write(&data, 1);
+        sink->submit();
     } catch (const std::exception& e) {
         
     }
@@ -532,17 +800,17 @@ void TFTDisplay::writeData(uint8_t data) {
 
 void TFTDisplay::setAddressWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
     // Установка диапазона столбцов
-    writeCommand(CMD_CASET);
+    sink->queueCommand(CMD_CASET);
     uint8_t caset[] = {0x00, (uint8_t)x0, 0x00, (uint8_t)x1};
-    writeData(caset, sizeof(caset));
+    sink->queueData(caset, sizeof(caset));
 
     // Установка диапазона строк
-    writeCommand(CMD_RASET);
+    sink->queueCommand(CMD_RASET);
     uint8_t raset[] = {0x00, (uint8_t)y0, 0x00, (uint8_t)y1};
-    writeData(raset, sizeof(raset));
+    sink->queueData(raset, sizeof(raset));
 
     // Команда записи в память
-    writeCommand(CMD_RAMWR);
+    sink->queueCommand(CMD_RAMWR);
 }
 
 void TFTDisplay::setColor(uint16_t color) {
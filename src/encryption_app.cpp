@@ -1,10 +1,16 @@
 #include "encryption_app.h"
 #include "font.h"         // Обычный шрифт
 #include "cyrillic_font.h" // Кириллический шрифт
-#include "utf8_helper.h"  // Новый помощник для UTF-8
 #include "table.h"        // Таблицы для алгоритма Кузнечик
 #include "cmac.h"        // Добавляем поддержку CMAC
 #include "counter_mode.h" // Добавляем поддержку режима гаммирования
+#include "file_engine.h"  // Потоковое шифрование файлов
+#include "device_profile.h" // Профили скорости носителей
+#include "transfer_scheduler.h" // Параллельная обработка пакета файлов
+#include "transfer_plan.h"    // План пакета: место на носителе и оценка времени
+#include "archive.h"          // Архив для пакетов мелких файлов
+#include "manifest.h"         // Манифест изменений на носителе назначения
+#include "checkpoint.h"       // Контрольные точки прерванного пакета
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -19,7 +25,10 @@
 #include <regex>
 #include <set>
 #include <sstream>
+#include <ctime>
+#include <cstdlib>
 #include "display_pi.h"
+#include "spi_pi.h"
 #include "keyboard.h"  // Используем keyboard.h из директории include
 #include <atomic>
 #include <vector>
@@ -28,102 +37,114 @@
 #include <mntent.h>
 #include <sys/stat.h>  // Добавляем для stat() и S_ISDIR
 
-// Функция для преобразования UTF-8 в индекс для кириллического шрифта
-uint8_t utf8ToFontIndex(unsigned char c1, unsigned char c2) {
-    
-    // Таблица соответствий UTF-8 кодов и индексов шрифта для русских букв
-    if (c1 == 0xD0) {
-        switch (c2) {
-            // Заглавные буквы
-            case 0x90: return 128; // А
-            case 0x91: return 129; // Б
-            case 0x92: return 130; // В
-            case 0x93: return 131; // Г
-            case 0x94: return 132; // Д
-            case 0x95: return 133; // Е
-            case 0x96: return 134; // Ж
-            case 0x97: return 135; // З
-            case 0x98: return 136; // И
-            case 0x99: return 137; // Й
-            case 0x9A: return 138; // К
-            case 0x9B: return 139; // Л
-            case 0x9C: return 140; // М
-            case 0x9D: return 141; // Н
-            case 0x9E: return 142; // О
-            case 0x9F: return 143; // П
-            case 0xA0: return 144; // Р
-            case 0xA1: return 145; // С
-            case 0xA2: return 146; // Т
-            case 0xA3: return 147; // У
-            case 0xA4: return 148; // Ф
-            case 0xA5: return 149; // Х
-            case 0xA6: return 150; // Ц
-            case 0xA7: return 151; // Ч
-            case 0xA8: return 152; // Ш
-            case 0xA9: return 153; // Щ
-            case 0xAA: return 154; // Ъ
-            case 0xAB: return 155; // Ы
-            case 0xAC: return 156; // Ь
-            case 0xAD: return 157; // Э
-            case 0xAE: return 158; // Ю
-            case 0xAF: return 159; // Я
-            
-            // Строчные буквы (первая часть)
-            case 0xB0: return 160; // а
-            case 0xB1: return 161; // б
-            case 0xB2: return 162; // в
-            case 0xB3: return 163; // г
-            case 0xB4: return 164; // д
-            case 0xB5: return 165; // е
-            case 0xB6: return 166; // ж
-            case 0xB7: return 167; // з
-            case 0xB8: return 168; // и
-            case 0xB9: return 169; // й
-            case 0xBA: return 170; // к
-            case 0xBB: return 171; // л
-            case 0xBC: return 172; // м
-            case 0xBD: return 173; // н
-            case 0xBE: return 174; // о
-            case 0xBF: return 175; // п
-        }
-    } else if (c1 == 0xD1) {
-        switch (c2) {
-            // Строчные буквы (вторая часть)
-            case 0x80: return 176; // р
-            case 0x81: return 177; // с
-            case 0x82: return 178; // т
-            case 0x83: return 179; // у
-            case 0x84: return 180; // ф
-            case 0x85: return 181; // х
-            case 0x86: return 182; // ц
-            case 0x87: return 183; // ч
-            case 0x88: return 184; // ш
-            case 0x89: return 185; // щ
-            case 0x8A: return 186; // ъ
-            case 0x8B: return 187; // ы
-            case 0x8C: return 188; // ь
-            case 0x8D: return 189; // э
-            case 0x8E: return 190; // ю
-            case 0x8F: return 191; // я
-        }
+// Главное меню: заголовок в рамке и два пункта, нижний пункт — первый
+struct EncryptionApp::MenuScreen {
+    ui::Screen screen;
+    ui::Box header_box;
+    ui::Label header;
+    ui::Line rule_top;
+    ui::Line rule_bottom;
+    ui::Button items[2];
+
+    MenuScreen(int16_t width, int16_t height)
+        : header_box(headerArea(width), COLOR_GREEN),
+          header({static_cast<int16_t>(headerArea(width).x + 1), 11,
+                  static_cast<int16_t>(headerArea(width).w - 2), static_cast<int16_t>(CYRILLIC_FONT.height + 8)},
+                 "СТЦ", COLOR_GREEN, ui::Align::CENTER),
+          rule_top(10, width - 10, 10 + CYRILLIC_FONT.height + 15, COLOR_GREEN),
+          rule_bottom(10, width - 10, 10 + CYRILLIC_FONT.height + 17, COLOR_GREEN),
+          items{{itemArea(width, height, "2 - РАСШИФРОВАТЬ", 0), "2 - РАСШИФРОВАТЬ"},
+                {itemArea(width, height, "1 - ЗАШИФРОВАТЬ", 1), "1 - ЗАШИФРОВАТЬ"}} {
+        screen.add(header_box);
+        screen.add(header);
+        screen.add(rule_top);
+        screen.add(rule_bottom);
+        screen.add(items[0]);
+        screen.add(items[1]);
     }
-    
-    // Для ASCII символов
-    if (c1 < 128) {
-        return c1;
+
+    static ui::Rect headerArea(int16_t width) {
+        int16_t header_width = ui::textWidth("СТЦ") + 20;
+        return {static_cast<int16_t>((width - header_width) / 2), 10,
+                header_width, static_cast<int16_t>(CYRILLIC_FONT.height + 10)};
     }
-    
 
-    return '?'; 
-}
+    static ui::Rect itemArea(int16_t width, int16_t height, const std::string& text, int index) {
+        int16_t row = CYRILLIC_FONT.height + 15;
+        int16_t start_y = (height - 2 * row) / 2 + 20;
+        int16_t item_width = ui::textWidth(text) + 30;
+        return {static_cast<int16_t>((width - item_width) / 2),
+                static_cast<int16_t>(start_y + (1 - index) * row - 5),
+                item_width, static_cast<int16_t>(CYRILLIC_FONT.height + 10)};
+    }
+};
+
+// Выбор файлов: заголовок, список с отметками и позиция в списке
+struct EncryptionApp::FileScreen {
+    ui::Screen screen;
+    ui::Box border;
+    ui::Label header;
+    ui::Line rule;
+    ui::CheckList list;
+    ui::Label position;
+
+    FileScreen(int16_t width, int16_t height)
+        : border({5, 5, static_cast<int16_t>(width - 10), static_cast<int16_t>(height - 10)}, COLOR_GREEN),
+          header({7, 9, static_cast<int16_t>(width - 14), 10}, "ВЫБЕРИТЕ ФАЙЛЫ:", COLOR_GREEN, ui::Align::CENTER),
+          rule(10, width - 10, 10 + CYRILLIC_FONT.height + 5, COLOR_GREEN),
+          list({10, 33, static_cast<int16_t>(width - 20),
+                static_cast<int16_t>((height - 10 - 35) / (CYRILLIC_FONT.height + 10) * (CYRILLIC_FONT.height + 10))},
+               CYRILLIC_FONT.height + 10),
+          position({10, static_cast<int16_t>(height - 10 - CYRILLIC_FONT.height - 6), static_cast<int16_t>(width - 20),
+                    static_cast<int16_t>(CYRILLIC_FONT.height + 2)}, "", COLOR_GREEN, ui::Align::CENTER) {
+        position.setTextCache(ui::TextCache::TRANSIENT);
+        screen.add(border);
+        screen.add(header);
+        screen.add(rule);
+        screen.add(list);
+        screen.add(position);
+    }
+};
+
+// Ход пакета: операция, номер и имя файла, полоса и скорость со временем
+struct EncryptionApp::ProgressScreen {
+    ui::Screen screen;
+    ui::Box border;
+    ui::Label operation;
+    ui::Line rule;
+    ui::Label counter;
+    ui::Label file_name;
+    ui::ProgressBar bar;
+    ui::Label eta;
+
+    ProgressScreen(int16_t width, int16_t height)
+        : border({5, 5, static_cast<int16_t>(width - 10), static_cast<int16_t>(height - 10)}, COLOR_GREEN),
+          operation({7, 14, static_cast<int16_t>(width - 14), 10}, "", COLOR_GREEN, ui::Align::CENTER),
+          rule(10, width - 10, 30, COLOR_GREEN),
+          counter({10, 44, static_cast<int16_t>(width - 20), 10}, "", COLOR_GREEN, ui::Align::CENTER),
+          file_name({10, 64, static_cast<int16_t>(width - 20), 10}, "", COLOR_GREEN, ui::Align::CENTER),
+          bar({20, 90, static_cast<int16_t>(width - 40), 10}, COLOR_GREEN),
+          eta({10, 104, static_cast<int16_t>(width - 20), 10}, "", COLOR_GREEN, ui::Align::CENTER) {
+        // Счетчик и скорость со временем меняются при каждом обновлении
+        counter.setTextCache(ui::TextCache::TRANSIENT);
+        eta.setTextCache(ui::TextCache::TRANSIENT);
+        screen.add(border);
+        screen.add(operation);
+        screen.add(rule);
+        screen.add(counter);
+        screen.add(file_name);
+        screen.add(bar);
+        screen.add(eta);
+    }
+};
 
 // Конструктор
 EncryptionApp::EncryptionApp()
-    : display(0, RESET_PIN, DC_PIN, DISPLAY_WIDTH, DISPLAY_HEIGHT),
+    : display(std::make_unique<SPIDevice>(0, 8000000), DISPLAY_WIDTH, DISPLAY_HEIGHT),
+      stage(display),
       selected_item(0),
       waiting_for_key(false),
-      current_file_index(0),
-      current_page(0) {
+      current_file_index(0) {
     
 
 }
@@ -147,6 +168,23 @@ bool EncryptionApp::init() {
         return false;
     }
     
+    // Установка ориентации дисплея и шрифта. Экраны строятся до запуска
+    // опроса клавиатуры: обработчик нажатий сразу рисует меню
+    display.setRotation(DisplayRotation::ROTATION_0);
+    display.setFont(CYRILLIC_FONT);
+    buildScreens();
+    
+    // Режимы упаковки, сжатия и проверки записи читаются до запуска опроса клавиатуры
+    if (const char* value = std::getenv("SHIFRO_ARCHIVE")) {
+        pack_small_files = std::string(value) == "1";
+    }
+    if (const char* value = std::getenv("SHIFRO_COMPRESS")) {
+        compress_files = std::string(value) == "1";
+    }
+    if (const char* value = std::getenv("SHIFRO_VERIFY")) {
+        verify_writes = std::string(value) == "1";
+    }
+    
     // Инициализация мембранной клавиатуры
     if (!keyboard.init()) {
         return false;
@@ -159,14 +197,31 @@ bool EncryptionApp::init() {
     
     // Запуск потока опроса клавиатуры
     keyboard.start();
-    
-    // Установка ориентации дисплея и шрифта
-    display.setRotation(DisplayRotation::ROTATION_0);
-    display.setFont(CYRILLIC_FONT);
+
+    // Учет отрисовки включается заданием файла отчета или трассы
+    if (const char* path = std::getenv("SHIFRO_PROFILE")) {
+        profile_report_path = path;
+    }
+    if (const char* path = std::getenv("SHIFRO_TRACE")) {
+        profile_trace_path = path;
+    }
+    display.profiler().setEnabled(!profile_report_path.empty() || !profile_trace_path.empty());
 
     return true;
 }
 
+// Запись отчета и трассы учета отрисовки (файлы перезаписываются)
+void EncryptionApp::writeProfile() {
+    if (!profile_report_path.empty()) {
+        std::ofstream report(profile_report_path);
+        display.profiler().writeReport(report);
+    }
+    if (!profile_trace_path.empty()) {
+        std::ofstream trace(profile_trace_path);
+        display.profiler().writeTrace(trace);
+    }
+}
+
 // Настройка терминала для работы с клавиатурой
 void EncryptionApp::setupTerminal() {
     // Сохраняем текущие настройки терминала
@@ -246,7 +301,7 @@ void EncryptionApp::run() {
             // Проверяем состояние приложения каждые 5 секунд
             auto now = std::chrono::steady_clock::now();
             if (std::chrono::duration_cast<std::chrono::seconds>(now - last_status_check).count() >= 5) {
-
+                writeProfile();
                 last_status_check = now;
             }
             
@@ -259,93 +314,36 @@ void EncryptionApp::run() {
     }
 }
 
+// Экраны строятся после выбора шрифта: разметка зависит от ширины текста
+void EncryptionApp::buildScreens() {
+    int16_t width = display.getWidth();
+    int16_t height = display.getHeight();
+    menu_screen = std::make_unique<MenuScreen>(width, height);
+    file_screen = std::make_unique<FileScreen>(width, height);
+    progress_screen = std::make_unique<ProgressScreen>(width, height);
+}
+
 // Отрисовка меню
 void EncryptionApp::drawMenu() {
-    // Очистка экрана
-    display.clearScreen(COLOR_BLACK);
-    
-    
-    // Отрисовка заголовка компании
-    std::string company_name = "СТЦ";
-    
-    // Рисуем рамку вокруг заголовка
-    int16_t header_width = company_name.length() * (CYRILLIC_FONT.width + 2) + 20;
-    int16_t header_x = (display.getWidth() - header_width) / 2;
-    int16_t header_y = 10;
-    
-    // Рисуем рамку
-    display.drawRect(header_x, header_y, 
-                    header_width, CYRILLIC_FONT.height + 10, 
-                    COLOR_GREEN);
-
-    // Рисуем заголовок по центру рамки
-    drawCurrentFile(company_name, -1, header_y + 5, COLOR_GREEN);
-    
-    // Отрисовка декоративных линий
-    int16_t line_y = header_y + CYRILLIC_FONT.height + 15;
-    display.drawLine(10, line_y, display.getWidth() - 10, line_y, COLOR_GREEN);
-    display.drawLine(10, line_y + 2, display.getWidth() - 10, line_y + 2, COLOR_GREEN);
-
-    // Вычисляем размеры для меню
-    int16_t menu_height = 2 * (CYRILLIC_FONT.height + 15); 
-    int16_t start_y = (display.getHeight() - menu_height) / 2 + 20; 
-    
-    // Отрисовка пунктов меню
+    RenderProfiler::Screen screen(display.profiler(), "drawMenu");
     for (size_t i = 0; i < 2; i++) {
-        drawMenuItem(i, i == selected_item);
+        menu_screen->items[i].setSelected(i == selected_item);
     }
+    stage.show(menu_screen->screen);
 }
 
 void EncryptionApp::drawMenuItem(int index, bool is_selected) {
-    static int last_selected = -1;
-    if (last_selected == index && !is_selected) return;  // Не перерисовываем неизменившиеся пункты
-    
-    const char* menu_items[] = {
-        "2 - РАСШИФРОВАТЬ",
-        "1 - ЗАШИФРОВАТЬ"
-    };
-    
-    // Вычисляем начальную позицию Y 
-    int16_t menu_height = 2 * (CYRILLIC_FONT.height + 15);  
-    int16_t start_y = (display.getHeight() - menu_height) / 2 + 20;  
-    
-    // Инвертируем индекс для отрисовки снизу вверх
-    int display_index = 1 - index;
-    int16_t item_y = start_y + display_index * (CYRILLIC_FONT.height + 15);
-    
-    // Цвет текста в зависимости от выбора
-    uint16_t text_color = is_selected ? COLOR_WHITE : COLOR_GREEN;
-    // Цвет фона в зависимости от выбора
-    uint16_t bg_color = is_selected ? COLOR_BLUE : COLOR_BLACK;
-    
-    const char* menu_text = menu_items[index];
-    
-    // Вычисляем размеры пункта меню
-    int16_t item_width = strlen(menu_text) * (CYRILLIC_FONT.width + 2) + 20;
-    int16_t item_x = (display.getWidth() - item_width) / 2;
-    
-    // Рисуем рамку вокруг пункта меню
-    display.fillRect(item_x - 5, item_y - 5, 
-                    item_width + 10, CYRILLIC_FONT.height + 10, 
-                    bg_color);
-    display.drawRect(item_x - 5, item_y - 5, 
-                    item_width + 10, CYRILLIC_FONT.height + 10, 
-                    is_selected ? COLOR_WHITE : COLOR_GREEN);
-    
-    // Отрисовка текста с автоцентрированием
-    drawCurrentFile(menu_text, -1, item_y, text_color);
-    
-    last_selected = is_selected ? index : -1;
+    RenderProfiler::Screen screen(display.profiler(), "drawMenuItem");
+    menu_screen->items[index].setSelected(is_selected);
+    stage.show(menu_screen->screen);
 }
 
+// Сообщение поверх текущего экрана; закрывается следующей отрисовкой экрана
 void EncryptionApp::showMessage(const std::string& message, bool isError, int timeout_seconds) {
-    display.clearScreen(COLOR_BLACK);
-    
-    // Адаптируем сообщения под короткие варианты
-    std::string display_message = message;
-    int16_t text_y = this->display.getHeight() / 2 - 10;
-    uint16_t color = isError ? COLOR_RED : COLOR_GREEN;
-    this->drawCurrentFile(display_message, -1, text_y, color);
+    {
+        RenderProfiler::Screen screen(display.profiler(), "showMessage");
+        stage.showMessage({message}, isError ? COLOR_RED : COLOR_GREEN);
+    }
     
     // Ждем указанное время
     std::this_thread::sleep_for(std::chrono::seconds(timeout_seconds));
@@ -417,11 +415,9 @@ bool EncryptionApp::checkDeviceExists(const std::string& device) {
 }
 
 // Реализация новых методов
-void EncryptionApp::loadFilesFromDrive(const std::string& path) {
+void EncryptionApp::loadFilesFromDrive(const std::string& path, bool decrypting) {
     file_list.clear();
     current_file_index = 0;
-    current_page = 0;
-    files_per_page = 4;
 
     try {
         // Проверяем существование пути
@@ -444,6 +440,11 @@ void EncryptionApp::loadFilesFromDrive(const std::string& path) {
         // Считаем файлы
         for (const auto& entry : std::filesystem::directory_iterator(path)) {
             if (entry.is_regular_file()) {
+                // Служебные манифест изменений и журнал контрольных точек в список не попадают
+                if (entry.path().filename() == manifest::FILE_NAME ||
+                    entry.path().filename() == checkpoint::FILE_NAME) {
+                    continue;
+                }
                 FileInfo file;
                 file.name = entry.path().filename().string();
                 file.selected = false;
@@ -452,7 +453,40 @@ void EncryptionApp::loadFilesFromDrive(const std::string& path) {
             }
         }
 
-        
+        if (decrypting) {
+            // Проверяем только начало каждого файла, несколько файлов сразу:
+            // на флешке время ожидания каждого чтения больше времени передачи
+            std::vector<char> valid(file_list.size(), 0);
+            std::atomic<size_t> next_file(0);
+            auto probe = [&]() {
+                for (size_t i = next_file++; i < file_list.size(); i = next_file++) {
+                    FileInfo& file = file_list[i];
+                    valid[i] = archive::describe(file.full_path, file.plain_size) ||
+                               file_engine::describeFile(file.full_path, file.plain_size);
+                }
+            };
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < std::min(transfer_scheduler::MAX_WORKERS, file_list.size()); i++) {
+                workers.emplace_back(probe);
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            std::vector<FileInfo> encrypted;
+            for (size_t i = 0; i < file_list.size(); i++) {
+                if (valid[i]) {
+                    encrypted.push_back(std::move(file_list[i]));
+                }
+            }
+            file_list = std::move(encrypted);
+        }
+
+        std::vector<ui::CheckList::Item> items;
+        for (const auto& file : file_list) {
+            items.push_back({file.name, file.selected});
+        }
+        file_screen->list.setItems(std::move(items));
     } catch (const std::filesystem::filesystem_error& e) {
         throw;
     } catch (const std::exception& e) {
@@ -460,77 +494,23 @@ void EncryptionApp::loadFilesFromDrive(const std::string& path) {
     }
 }
 
-void EncryptionApp::drawFileSelectionMenu(bool force_full_redraw) {
-    static bool first_draw = true;
-    static int last_selected = -1;
-    static size_t last_page = 0;
-
-    bool need_full_update = first_draw || force_full_redraw || last_page != current_page;
-
-    if (need_full_update) {
-        display.clearScreen(COLOR_BLACK);
-        display.drawRect(5, 5, display.getWidth() - 10, display.getHeight() - 10, COLOR_GREEN);
-        std::string header = "ВЫБЕРИТЕ ФАЙЛЫ:";
-        int16_t header_y = 10;
-        drawCurrentFile(header, -1, header_y, COLOR_GREEN);
-        display.drawLine(10, header_y + CYRILLIC_FONT.height + 5,
-                       display.getWidth() - 10, header_y + CYRILLIC_FONT.height + 5,
-                       COLOR_GREEN);
-        first_draw = false;
-        last_page = current_page;
-    }
-
-    int16_t list_start_y = 35;
-    int16_t list_end_y = display.getHeight() - 10;
-    int16_t list_height = list_end_y - list_start_y;
-    files_per_page = list_height / (CYRILLIC_FONT.height + 10);
-
-    size_t start_idx = current_page * files_per_page;
-    int16_t item_y = list_start_y;
-
-    if (need_full_update) {
-        // Полностью обновляем список файлов
-        display.fillRect(10, list_start_y, display.getWidth() - 20, list_height, COLOR_BLACK);
-        for (size_t i = 0; i < files_per_page && (start_idx + i) < file_list.size(); ++i) {
-            const auto& file = file_list[start_idx + i];
-            bool is_current = (start_idx + i == current_file_index);
-            uint16_t text_color = is_current ? COLOR_WHITE : COLOR_GREEN;
-            uint16_t bg_color = is_current ? COLOR_BLUE : COLOR_BLACK;
-            display.fillRect(10, item_y - 2, display.getWidth() - 20, CYRILLIC_FONT.height + 4, bg_color);
-            std::string checkbox = file.selected ? "[X] " : "[ ] ";
-            std::string filename = file.name;
-            if (filename.length() > 20) filename = filename.substr(0, 17) + "...";
-            std::string line = checkbox + filename;
-            drawCurrentFile(line, 15, item_y, text_color);
-            item_y += CYRILLIC_FONT.height + 10;
-        }
-        // Номер страницы
-        if (file_list.size() > files_per_page) {
-            size_t total_pages = (file_list.size() + files_per_page - 1) / files_per_page;
-            std::string page_info = std::to_string(current_page + 1) + "/" + std::to_string(total_pages);
-            drawCurrentFile(page_info, -1, list_end_y - CYRILLIC_FONT.height - 5, COLOR_GREEN);
-        }
-        last_selected = current_file_index;
-    } else {
-        // Обновляем только одну строку (старую и новую)
-        for (int i = 0; i < files_per_page; ++i) {
-            size_t idx = start_idx + i;
-            if (idx >= file_list.size()) break;
-            if ((int)idx == last_selected || (int)idx == current_file_index) {
-                int16_t y = list_start_y + i * (CYRILLIC_FONT.height + 10);
-                bool is_current = (idx == current_file_index);
-                uint16_t text_color = is_current ? COLOR_WHITE : COLOR_GREEN;
-                uint16_t bg_color = is_current ? COLOR_BLUE : COLOR_BLACK;
-                display.fillRect(10, y - 2, display.getWidth() - 20, CYRILLIC_FONT.height + 4, bg_color);
-                std::string checkbox = file_list[idx].selected ? "[X] " : "[ ] ";
-                std::string filename = file_list[idx].name;
-                if (filename.length() > 20) filename = filename.substr(0, 17) + "...";
-                std::string line = checkbox + filename;
-                drawCurrentFile(line, 15, y, text_color);
-            }
-        }
-        last_selected = current_file_index;
+// Список перерисовывает только изменившиеся строки, сдвиг на строку —
+// прокруткой уже нарисованных (ui::CheckList)
+void EncryptionApp::drawFileSelectionMenu() {
+    RenderProfiler::Screen screen(display.profiler(), "drawFileSelectionMenu");
+    ui::CheckList& list = file_screen->list;
+    for (size_t i = 0; i < file_list.size(); i++) {
+        list.setChecked(i, file_list[i].selected);
     }
+    list.setCurrent(current_file_index);
+
+    // Позиция курсора в списке
+    std::string position;
+    if (file_list.size() > list.visibleRows()) {
+        position = std::to_string(current_file_index + 1) + "/" + std::to_string(file_list.size());
+    }
+    file_screen->position.setText(position);
+    stage.show(file_screen->screen);
 }
 
 void EncryptionApp::handleMembraneKeypress(int key) {
@@ -548,17 +528,12 @@ void EncryptionApp::handleMembraneKeypress(int key) {
         
         bool any_selected = false;
         bool need_redraw = false;
-        bool need_full_redraw = false;
         
         try {
             switch (key) {
                 case MembraneKeyboard::BTN_UP: // GPIO 6 
                     if (current_file_index > 0) {
                         current_file_index--;
-                        if (current_file_index < current_page * files_per_page) {
-                            current_page--;
-                            need_full_redraw = true;
-                        }
                         need_redraw = true;
                     } else {
                         std::cout << ">>> ФАЙЛЫ: Достигнут верхний предел списка" << std::endl;
@@ -568,10 +543,6 @@ void EncryptionApp::handleMembraneKeypress(int key) {
                 case MembraneKeyboard::BTN_DOWN: // GPIO 5 - Вниз
                     if (current_file_index < file_list.size() - 1) {
                         current_file_index++;
-                        if (current_file_index >= (current_page + 1) * files_per_page) {
-                            current_page++;
-                            need_full_redraw = true;
-                        }
                         need_redraw = true;
                     } else {
                         std::cout << ">>> ФАЙЛЫ: Достигнут нижний предел списка" << std::endl;
@@ -581,20 +552,8 @@ void EncryptionApp::handleMembraneKeypress(int key) {
                 case MembraneKeyboard::BTN_SELECT: // GPIO 13 - Кнопка 3 - ВЫБОР файла (инвертировать чекбокс)
                     if (!file_list.empty() && current_file_index < file_list.size()) {
                         file_list[current_file_index].selected = !file_list[current_file_index].selected;
-                        
-                        // Обновляем только текущую строку вместо всего меню
-                        size_t start_idx = current_page * files_per_page;
-                        int16_t list_start_y = 35;
-                        int16_t item_y = list_start_y + (current_file_index - start_idx) * (CYRILLIC_FONT.height + 10);
-                        
-                        // Перерисовываем только текущую строку
-                        display.fillRect(10, item_y - 2, display.getWidth() - 20, CYRILLIC_FONT.height + 4, COLOR_BLUE);
-                        std::string checkbox = file_list[current_file_index].selected ? "[X] " : "[ ] ";
-                        std::string filename = file_list[current_file_index].name;
-                        if (filename.length() > 20) filename = filename.substr(0, 17) + "...";
-                        std::string line = checkbox + filename;
-                        drawCurrentFile(line, 15, item_y, COLOR_WHITE);
-                        
+                        // Перерисуется только текущая строка
+                        need_redraw = true;
                     } else {
                         std::cout << ">>> ФАЙЛЫ: Список файлов пуст или индекс вне диапазона" << std::endl;
                     }
@@ -635,9 +594,8 @@ void EncryptionApp::handleMembraneKeypress(int key) {
                         }
                         return; 
                     } else {
-                        display.clearScreen(COLOR_BLACK);
                         showMessage("Выберите файлы", true, 1);
-                        drawFileSelectionMenu(true);
+                        drawFileSelectionMenu();
                         return;
                     }
                     break;
@@ -647,12 +605,12 @@ void EncryptionApp::handleMembraneKeypress(int key) {
             }
         } catch (const std::exception& e) {
             showMessage("Ошибка", true, 1);
-            drawFileSelectionMenu(true); // Принудительное обновление после ошибки
+            drawFileSelectionMenu(); // Закрывает сообщение об ошибке
         }
         
         // Обновляем отображение если нужно
         if (need_redraw) {
-            drawFileSelectionMenu(need_full_redraw);
+            drawFileSelectionMenu();
         }
     } else {
         
@@ -698,7 +656,6 @@ void EncryptionApp::processSelection(MenuOption option) {
             
             // Сбрасываем состояние перед инициализацией
             current_file_index = 0;
-            current_page = 0;
             file_list.clear();
             
             // Инициализируем режим выбора файлов
@@ -715,7 +672,7 @@ void EncryptionApp::processSelection(MenuOption option) {
             }
             
             try {
-                loadFilesFromDrive(source_drive);
+                loadFilesFromDrive(source_drive, false);
                 if (file_list.empty()) {
                     showMessage("Нет файлов", true, 2);
                     waiting_for_key = false;
@@ -723,10 +680,8 @@ void EncryptionApp::processSelection(MenuOption option) {
                     return;
                 }
                 
-                // Очищаем экран перед отрисовкой меню выбора файлов
-                display.clearScreen(COLOR_BLACK);
                 // Отрисовываем меню выбора файлов
-                drawFileSelectionMenu(true);
+                drawFileSelectionMenu();
                 return;
                 
             } catch (const std::exception& e) {
@@ -740,7 +695,6 @@ void EncryptionApp::processSelection(MenuOption option) {
         case MenuOption::DECRYPT: {
             // Сбрасываем состояние
             current_file_index = 0;
-            current_page = 0;
             file_list.clear();
             waiting_for_key = true;
             
@@ -755,7 +709,7 @@ void EncryptionApp::processSelection(MenuOption option) {
             }
             
             try {
-                loadFilesFromDrive(source_drive);
+                loadFilesFromDrive(source_drive, true);
                 if (file_list.empty()) {
                     showMessage("Нет файлов", true, 2);
                     waiting_for_key = false;
@@ -763,10 +717,8 @@ void EncryptionApp::processSelection(MenuOption option) {
                     return;
                 }
                 
-                // Очищаем экран перед отрисовкой меню выбора файлов
-                display.clearScreen(COLOR_BLACK);
                 // Отрисовываем меню выбора файлов
-                drawFileSelectionMenu(true);
+                drawFileSelectionMenu();
                 return;
                 
             } catch (const std::exception& e) {
@@ -780,113 +732,20 @@ void EncryptionApp::processSelection(MenuOption option) {
     }
 }
 
-// Обновляем отображение текущего файла
+// Строка текста на очищенном фоне для экранов, которые рисуются в обход
+// ui::Stage; x < 0 — по центру
 void EncryptionApp::drawCurrentFile(const std::string& fileName, int16_t x, int16_t y, uint16_t color) {
     if (fileName.empty()) {
         return;
     }
 
-    const char* utf8_str = fileName.c_str();
-    size_t pos = 0;
-    size_t char_pos = 0;
-    int16_t letter_spacing = 2;  // Базовый отступ между буквами
-    
-    // Сначала подсчитаем реальную длину текста в символах (с учетом UTF-8)
-    size_t real_length = 0;
-    std::vector<int16_t> char_widths;  // Хранит ширину каждого символа
-    size_t temp_pos = 0;
-    while (temp_pos < fileName.length()) {
-        unsigned char c1 = utf8_str[temp_pos];
-        unsigned char c2 = (temp_pos + 1 < fileName.length()) ? utf8_str[temp_pos + 1] : 0;
-        
-        // Определяем ширину символа
-        int16_t char_width = CYRILLIC_FONT.width;
-        if ((c1 == 0xD0 && c2 == 0xA6) ||  // Ц
-            (c1 == 0xD1 && c2 == 0x8C) ||  // ь
-            (c1 == 0xD0 && c2 == 0x86)) {  // ц
-            char_width += 1;  // Добавляем место для хвостика
-        }
-        
-        char_widths.push_back(char_width);
-        
-        if ((c1 >= 0xD0 && c1 <= 0xD1) && (temp_pos + 1 < fileName.length())) {
-            temp_pos += 2;  // Двухбайтовый UTF-8
-        } else {
-            temp_pos += 1;  // Однобайтовый ASCII
-        }
-        real_length++;
-    }
-    
-    // Вычисляем общую ширину текста с учетом разных размеров символов
-    int16_t total_width = 0;
-    for (size_t i = 0; i < char_widths.size(); i++) {
-        total_width += char_widths[i] + letter_spacing;
-    }
-    total_width -= letter_spacing;  // Убираем последний отступ
-    
-    // Если x < 0, центрируем текст по горизонтали
+    int16_t total_width = ui::textWidth(fileName);
     if (x < 0) {
         x = (display.getWidth() - total_width) / 2;
         if (x < 0) x = 0;
     }
-
-    // Удаляем добавление чекбокса! Просто рисуем строку fileName
-    // Очищаем область перед отрисовкой текста
     display.fillRect(x - 1, y - 1, total_width + 2, CYRILLIC_FONT.height + 2, COLOR_BLACK);
-    
-    // Отрисовываем текст
-    int16_t current_x = x;
-    size_t char_index = 0;
-    while (pos < fileName.length()) {
-        unsigned char c1 = utf8_str[pos];
-        unsigned char c2 = (pos + 1 < fileName.length()) ? utf8_str[pos + 1] : 0;
-        
-        // Проверяем, не выходим ли за пределы экрана
-        if (current_x + CYRILLIC_FONT.width > display.getWidth()) {
-            break;
-        }
-        
-        uint8_t font_index;
-        if ((c1 >= 0xD0 && c1 <= 0xD1) && (pos + 1 < fileName.length())) {
-            font_index = utf8ToFontIndex(c1, c2);
-            pos += 2;
-        } else {
-            font_index = c1;
-            pos += 1;
-        }
-        
-        try {
-            // Специальная обработка для проблемных букв
-            bool is_problematic = false;
-            if ((c1 == 0xD0 && (c2 == 0xA8 || c2 == 0x88)) ||  // Ш, ш
-                (c1 == 0xD0 && (c2 == 0xA9 || c2 == 0x89)) ||  // Щ, щ
-                (c1 == 0xD0 && (c2 == 0xA4 || c2 == 0xB4))) {  // Ф, ф
-                // Для широких букв рисуем тоньше
-                display.drawChar(current_x, y, font_index, color);
-                is_problematic = true;
-            }
-            
-            if (!is_problematic) {
-                // Для остальных букв рисуем с утолщением
-                display.drawChar(current_x, y, font_index, color);
-                display.drawChar(current_x + 1, y, font_index, color);
-            }
-            
-            // Специальная обработка для букв с хвостиками
-            if ((c1 == 0xD0 && c2 == 0xA6) ||  // Ц
-                (c1 == 0xD1 && c2 == 0x8C) ||  // ь
-                (c1 == 0xD0 && c2 == 0x86)) {  // ц
-                // Добавляем хвостик
-                display.drawPixel(current_x + CYRILLIC_FONT.width, y + CYRILLIC_FONT.height - 1, color);
-            }
-            
-        } catch (const std::exception& e) {
-            std::cerr << "Ошибка при отрисовке символа: " << e.what() << std::endl;
-        }
-        
-        current_x += char_widths[char_index] + letter_spacing;
-        char_index++;
-    }
+    ui::drawText(display, fileName, x, y, color);
 }
 
 // Получение пути к USB-накопителю
@@ -924,279 +783,15 @@ std::pair<std::string, std::string> EncryptionApp::getStoragePaths() {
     return std::make_pair(first_usb, second_usb);
 }
 
-void EncryptionApp::encryptFile(const std::string& source_file, const std::string& dest_file) {
-    constexpr size_t BUFFER_SIZE = 1024 * 1024; // 1MB буфер
-    
-    // Открываем исходный файл
-    std::ifstream in(source_file, std::ios::binary);
-    if (!in) {
-        throw std::runtime_error("Не удалось открыть исходный файл: " + source_file);
-    }
-    
-    // Получаем размер файла
-    in.seekg(0, std::ios::end);
-    size_t file_size = in.tellg();
-    in.seekg(0, std::ios::beg);
-    
-    // Подготавливаем мастер-ключ (32 байта)
-    unsigned char masterKey[32] = {0};
-    memcpy(masterKey, encryptionKey.c_str(), std::min<size_t>(encryptionKey.length(), 16));
-    memcpy(masterKey + 16, encryptionKey.c_str(), std::min<size_t>(encryptionKey.length(), 16));
-    
-    // Выделяем память под раундовые ключи
-    unsigned char roundKeys[160] = {0};
-    
-    // Разворачиваем ключи
-    if (kuznechik_expkey(masterKey, roundKeys) != 0) {
-        throw std::runtime_error("Ошибка развертывания ключа");
-    }
-    
-    // Создаем временный вектор для накопления данных для CMAC
-    std::vector<char> all_data;
-    all_data.reserve(file_size);
-    
-    // Создаем временный файл
-    std::string temp_file = dest_file + ".tmp";
-    std::ofstream out(temp_file, std::ios::binary | std::ios::trunc);
-    if (!out) {
-        throw std::runtime_error("Не удалось создать временный файл: " + temp_file);
-    }
-    
-    
-    auto iv = counter_mode::generate_iv();
-    counter_mode::Counter ctr;
-    ctr.setValue(iv.data());
-    
-    // Записываем синхропосылку в начало файла
-    out.write(reinterpret_cast<const char*>(iv.data()), counter_mode::IV_SIZE);
-    
-    // Буферы для чтения и шифрования
-    std::vector<char> buffer(BUFFER_SIZE);
-    std::vector<char> encrypted_buffer;
-    size_t total_read = 0;
-    
-    // Читаем и шифруем файл блоками
-    while (total_read < file_size) {
-        // Определяем размер следующего блока для чтения
-        size_t bytes_to_read = std::min(BUFFER_SIZE, file_size - total_read);
-        
-        // Читаем блок данных
-        in.read(buffer.data(), bytes_to_read);
-        std::streamsize bytes_read = in.gcount();
-        if (bytes_read <= 0) break;
-        
-        // Добавляем прочитанные данные для последующего вычисления CMAC
-        all_data.insert(all_data.end(), buffer.data(), buffer.data() + bytes_read);
-        
-        // Вычисляем размер зашифрованных данных (округляем до размера блока)
-        size_t blocks = (bytes_read + counter_mode::BLOCK_SIZE - 1) / counter_mode::BLOCK_SIZE;
-        size_t padded_size = blocks * counter_mode::BLOCK_SIZE;
-        encrypted_buffer.resize(padded_size);
-        
-        // Шифруем блоками
-        for (size_t pos = 0; pos < padded_size; pos += counter_mode::BLOCK_SIZE) {
-            unsigned char block[counter_mode::BLOCK_SIZE] = {0};
-            unsigned char gamma[counter_mode::BLOCK_SIZE] = {0};
-            
-            // Копируем данные в блок с паддингом
-            size_t block_size = std::min<size_t>(counter_mode::BLOCK_SIZE, bytes_read - pos);
-            std::memcpy(block, buffer.data() + pos, block_size);
-            
-            // Генерируем гамму и накладываем её на данные
-            counter_mode::generate_gamma(gamma, ctr, roundKeys);
-            counter_mode::apply_gamma(block, gamma, block_size);
-            
-            // Копируем зашифрованный блок в выходной буфер
-            std::memcpy(encrypted_buffer.data() + pos, block, block_size);
-        }
-        
-        // Записываем зашифрованный блок
-        out.write(encrypted_buffer.data(), bytes_read);
-        if (!out.good()) {
-            out.close();
-            std::filesystem::remove(temp_file);
-            throw std::runtime_error("Ошибка записи в файл");
-        }
-        
-        total_read += bytes_read;
-    }
-    
-    // Вычисляем CMAC для всего файла
-    auto mac = cmac::calculateCMAC(all_data, masterKey, roundKeys);
-    
-    // Записываем MAC в конец файла
-    out.write(reinterpret_cast<const char*>(mac.data()), mac.size());
-    if (!out.good()) {
-        out.close();
-        std::filesystem::remove(temp_file);
-        throw std::runtime_error("Ошибка записи MAC");
-    }
-    
-    // Закрываем файлы
-    in.close();
-    out.close();
-    
-    // Проверяем, что временный файл создан успешно
-    if (!std::filesystem::exists(temp_file)) {
-        throw std::runtime_error("Временный файл не создан");
-    }
-    
-    // Проверяем размер временного файла
-    auto temp_size = std::filesystem::file_size(temp_file);
-    if (temp_size <= file_size) {
-        std::filesystem::remove(temp_file);
-        throw std::runtime_error("Некорректный размер зашифрованного файла");
-    }
-    
-    // Перемещаем временный файл в целевой
-    try {
-        std::filesystem::rename(temp_file, dest_file);
-    } catch (const std::filesystem::filesystem_error& e) {
-        try {
-            std::filesystem::copy_file(temp_file, dest_file, 
-                                     std::filesystem::copy_options::overwrite_existing);
-            std::filesystem::remove(temp_file);
-        } catch (const std::filesystem::filesystem_error& e2) {
-            throw std::runtime_error("Не удалось создать конечный файл: " + 
-                                   std::string(e2.what()));
-        }
-    }
-    
-    // Финальная проверка
-    if (!std::filesystem::exists(dest_file)) {
-        throw std::runtime_error("Файл не создан после всех операций");
-    }
-    
-    // Принудительно сбрасываем буферы файловой системы
-    sync();
+void EncryptionApp::encryptFile(const std::string& source_file, const std::string& dest_file,
+                                const file_engine::Options& options) {
+    file_engine::encryptFile(source_file, dest_file, file_engine::expandKey(encryptionKey), options);
 }
 
 // Метод для расшифрования отдельного файла
-void EncryptionApp::decryptFile(const std::string& source_file, const std::string& dest_file) {
-    constexpr size_t BUFFER_SIZE = 1024 * 1024; // 1MB буфер для чтения/записи
-    
-    // Открываем зашифрованный файл
-    std::ifstream in(source_file, std::ios::binary);
-    if (!in) {
-        throw std::runtime_error("Не удалось открыть файл: " + source_file);
-    }
-    
-    // Получаем размер файла
-    in.seekg(0, std::ios::end);
-    size_t file_size = in.tellg();
-    in.seekg(0, std::ios::beg);
-    
-    // Проверяем минимальный размер (IV + MAC)
-    if (file_size < counter_mode::IV_SIZE + 16) {
-        throw std::runtime_error("Файл слишком мал для расшифровки");
-    }
-    
-    // Читаем синхропосылку
-    std::vector<uint8_t> iv(counter_mode::IV_SIZE);
-    in.read(reinterpret_cast<char*>(iv.data()), counter_mode::IV_SIZE);
-    
-    // Инициализируем счетчик
-    counter_mode::Counter ctr;
-    ctr.setValue(iv.data());
-    
-    // Подготавливаем мастер-ключ (32 байта)
-    unsigned char masterKey[32] = {0};
-    memcpy(masterKey, encryptionKey.c_str(), std::min<size_t>(encryptionKey.length(), 16));
-    memcpy(masterKey + 16, encryptionKey.c_str(), std::min<size_t>(encryptionKey.length(), 16));
-    
-    // Выделяем память под раундовые ключи (10 ключей по 16 байт)
-    unsigned char roundKeys[160] = {0};
-    
-    // Разворачиваем ключи
-    if (kuznechik_expkey(masterKey, roundKeys) != 0) {
-        throw std::runtime_error("Ошибка развертывания ключа");
-    }
-    
-    // Создаем временный вектор для накопления расшифрованных данных для CMAC
-    std::vector<char> decrypted_data;
-    size_t encrypted_size = file_size - counter_mode::IV_SIZE - 16; // Размер без IV и MAC
-    decrypted_data.reserve(encrypted_size);
-    
-    // Открываем файл для записи
-    std::ofstream out(dest_file, std::ios::binary | std::ios::trunc);
-    if (!out) {
-        throw std::runtime_error("Не удалось создать файл: " + dest_file);
-    }
-    
-    // Читаем MAC из конца файла
-    std::vector<uint8_t> stored_mac(16);
-    in.seekg(-16, std::ios::end);
-    in.read(reinterpret_cast<char*>(stored_mac.data()), 16);
-    
-    // Возвращаемся к позиции после IV для чтения данных
-    in.seekg(counter_mode::IV_SIZE, std::ios::beg);
-    
-    // Буфер для чтения и расшифрования
-    std::vector<char> buffer(BUFFER_SIZE);
-    std::vector<char> decrypted_buffer;
-    size_t total_read = 0;
-    
-    // Читаем и расшифровываем файл блоками
-    while (total_read < encrypted_size) {
-        // Определяем размер следующего блока для чтения
-        size_t bytes_to_read = std::min(BUFFER_SIZE, encrypted_size - total_read);
-        
-        // Читаем блок данных
-        in.read(buffer.data(), bytes_to_read);
-        std::streamsize bytes_read = in.gcount();
-        if (bytes_read <= 0) break;
-        
-        // Вычисляем размер расшифрованных данных (должен быть кратен размеру блока)
-        size_t blocks = (bytes_read + counter_mode::BLOCK_SIZE - 1) / counter_mode::BLOCK_SIZE;
-        size_t padded_size = blocks * counter_mode::BLOCK_SIZE;
-        decrypted_buffer.resize(padded_size);
-        
-        // Расшифровываем блоками
-        for (size_t pos = 0; pos < bytes_read; pos += counter_mode::BLOCK_SIZE) {
-            unsigned char block[counter_mode::BLOCK_SIZE] = {0};
-            unsigned char gamma[counter_mode::BLOCK_SIZE] = {0};
-            
-            // Копируем зашифрованный блок
-            size_t block_size = std::min<size_t>(counter_mode::BLOCK_SIZE, bytes_read - pos);
-            std::memcpy(block, buffer.data() + pos, block_size);
-            
-            // Генерируем гамму и накладываем её на данные
-            counter_mode::generate_gamma(gamma, ctr, roundKeys);
-            counter_mode::apply_gamma(block, gamma, block_size);
-            
-            // Копируем расшифрованный блок
-            std::memcpy(decrypted_buffer.data() + pos, block, block_size);
-        }
-        
-        // Сохраняем расшифрованные данные для проверки CMAC
-        decrypted_data.insert(decrypted_data.end(), 
-                            decrypted_buffer.begin(), 
-                            decrypted_buffer.begin() + bytes_read);
-        
-        // Записываем расшифрованный блок
-        out.write(decrypted_buffer.data(), bytes_read);
-        if (!out.good()) {
-            out.close();
-            std::filesystem::remove(dest_file);
-            throw std::runtime_error("Ошибка записи в файл");
-        }
-        
-        total_read += bytes_read;
-    }
-    
-    // Закрываем файл для записи
-    out.close();
-    
-    // Проверяем CMAC
-    auto calculated_mac = cmac::calculateCMAC(decrypted_data, masterKey, roundKeys);
-    
-    // Сравниваем вычисленный и сохраненный MAC
-    if (!std::equal(calculated_mac.begin(), calculated_mac.end(), stored_mac.begin())) {
-        std::filesystem::remove(dest_file);
-        throw std::runtime_error("Ошибка: MAC не совпадает");
-    }
-    
-    in.close();
+void EncryptionApp::decryptFile(const std::string& source_file, const std::string& dest_file,
+                                const file_engine::Options& options) {
+    file_engine::decryptFile(source_file, dest_file, file_engine::expandKey(encryptionKey), options);
 }
 
 std::vector<std::string> EncryptionApp::findUsbMountPoints() {
@@ -1328,6 +923,7 @@ std::string EncryptionApp::waitForUsbDrive(const std::string& message, int timeo
         }
     }
 
+    stage.release();
     display.clearScreen(COLOR_BLACK);
 
     // Разбиваем сообщение на строки
@@ -1402,6 +998,7 @@ std::string EncryptionApp::waitForUsbDrive(const std::string& message, int timeo
         drawCurrentFile(line, -1, current_y, COLOR_GREEN);
         current_y += CYRILLIC_FONT.height + 5;
     }
+    display.flush();
 
     auto last_animation_time = std::chrono::steady_clock::now();
 
@@ -1425,7 +1022,9 @@ std::string EncryptionApp::waitForUsbDrive(const std::string& message, int timeo
         auto animation_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
             current_time - last_animation_time).count();
         if (animation_elapsed >= 250) {
+            RenderProfiler::Screen screen(display.profiler(), "waitForUsbDrive/frame");
             drawAnimatedFrame(frame_animation++);
+            display.flush();
             last_animation_time = current_time;
         }
 
@@ -1445,11 +1044,14 @@ std::string EncryptionApp::waitForUsbDrive(const std::string& message, int timeo
 
 void EncryptionApp::transferFiles(const std::string& source_path, const std::string& dest_path, bool encrypting) {
 
-    display.clearScreen(COLOR_BLACK);
-    display.drawRect(5, 5, display.getWidth() - 10, display.getHeight() - 10, COLOR_GREEN);
-    std::string operation = encrypting ? "ЗАШИФРОВАНИЕ" : "РАСШИФРОВАНИЕ";
-    drawCurrentFile(operation, -1, 15, COLOR_GREEN);
-    display.drawLine(10, 30, display.getWidth() - 10, 30, COLOR_GREEN);
+    ProgressScreen& progress = *progress_screen;
+    progress.operation.setText(encrypting ? "ЗАШИФРОВАНИЕ" : "РАСШИФРОВАНИЕ");
+    for (ui::Label* label : {&progress.counter, &progress.file_name, &progress.eta}) {
+        label->setText("");
+        label->setColor(COLOR_GREEN);
+    }
+    progress.bar.setProgress(0, 1);
+    stage.show(progress.screen);
     
     // Проверяем существование директорий
     if (!std::filesystem::exists(source_path)) {
@@ -1464,98 +1066,305 @@ void EncryptionApp::transferFiles(const std::string& source_path, const std::str
         throw std::runtime_error("Нет прав на запись");
     }
     
-    size_t total_files = 0;
-    for (const auto& file : file_list) if (file.selected) total_files++;
-    size_t processed_files = 0;
-    
+    // Размер порции и глубина конвейера, подобранные для этих носителей в прошлый раз
+    std::string source_uuid = device_profile::filesystemUuid(source_path);
+    std::string dest_uuid = device_profile::filesystemUuid(dest_path);
+    device_profile::Profile source_profile;
+    device_profile::Profile dest_profile;
+    device_profile::load(source_uuid, source_profile);
+    device_profile::load(dest_uuid, dest_profile);
+    device_profile::Tuner tuner(source_profile, dest_profile);
+    file_engine::Options options;
+    options.tuner = &tuner;
+    // Один sync() на весь пакет вместо sync() после каждого файла
+    options.sync_each_file = false;
+    // Документы и журналы сжимаются в разы, а запись на флешку — самое медленное звено
+    options.compress = compress_files;
+    // Записанное на флешку перечитывается в фоне и при сбое переписывается
+    options.verify = verify_writes;
+    
+    const file_engine::Key key = file_engine::expandKey(encryptionKey);
+    
+    // Файлы, не изменившиеся с прошлого шифрования на этот носитель, пропускаем
+    manifest::Manifest change_manifest(dest_path, key);
+    std::set<std::string> skipped_paths;
+    std::set<std::string> stale_archives;
+    if (encrypting) {
+        for (const auto& file : file_list) {
+            if (!file.selected) continue;
+            manifest::Entry previous;
+            if (change_manifest.isUnchanged(file.name, file.full_path)) {
+                skipped_paths.insert(file.full_path);
+            } else if (change_manifest.find(file.name, previous) &&
+                       archive::isArchive(dest_path + "/" + previous.output)) {
+                stale_archives.insert(previous.output);
+            }
+        }
+        // Архив с измененным файлом заменяется целиком, поэтому остальные
+        // его файлы упаковываются заново
+        for (const auto& file : file_list) {
+            manifest::Entry previous;
+            if (skipped_paths.count(file.full_path) && change_manifest.find(file.name, previous) &&
+                stale_archives.count(previous.output)) {
+                skipped_paths.erase(file.full_path);
+            }
+        }
+    }
     
+    // Мелкие файлы большого пакета упаковываем в один архив, если это включено
+    std::vector<archive::Entry> archive_entries;
+    std::set<std::string> archived_paths;
+    uint64_t archive_bytes = 0;
+    if (encrypting && pack_small_files) {
+        for (const auto& file : file_list) {
+            std::error_code ec;
+            uint64_t file_size = std::filesystem::file_size(file.full_path, ec);
+            if (file.selected && !skipped_paths.count(file.full_path) && !ec &&
+                file_size < transfer_scheduler::SMALL_FILE_LIMIT) {
+                archive_entries.push_back({file.full_path, file.name});
+                archive_bytes += file_size;
+            }
+        }
+        if (archive_entries.size() < archive::MIN_FILES) {
+            archive_entries.clear();
+        }
+        for (const auto& entry : archive_entries) {
+            archived_paths.insert(entry.source);
+        }
+    }
+    std::string archive_file;
+    
+    // Журнал прерванного пакета: обработанные файлы пропускаем, начатые дописываем
+    checkpoint::Journal journal(dest_path, key);
+    
+    // Формируем задания
+    std::vector<transfer_scheduler::Job> jobs;
+    uint64_t allocated_bytes = 0;
+    if (!archive_entries.empty()) {
+        char stamp[32];
+        time_t now = time(nullptr);
+        strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+        std::string archive_name = std::string("archive_") + stamp + ".enc";
+        archive_file = dest_path + "/" + archive_name;
+        jobs.push_back({"", archive_file, archive_name, archive_bytes, archive::archiveSize(archive_entries)});
+    }
     for (const auto& file : file_list) {
         if (!file.selected) continue;
+        if (archived_paths.count(file.full_path) || skipped_paths.count(file.full_path)) continue;
         
-        try {
-
-            std::string dest_file;
+        std::string dest_file;
+        if (encrypting) {
+            dest_file = dest_path + "/" + file.name + ".enc";
+        } else {
+            std::string filename = file.name;
+            if (filename.length() > 4 && filename.substr(filename.length() - 4) == ".enc") {
+                filename = filename.substr(0, filename.length() - 4);
+            }
+            dest_file = dest_path + "/" + filename;
+        }
+        
+        std::string output = std::filesystem::path(dest_file).filename().string();
+        if (journal.isFinished(output, file.full_path)) {
+            // Файл не изменился с момента обработки, запись в манифесте восстанавливаем
             if (encrypting) {
-                dest_file = dest_path + "/" + file.name + ".enc";
-            } else {
-                std::string filename = file.name;
-                if (filename.length() > 4 && filename.substr(filename.length() - 4) == ".enc") {
-                    filename = filename.substr(0, filename.length() - 4);
-                }
-                dest_file = dest_path + "/" + filename;
+                change_manifest.record(manifest::describe(file.name, file.full_path, output));
             }
-            
-            
-            // Удаляем существующий файл, если он есть
-            if (std::filesystem::exists(dest_file)) {
-                std::filesystem::remove(dest_file);
+            continue;
+        }
+        
+        // Ход расшифрования считается по открытым данным, их размер известен из заголовка
+        std::error_code ec;
+        uint64_t file_size = encrypting ? std::filesystem::file_size(file.full_path, ec) : file.plain_size;
+        if (ec) {
+            file_size = 0;
+        }
+        uint64_t output_size = encrypting ? file_engine::maxEncryptedSize(file_size, options) : file_size;
+        jobs.push_back({file.full_path, dest_file, file.name, file_size, output_size});
+        
+        // Недописанный файл продолжаемого задания уже занимает место на носителе:
+        // шифрование дописывает временный файл, расшифрование — сам результат
+        file_engine::Checkpoint resume_point;
+        if (journal.find(output, file.full_path, resume_point)) {
+            uint64_t allocated = transfer_plan::allocatedSpace(encrypting ? dest_file + ".tmp" : dest_file);
+            allocated_bytes += std::min(allocated, output_size);
+        }
+    }
+    
+    // До начала работы проверяем, что результат поместится на носитель
+    transfer_plan::Plan plan = transfer_plan::make(std::move(jobs), dest_path, source_profile, dest_profile,
+                                                   allocated_bytes);
+    if (!plan.fits()) {
+        uint64_t shortage_mb = (plan.shortage() + 1024 * 1024 - 1) / (1024 * 1024);
+        stage.showMessage({"МАЛО МЕСТА", "НУЖНО ЕЩЕ " + std::to_string(shortage_mb) + " МБ"}, COLOR_RED);
+        std::this_thread::sleep_for(std::chrono::seconds(3));
+        throw std::runtime_error("Недостаточно места на носителе назначения");
+    }
+    
+    auto process = [&](const transfer_scheduler::Job& job, const file_engine::Options& job_options) {
+        if (!archive_file.empty() && job.dest == archive_file) {
+            std::vector<manifest::Entry> described;
+            for (const auto& entry : archive_entries) {
+                described.push_back(manifest::describe(entry.name, entry.source, job.name));
             }
-            
-            display.fillRect(10, 40, display.getWidth() - 20, 50, COLOR_BLACK);
-            std::string progress = "Файл " + std::to_string(processed_files + 1) + "/" + std::to_string(total_files);
-            drawCurrentFile(progress, -1, 45, COLOR_GREEN);
-            
-            std::string current_file = file.name;
-            if (current_file.length() > 15) current_file = current_file.substr(0, 12) + "...";
-            drawCurrentFile(current_file, -1, 65, COLOR_GREEN);
-            
-            int bar_x = 20, bar_y = 90, bar_w = display.getWidth() - 40, bar_h = 10;
-            display.drawRect(bar_x, bar_y, bar_w, bar_h, COLOR_GREEN);
-            int filled = (int)((processed_files + 1) * bar_w / total_files);
-            display.fillRect(bar_x + 1, bar_y + 1, filled - 2, bar_h - 2, COLOR_GREEN);
-            
-            // Проверяем размер исходного файла
-            std::filesystem::path src_path(file.full_path);
-            if (!std::filesystem::exists(src_path)) {
-                throw std::runtime_error("Исходный файл не найден: " + file.full_path);
+            archive::create(archive_file, archive_entries, key, job_options);
+            for (const auto& entry : described) {
+                change_manifest.record(entry);
             }
-            auto file_size = std::filesystem::file_size(src_path);
-            
-            if (encrypting) {
-                encryptFile(file.full_path, dest_file);
-            } else {
-                decryptFile(file.full_path, dest_file);
+            return;
+        }
+        
+        if (!std::filesystem::exists(job.source)) {
+            throw std::runtime_error("Исходный файл не найден: " + job.source);
+        }
+        
+        if (!encrypting && archive::isArchive(job.source)) {
+            // Архив распаковывается в каталог назначения целиком
+            archive::extractAll(job.source, dest_path, key, job_options);
+            return;
+        }
+        
+        // Продолжаем с контрольной точки прерванного пакета, если она есть
+        std::string output = std::filesystem::path(job.dest).filename().string();
+        file_engine::Checkpoint resume_point;
+        file_engine::Options file_options = job_options;
+        if (journal.find(output, job.source, resume_point)) {
+            file_options.resume = &resume_point;
+        }
+        file_options.on_checkpoint = [&](const file_engine::Checkpoint& point) {
+            try {
+                journal.update(output, job.source, point);
+            } catch (const std::exception& e) {
+                // Без журнала файл просто не продолжится после сбоя
+                std::cerr << "Не удалось сохранить контрольную точку: " << e.what() << std::endl;
             }
-            
-            if (!std::filesystem::exists(dest_file)) {
-                throw std::runtime_error("Файл не был создан: " + dest_file);
+        };
+        
+        // Удаляем существующий файл, если он есть (частично расшифрованный
+        // файл с контрольной точкой дописывается)
+        if (std::filesystem::exists(job.dest) && !(file_options.resume && !encrypting)) {
+            std::filesystem::remove(job.dest);
+        }
+        
+        if (encrypting) {
+            // Состояние исходного файла запоминаем до шифрования: если он
+            // изменится во время работы, в следующий раз будет зашифрован заново
+            auto entry = manifest::describe(job.name, job.source, output);
+            file_engine::encryptFile(job.source, job.dest, key, file_options);
+            change_manifest.record(entry);
+        } else {
+            file_engine::decryptFile(job.source, job.dest, key, file_options);
+        }
+        
+        if (!std::filesystem::exists(job.dest)) {
+            throw std::runtime_error("Файл не был создан: " + job.dest);
+        }
+        journal.finished(output, job.source);
+    };
+    
+    // Виджеты экрана перерисовываются только при изменении
+    transfer_plan::RateMeter rate;
+    auto started = std::chrono::steady_clock::now();
+    auto draw_progress = [&](const transfer_scheduler::Progress& p) {
+        RenderProfiler::Screen screen(display.profiler(), "transferFiles/progress");
+        size_t current = std::min(p.files_done + 1, p.files_total);
+        progress.counter.setText("Файл " + std::to_string(current) + "/" + std::to_string(p.files_total));
+        progress.file_name.setText(p.current_file);
+        if (p.bytes_total > 0) {
+            progress.bar.setProgress(p.bytes_done, p.bytes_total);
+        } else {
+            progress.bar.setProgress(p.files_done, std::max<size_t>(1, p.files_total));
+        }
+        
+        // Текущая скорость и оставшееся время: сначала по профилям носителей,
+        // затем по измеренной скорости
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        rate.add(elapsed, p.bytes_done);
+        double remaining = transfer_plan::remainingSeconds(plan, p, elapsed);
+        double bytes_per_second = rate.bytesPerSecond();
+        std::string eta;
+        if (remaining >= 0 && bytes_per_second >= 0) {
+            eta = transfer_plan::formatRate(bytes_per_second) + "  " + transfer_plan::formatDuration(remaining);
+        } else if (remaining >= 0) {
+            eta = "ОСТАЛОСЬ " + transfer_plan::formatDuration(remaining);
+        }
+        progress.eta.setText(eta);
+        stage.show(progress.screen);
+    };
+    
+    transfer_scheduler::Scheduler scheduler(std::move(plan.jobs),
+                                            transfer_scheduler::workerCount(tuner.pipelineDepth()));
+    scheduler.run(process, options, draw_progress, std::chrono::milliseconds(PROGRESS_REFRESH_MS));
+    
+    if (encrypting) {
+        // Старые архивы, все файлы которых упакованы заново, больше не нужны
+        for (const auto& stale : stale_archives) {
+            if (!change_manifest.references(stale)) {
+                std::error_code ec;
+                std::filesystem::remove(dest_path + "/" + stale, ec);
             }
-            auto new_size = std::filesystem::file_size(dest_file);
-            
-            processed_files++;
-            
+        }
+        try {
+            change_manifest.save();
         } catch (const std::exception& e) {
-            display.fillRect(10, 40, display.getWidth() - 20, 50, COLOR_BLACK);
-            drawCurrentFile("ОШИБКА:", -1, 45, COLOR_RED);
-            std::string error_msg = e.what();
-            if (error_msg.length() > 20) error_msg = error_msg.substr(0, 17) + "...";
-            drawCurrentFile(error_msg, -1, 65, COLOR_RED);
-            std::this_thread::sleep_for(std::chrono::seconds(2));
+            std::cerr << "Не удалось сохранить манифест: " << e.what() << std::endl;
         }
     }
     
+    // Принудительно сбрасываем буферы файловой системы
+    sync();
+    
+    auto errors = scheduler.errors();
+    // Журнал нужен только для продолжения незавершенного пакета
+    try {
+        if (errors.empty()) {
+            journal.remove();
+        } else {
+            journal.save();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Не удалось сохранить журнал контрольных точек: " << e.what() << std::endl;
+    }
+    if (!errors.empty()) {
+        progress.counter.setText("ОШИБОК: " + std::to_string(errors.size()));
+        progress.file_name.setText(errors.front());
+        progress.counter.setColor(COLOR_RED);
+        progress.file_name.setColor(COLOR_RED);
+        stage.show(progress.screen);
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+    }
+    
+    // Сохраняем измеренные параметры носителей до следующего подключения
+    device_profile::Profile measured_dest = tuner.destProfile();
+    if (source_uuid == dest_uuid) {
+        measured_dest.read_bandwidth = tuner.sourceProfile().read_bandwidth;
+    } else {
+        device_profile::save(source_uuid, tuner.sourceProfile());
+    }
+    device_profile::save(dest_uuid, measured_dest);
     
     // Показываем сообщение о завершении
-    display.clearScreen(COLOR_BLACK);
-    drawCurrentFile("ЗАВЕРШЕНО", -1, display.getHeight() / 2 - 10, COLOR_GREEN);
+    std::vector<std::string> summary = {"ЗАВЕРШЕНО"};
+    if (!skipped_paths.empty()) {
+        summary.push_back("БЕЗ ИЗМЕНЕНИЙ: " + std::to_string(skipped_paths.size()));
+    }
+    stage.showMessage(summary, COLOR_GREEN);
     std::this_thread::sleep_for(std::chrono::seconds(2));
     
     // Сбрасываем состояние и возвращаемся в главное меню
     waiting_for_key = false;
     file_list.clear();
     current_file_index = 0;
-    current_page = 0;
     
-    // Принудительно очищаем экран и перерисовываем меню
-    display.clearScreen(COLOR_BLACK);
-    std::this_thread::sleep_for(std::chrono::milliseconds(100)); 
     drawMenu();
 }
 
 
 void EncryptionApp::showUsbWaitScreen(const std::string& message) {
+    RenderProfiler::Screen screen(display.profiler(), "showUsbWaitScreen");
+    stage.release();
     display.clearScreen(COLOR_BLACK);
     display.drawRect(5, 5, display.getWidth() - 10, display.getHeight() - 10, COLOR_GREEN);
     drawCurrentFile(message, -1, display.getHeight() / 2 - 10, COLOR_GREEN);
+    display.flush();
 }
 
@@ -0,0 +1,1475 @@
+#include "file_engine.h"
+#include "file_io.h"
+#include "cmac.h"
+#include "kuznechik.h"
+#include "file_format.h"
+#include "compression.h"
+#include "byte_order.h"
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <optional>
+#include <unistd.h>
+
+namespace file_engine {
+
+namespace {
+
+// Текущий размер порции и глубина конвейера
+size_t pipelineDepth(const Options& options) {
+    return options.tuner ? options.tuner->pipelineDepth() : device_profile::DEFAULT_PIPELINE_DEPTH;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+uint64_t maxEncryptedSize(uint64_t plain_size, const Options& options) {
+    uint64_t size = encryptedSize(plain_size);
+    if (options.compress && compression::available() && plain_size >= compression::MIN_FILE_SIZE) {
+        uint64_t frames = (plain_size + compression::FRAME_SIZE - 1) / compression::FRAME_SIZE;
+        size = std::max<uint64_t>(size, file_format::HEADER_SIZE + plain_size +
+                                        frames * compression::FRAME_HEADER_SIZE + MAC_SIZE);
+    }
+    return size;
+}
+
+size_t chunkSize(const Options& options) {
+    return options.tuner ? options.tuner->chunkSize() : device_profile::DEFAULT_CHUNK_SIZE;
+}
+
+bool useDirectIo(const Options& options, uint64_t output_size) {
+    switch (options.direct_io) {
+        case DirectIo::ALWAYS: return true;
+        case DirectIo::NEVER:  return false;
+        case DirectIo::AUTO:   break;
+    }
+    return output_size >= DIRECT_IO_THRESHOLD;
+}
+
+ChunkWriter::ChunkWriter(int fd, const Options& options)
+    : fd(fd), stream(!file_io::isSeekable(fd)), direct(!stream && file_io::isDirect(fd)), position(0),
+      write_behind(fd, pipelineDepth(options)), tuner(options.tuner) {
+    // Из канала прочитать записанное нельзя
+    if (options.verify && !stream) {
+        verifier = std::make_unique<file_io::ReadBackVerifier>(fd, pipelineDepth(options));
+    }
+}
+
+void ChunkWriter::write(const uint8_t* data, size_t length, uint64_t offset) {
+    auto started = std::chrono::steady_clock::now();
+    if (stream) {
+        fillStream(offset);
+        file_io::writeStream(fd, data, length);
+        position += length;
+        if (tuner) {
+            tuner->recordWrite(length, secondsSince(started));
+        }
+        return;
+    }
+    size_t aligned = 0;
+    if (direct) {
+        // Невыровненное начало (например, участок разреженного файла
+        // в середине порции) переводит файл в обычный режим
+        bool aligned_start = offset % file_io::DIRECT_IO_ALIGNMENT == 0 &&
+            reinterpret_cast<uintptr_t>(data) % file_io::DIRECT_IO_ALIGNMENT == 0;
+        aligned = aligned_start ? length / file_io::DIRECT_IO_ALIGNMENT * file_io::DIRECT_IO_ALIGNMENT : 0;
+        if (aligned > 0) {
+            file_io::writeAt(fd, data, aligned, offset);
+        }
+        if (aligned < length) {
+            file_io::setDirect(fd, false);
+            direct = false;
+        }
+    }
+    if (aligned < length) {
+        file_io::writeAt(fd, data + aligned, length - aligned, offset + aligned);
+        write_behind.written(offset + aligned, length - aligned);
+    }
+    if (tuner) {
+        tuner->recordWrite(length, secondsSince(started));
+        write_behind.setDepth(tuner->pipelineDepth());
+    }
+    if (verifier) {
+        verifier->submit(data, length, offset);
+    }
+}
+
+void ChunkWriter::fillTo(uint64_t size) {
+    if (stream) {
+        fillStream(size);
+    } else if (file_io::fileSize(fd) < size) {
+        file_io::truncate(fd, size);
+    }
+}
+
+void ChunkWriter::fillStream(uint64_t offset) {
+    if (offset < position) {
+        throw std::runtime_error("Непоследовательная запись в поток");
+    }
+    static const uint8_t zeros[64 * 1024] = {};
+    while (position < offset) {
+        size_t part = std::min<uint64_t>(sizeof(zeros), offset - position);
+        file_io::writeStream(fd, zeros, part);
+        position += part;
+    }
+}
+
+void ChunkWriter::sync() {
+    if (stream) {
+        return;
+    }
+    if (verifier) {
+        verifier->finish();
+    }
+    file_io::syncData(fd);
+}
+
+void ChunkWriter::finish() {
+    if (!stream) {
+        write_behind.finish();
+    }
+    if (verifier) {
+        verifier->finish();
+    }
+}
+
+void readChunk(int fd, uint8_t* buffer, size_t length, uint64_t offset, const Options& options) {
+    auto started = std::chrono::steady_clock::now();
+    size_t bytes_read = file_io::readAt(fd, buffer, length, offset);
+    if (bytes_read != length) {
+        throw std::runtime_error("Файл изменился во время чтения");
+    }
+    if (options.tuner) {
+        options.tuner->recordRead(length, secondsSince(started));
+    }
+    file_io::readAhead(fd, offset + length, chunkSize(options));
+}
+
+void publishFile(const std::string& temp_file, const std::string& dest_file) {
+    // Перемещаем временный файл в целевой
+    try {
+        std::filesystem::rename(temp_file, dest_file);
+    } catch (const std::filesystem::filesystem_error& e) {
+        try {
+            std::filesystem::copy_file(temp_file, dest_file,
+                                     std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::remove(temp_file);
+        } catch (const std::filesystem::filesystem_error& e2) {
+            throw std::runtime_error("Не удалось создать конечный файл: " +
+                                   std::string(e2.what()));
+        }
+    }
+
+    // Финальная проверка
+    if (!std::filesystem::exists(dest_file)) {
+        throw std::runtime_error("Файл не создан после всех операций");
+    }
+}
+
+Key expandKey(const std::string& key) {
+    Key result;
+    std::memset(&result, 0, sizeof(result));
+
+    // Мастер-ключ (32 байта): первые 16 байт строки, повторенные дважды
+    std::memcpy(result.master, key.c_str(), std::min<size_t>(key.length(), 16));
+    std::memcpy(result.master + 16, key.c_str(), std::min<size_t>(key.length(), 16));
+
+    if (kuznechik_expkey(result.master, result.round) != 0) {
+        throw std::runtime_error("Ошибка развертывания ключа");
+    }
+    return result;
+}
+
+std::vector<uint8_t> encryptBuffer(const std::vector<uint8_t>& plain, const Key& key) {
+    auto iv = counter_mode::generate_iv();
+    std::vector<uint8_t> result(encryptedSize(plain.size()));
+    std::memcpy(result.data(), iv.data(), counter_mode::IV_SIZE);
+    std::copy(plain.begin(), plain.end(), result.begin() + counter_mode::IV_SIZE);
+
+    cmac::Context mac_ctx(key.round);
+    mac_ctx.update(plain.data(), plain.size());
+    auto mac = mac_ctx.finalize();
+
+    counter_mode::Counter ctr;
+    ctr.setValue(iv.data());
+    counter_mode::apply_ctr(result.data() + counter_mode::IV_SIZE, plain.size(), ctr, key.round);
+    std::memcpy(result.data() + counter_mode::IV_SIZE + plain.size(), mac.data(), MAC_SIZE);
+    return result;
+}
+
+bool decryptBuffer(const std::vector<uint8_t>& encrypted, const Key& key, std::vector<uint8_t>& plain) {
+    if (encrypted.size() < counter_mode::IV_SIZE + MAC_SIZE) {
+        return false;
+    }
+    plain.assign(encrypted.begin() + counter_mode::IV_SIZE, encrypted.end() - MAC_SIZE);
+
+    counter_mode::Counter ctr;
+    ctr.setValue(encrypted.data());
+    counter_mode::apply_ctr(plain.data(), plain.size(), ctr, key.round);
+
+    cmac::Context mac_ctx(key.round);
+    mac_ctx.update(plain.data(), plain.size());
+    auto mac = mac_ctx.finalize();
+    if (!std::equal(mac.begin(), mac.end(), encrypted.end() - MAC_SIZE)) {
+        plain.clear();
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+// Можно ли продолжить запись в path с контрольной точки options.resume.
+// Точка должна быть сделана для того же формата (flags)
+bool canResume(const Options& options, const std::string& path, uint64_t input_size, uint32_t flags) {
+    if (!options.resume || options.resume->flags != flags || options.resume->input_offset > input_size) {
+        return false;
+    }
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    return !ec && size >= options.resume->output_offset;
+}
+
+// Контрольная точка после записанной порции. Точка не должна опережать
+// носитель, поэтому сначала сбрасываем данные
+void reportCheckpoint(ChunkWriter& writer, uint64_t input_offset, uint64_t output_offset,
+                      const counter_mode::Counter& ctr, const cmac::Context& mac_ctx, const Options& options,
+                      uint32_t flags = 0, uint64_t frame_offset = 0) {
+    writer.sync();
+    Checkpoint point;
+    point.input_offset = input_offset;
+    point.output_offset = output_offset;
+    std::memcpy(point.counter, ctr.value, sizeof(point.counter));
+    mac_ctx.saveState(point.mac_state);
+    point.flags = flags;
+    point.frame_offset = frame_offset;
+    options.on_checkpoint(point);
+}
+
+// Счетчик для блока гаммы с номером block от синхропосылки iv
+counter_mode::Counter counterAt(const uint8_t* iv, uint64_t block) {
+    counter_mode::Counter ctr;
+    ctr.setValue(iv);
+    unsigned carry = 0;
+    for (int i = counter_mode::BLOCK_SIZE - 1; i >= 0; i--) {
+        unsigned sum = ctr.value[i] + static_cast<unsigned>(block & 0xFF) + carry;
+        ctr.value[i] = static_cast<uint8_t>(sum);
+        carry = sum >> 8;
+        block >>= 8;
+    }
+    return ctr;
+}
+
+// Вывод потока нового формата: открытые данные копируются в буфер порции,
+// имитовставка считается по ним, а гамма накладывается при записи порции.
+// Первые encrypt_from байт (заголовок) пишутся открытыми
+class CtrOutput {
+public:
+    CtrOutput(int fd, const Options& options, const Key& key, const uint8_t* iv, uint64_t encrypt_from,
+              uint32_t flags = 0)
+        : writer(fd, options), options(options), key(key), mac_ctx(key.round),
+          encrypt_from(encrypt_from), chunk(chunkSize(options)),
+          buffer(file_io::BufferPool::instance().acquire(chunk + MAC_SIZE)),
+          fill(0), out_offset(0), in_frame(false), has_point(false) {
+        ctr.setValue(iv);
+        point.flags = flags;
+    }
+
+    // Продолжение с контрольной точки: запись идет с output_offset
+    void restore(const Checkpoint& resume) {
+        if (!mac_ctx.restoreState(resume.mac_state)) {
+            throw std::runtime_error("Некорректная контрольная точка");
+        }
+        ctr.setValue(resume.counter);
+        out_offset = resume.output_offset;
+        fill = 0;
+    }
+
+    // Начало кадра с данными исходного файла со смещения input_offset.
+    // skipped — сколько начальных байт кадра уже записано до сбоя
+    void beginFrame(uint64_t input_offset, size_t skipped = 0) {
+        frame_input = input_offset;
+        frame_output = out_offset + fill - skipped;
+        in_frame = true;
+    }
+
+    // Контрольная точка на последней записанной порции, если с прошлой
+    // точки порции записывались. false — сообщать нечего
+    bool checkpoint() {
+        if (!has_point) {
+            return false;
+        }
+        writer.sync();
+        options.on_checkpoint(point);
+        has_point = false;
+        return true;
+    }
+
+    void append(const uint8_t* data, size_t length) {
+        // Имитовставка считается по частям, чтобы на границе порции ее
+        // состояние можно было сохранить в контрольной точке
+        while (length > 0) {
+            size_t part = std::min(length, chunk - fill);
+            mac_ctx.update(data, part);
+            std::memcpy(buffer.data() + fill, data, part);
+            fill += part;
+            data += part;
+            length -= part;
+            if (fill == chunk) {
+                flush();
+            }
+        }
+    }
+
+    // Запись остатка с имитовставкой. Возвращает итоговый размер файла
+    uint64_t finish() {
+        encrypt();
+        auto mac = mac_ctx.finalize();
+        std::memcpy(buffer.data() + fill, mac.data(), MAC_SIZE);
+        writer.write(buffer.data(), fill + MAC_SIZE, out_offset);
+        writer.finish();
+        return out_offset + fill + MAC_SIZE;
+    }
+
+private:
+    // Гаммирование буфера, кроме попавшей в него части заголовка. Все порции,
+    // кроме последней, и заголовок кратны блоку шифра
+    void encrypt() {
+        size_t start = out_offset < encrypt_from ? std::min<uint64_t>(encrypt_from - out_offset, fill) : 0;
+        counter_mode::apply_ctr(buffer.data() + start, fill - start, ctr, key.round);
+    }
+
+    void flush() {
+        encrypt();
+        writer.write(buffer.data(), fill, out_offset);
+        out_offset += fill;
+        fill = 0;
+
+        // Состояние на границе порции: с нее продолжится запись после сбоя
+        if (in_frame && options.on_checkpoint) {
+            point.input_offset = frame_input;
+            point.output_offset = out_offset;
+            point.frame_offset = frame_output;
+            std::memcpy(point.counter, ctr.value, sizeof(point.counter));
+            mac_ctx.saveState(point.mac_state);
+            has_point = true;
+        }
+
+        // После замеров размер следующей порции может измениться
+        chunk = chunkSize(options);
+        if (buffer.size() < chunk + MAC_SIZE) {
+            buffer = file_io::BufferPool::instance().acquire(chunk + MAC_SIZE);
+        }
+    }
+
+    ChunkWriter writer;
+    const Options& options;
+    const Key& key;
+    cmac::Context mac_ctx;
+    counter_mode::Counter ctr;
+    uint64_t encrypt_from;
+    size_t chunk;
+    file_io::BufferPool::Lease buffer;
+    size_t fill;
+    uint64_t out_offset;
+    bool in_frame;
+    uint64_t frame_input = 0;
+    uint64_t frame_output = 0;
+    Checkpoint point;
+    bool has_point;
+};
+
+// Последовательное чтение логического потока данных — участков
+// с данными подряд, без дыр между ними
+class ExtentReader {
+public:
+    ExtentReader(int fd, const std::vector<file_io::Extent>& extents, const Options& options)
+        : fd(fd), extents(extents), options(options), index(0), position(0) {}
+
+    // Чтение length байт потока (меньше только в конце)
+    size_t read(uint8_t* buffer, size_t length) {
+        size_t done = 0;
+        while (done < length && index < extents.size()) {
+            const file_io::Extent& extent = extents[index];
+            size_t part = std::min<uint64_t>(length - done, extent.length - position);
+            readChunk(fd, buffer + done, part, extent.offset + position, options);
+            file_io::dropCache(fd, extent.offset + position, part);
+            done += part;
+            position += part;
+            if (position == extent.length) {
+                index++;
+                position = 0;
+                reportHole();
+            }
+        }
+        return done;
+    }
+
+    // Дыра перед первым участком тоже учитывается в ходе выполнения
+    void start() {
+        reportHole();
+    }
+
+    // Переход к смещению data_offset в потоке данных. Возвращает смещение
+    // в файле: сколько его вместе с дырами уже пройдено
+    uint64_t seek(uint64_t data_offset) {
+        index = 0;
+        while (index < extents.size() && data_offset >= extents[index].length) {
+            data_offset -= extents[index].length;
+            index++;
+        }
+        if (index == extents.size()) {
+            throw std::runtime_error("Некорректная контрольная точка");
+        }
+        position = data_offset;
+        return extents[index].offset + position;
+    }
+
+private:
+    void reportHole() {
+        uint64_t prev_end = index == 0 ? 0 : extents[index - 1].offset + extents[index - 1].length;
+        uint64_t next = index < extents.size() ? extents[index].offset : prev_end;
+        if (next > prev_end && options.progress) {
+            options.progress(next - prev_end);
+        }
+    }
+
+    int fd;
+    const std::vector<file_io::Extent>& extents;
+    const Options& options;
+    size_t index;
+    uint64_t position;
+};
+
+uint64_t dataBytes(const std::vector<file_io::Extent>& extents) {
+    uint64_t total = 0;
+    for (const auto& extent : extents) {
+        total += extent.length;
+    }
+    return total;
+}
+
+// Заголовок недописанного временного файла: продолжать можно, только если
+// он совпадает с header по флагам и размеру. Синхропосылка берется из файла
+bool readResumeHeader(const std::string& path, file_format::Header& header) {
+    uint8_t raw[file_format::HEADER_SIZE];
+    file_format::Header written;
+    try {
+        file_io::FileDescriptor fd = file_io::openForRead(path);
+        if (file_io::readAt(fd.get(), raw, sizeof(raw), 0) != sizeof(raw) ||
+            !file_format::decodeHeader(raw, written)) {
+            return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (written.flags != header.flags || written.plain_size != header.plain_size) {
+        return false;
+    }
+    std::memcpy(header.iv, written.iv, sizeof(header.iv));
+    return true;
+}
+
+// Шифрование в формате с заголовком: карта участков (для разреженных файлов),
+// затем данные участков подряд, при сжатии — кадрами
+void encryptWithHeader(int in_fd, uint64_t file_size, const std::vector<file_io::Extent>& extents,
+                       uint32_t flags, const std::string& dest_file, const Key& key, const Options& options) {
+    file_format::Header header;
+    header.flags = flags;
+    header.plain_size = file_size;
+    auto iv = counter_mode::generate_iv();
+    std::memcpy(header.iv, iv.data(), counter_mode::IV_SIZE);
+
+    bool sparse = (flags & file_format::FLAG_SPARSE) != 0;
+    bool compressed = (flags & file_format::FLAG_COMPRESSED) != 0;
+    uint64_t data_bytes = dataBytes(extents);
+    std::vector<uint8_t> extent_map;
+    if (sparse) {
+        byte_order::appendLe(extent_map, extents.size(), 4);
+        for (const auto& extent : extents) {
+            byte_order::appendLe(extent_map, extent.offset, 8);
+            byte_order::appendLe(extent_map, extent.length, 8);
+        }
+    }
+
+    // При сжатии размер результата заранее неизвестен: резервируем худший
+    // случай (все кадры несжимаемы) и отрезаем лишнее в конце
+    uint64_t frames = (data_bytes + compression::FRAME_SIZE - 1) / compression::FRAME_SIZE;
+    uint64_t max_size = file_format::HEADER_SIZE + extent_map.size() + data_bytes +
+                        (compressed ? frames * compression::FRAME_HEADER_SIZE : 0) + MAC_SIZE;
+
+    // Временный файл после сбоя дописывается с контрольной точки, если он
+    // начат с тем же заголовком; синхропосылка берется из него
+    std::string temp_file = dest_file + ".tmp";
+    const Checkpoint* resume = options.resume;
+    bool resuming = canResume(options, temp_file, data_bytes, flags) &&
+                    resume->frame_offset >= file_format::HEADER_SIZE + extent_map.size() &&
+                    resume->frame_offset <= resume->output_offset &&
+                    readResumeHeader(temp_file, header);
+    file_io::FileDescriptor out;
+    try {
+        bool direct = useDirectIo(options, max_size);
+        out = resuming ? file_io::openForResume(temp_file, direct) : file_io::openForWrite(temp_file, direct);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось создать временный файл: " + temp_file);
+    }
+    file_io::preallocate(out.get(), max_size);
+
+    uint64_t total_size;
+    bool checkpointed = resuming;
+    try {
+        CtrOutput stream(out.get(), options, key, header.iv, file_format::HEADER_SIZE, flags);
+        ExtentReader reader(in_fd, extents, options);
+        uint64_t done = 0;
+        size_t skip = 0;
+        if (resuming) {
+            // Кадр, на который пришлась точка, читается и сжимается заново,
+            // уже записанная его часть пропускается
+            stream.restore(*resume);
+            done = resume->input_offset;
+            skip = resume->output_offset - resume->frame_offset;
+            uint64_t position = reader.seek(done);
+            if (options.progress) {
+                options.progress(position);
+            }
+        } else {
+            uint8_t raw_header[file_format::HEADER_SIZE];
+            file_format::encodeHeader(header, raw_header);
+            stream.append(raw_header, sizeof(raw_header));
+            stream.append(extent_map.data(), extent_map.size());
+            reader.start();
+        }
+
+        size_t portion = compressed ? compression::FRAME_SIZE : chunkSize(options);
+        auto input = file_io::BufferPool::instance().acquire(portion);
+        std::vector<uint8_t> frame(compressed ? compression::frameBound() : 0);
+        uint64_t checkpoint_at = done + CHECKPOINT_INTERVAL;
+        while (done < data_bytes) {
+            size_t length = reader.read(input.data(), std::min<uint64_t>(portion, data_bytes - done));
+            if (length == 0) {
+                throw std::runtime_error("Файл изменился во время чтения");
+            }
+            const uint8_t* data = input.data();
+            size_t data_length = length;
+            if (compressed) {
+                data = frame.data();
+                data_length = compression::compressFrame(input.data(), length, frame.data());
+            }
+            if (skip > data_length) {
+                throw std::runtime_error("Некорректная контрольная точка");
+            }
+            stream.beginFrame(done, skip);
+            stream.append(data + skip, data_length - skip);
+            skip = 0;
+            done += length;
+            if (options.progress) {
+                options.progress(length);
+            }
+            if (options.on_checkpoint && done >= checkpoint_at && done < data_bytes && stream.checkpoint()) {
+                checkpoint_at = done + CHECKPOINT_INTERVAL;
+                checkpointed = true;
+            }
+        }
+        total_size = stream.finish();
+
+        // Возвращаем O_DIRECT-дескриптору обычный режим, иначе ftruncate
+        // по невыровненной длине может не пройти на некоторых ФС
+        file_io::setDirect(out.get(), false);
+        file_io::truncate(out.get(), total_size);
+    } catch (const std::exception&) {
+        out.close();
+        // С контрольной точки файл можно будет дописать
+        if (!checkpointed) {
+            std::filesystem::remove(temp_file);
+        }
+        throw;
+    }
+    out.close();
+
+    if (std::filesystem::file_size(temp_file) != total_size) {
+        std::filesystem::remove(temp_file);
+        throw std::runtime_error("Некорректный размер зашифрованного файла");
+    }
+    publishFile(temp_file, dest_file);
+
+    if (options.sync_each_file) {
+        sync();
+    }
+}
+
+// Разбор расшифрованного потока формата с заголовком: карта участков,
+// сжатые кадры и раскладка данных по участкам выходного файла. Поток
+// подается порциями произвольной длины
+class StreamDecoder {
+public:
+    StreamDecoder(const file_format::Header& header, ChunkWriter& writer, int out_fd, const Options& options)
+        : writer(writer), out_fd(out_fd), options(options), plain_size(header.plain_size),
+          compressed((header.flags & file_format::FLAG_COMPRESSED) != 0),
+          map_done((header.flags & file_format::FLAG_SPARSE) == 0),
+          extent_index(0), extent_pos(0), pending_pos(0),
+          plain(file_io::BufferPool::instance().acquire(compression::FRAME_SIZE)) {
+        if ((header.flags & ~file_format::KNOWN_FLAGS) != 0) {
+            throw std::runtime_error("Неподдерживаемый формат файла");
+        }
+        // Без карты участков поток данных ложится в файл сплошь
+        if (map_done && plain_size > 0) {
+            extents.push_back({0, plain_size});
+        }
+    }
+
+    void consume(const uint8_t* data, size_t length) {
+        if (map_done && !compressed) {
+            emit(data, length);
+            return;
+        }
+        // Карта участков и кадры пересекают границы порций, поэтому
+        // поток накапливается в pending до получения их целиком
+        pending.erase(pending.begin(), pending.begin() + pending_pos);
+        pending_pos = 0;
+        pending.insert(pending.end(), data, data + length);
+
+        if (!map_done) {
+            parseMap();
+            if (!map_done) {
+                return;
+            }
+            if (!compressed) {
+                emit(pending.data() + pending_pos, pending.size() - pending_pos);
+                pending_pos = pending.size();
+                return;
+            }
+        }
+
+        while (pending.size() - pending_pos >= compression::FRAME_HEADER_SIZE) {
+            const uint8_t* frame = pending.data() + pending_pos;
+            size_t stored = byte_order::getLe(frame, 4);
+            size_t plain_length = byte_order::getLe(frame + 4, 4);
+            if (plain_length > compression::FRAME_SIZE || stored > compression::frameBound()) {
+                throw std::runtime_error("Файл поврежден");
+            }
+            if (pending.size() - pending_pos < compression::FRAME_HEADER_SIZE + stored) {
+                break;
+            }
+            compression::decompressFrame(frame + compression::FRAME_HEADER_SIZE, stored,
+                                         plain.data(), plain_length);
+            emit(plain.data(), plain_length);
+            pending_pos += compression::FRAME_HEADER_SIZE + stored;
+        }
+    }
+
+    // Продолжение с контрольной точки: разбор карты участков из начала
+    // потока (map, length) и переход к смещению data_offset в данных
+    void restore(const uint8_t* map, size_t length, uint64_t data_offset) {
+        if (!map_done) {
+            pending.assign(map, map + length);
+            pending_pos = 0;
+            parseMap();
+            if (!map_done) {
+                throw std::runtime_error("Файл поврежден");
+            }
+            pending.clear();
+            pending_pos = 0;
+        }
+        emitted = data_offset;
+        while (extent_index < extents.size() && data_offset >= extents[extent_index].length) {
+            data_offset -= extents[extent_index].length;
+            extent_index++;
+        }
+        if (extent_index == extents.size() && data_offset > 0) {
+            throw std::runtime_error("Некорректная контрольная точка");
+        }
+        extent_pos = data_offset;
+    }
+
+    // Контрольная точка возможна после разбора карты участков. Неразобранные
+    // байты — начало неполного кадра, при продолжении он читается заново
+    bool mapped() const { return map_done; }
+    size_t pendingBytes() const { return pending.size() - pending_pos; }
+
+    // Сколько открытых данных разложено по участкам
+    uint64_t dataOffset() const { return emitted; }
+
+    // Поток должен закончиться ровно на конце последнего участка.
+    // Дыра в конце файла дописывается
+    void finish() {
+        if (!map_done || pending.size() != pending_pos || extent_index != extents.size()) {
+            throw std::runtime_error("Файл поврежден");
+        }
+        writer.fillTo(plain_size);
+    }
+
+private:
+    // Раскладка логического потока данных по участкам файла
+    void emit(const uint8_t* data, size_t length) {
+        while (length > 0) {
+            if (extent_index >= extents.size()) {
+                throw std::runtime_error("Файл поврежден");
+            }
+            const file_io::Extent& extent = extents[extent_index];
+            size_t part = std::min<uint64_t>(length, extent.length - extent_pos);
+            writer.write(data, part, extent.offset + extent_pos);
+            data += part;
+            length -= part;
+            extent_pos += part;
+            emitted += part;
+            if (extent_pos == extent.length) {
+                extent_index++;
+                extent_pos = 0;
+            }
+            if (options.progress) {
+                options.progress(part);
+            }
+        }
+    }
+
+    void parseMap() {
+        if (pending.size() - pending_pos < 4) {
+            return;
+        }
+        uint64_t count = byte_order::getLe(pending.data() + pending_pos, 4);
+        if (count > MAX_EXTENTS) {
+            throw std::runtime_error("Файл поврежден");
+        }
+        if (pending.size() - pending_pos < 4 + count * 16) {
+            return;
+        }
+        const uint8_t* p = pending.data() + pending_pos + 4;
+        uint64_t prev_end = 0;
+        for (uint64_t i = 0; i < count; i++, p += 16) {
+            file_io::Extent extent{byte_order::getLe(p, 8), byte_order::getLe(p + 8, 8)};
+            if (extent.offset < prev_end || extent.offset > plain_size || extent.length == 0 ||
+                extent.length > plain_size - extent.offset) {
+                throw std::runtime_error("Файл поврежден");
+            }
+            // Дыры, оставшиеся от прежнего содержимого, освобождаем явно
+            // (в канале дыры заполняются нулями при записи)
+            file_io::punchHole(out_fd, prev_end, extent.offset - prev_end);
+            prev_end = extent.offset + extent.length;
+            extents.push_back(extent);
+        }
+        file_io::punchHole(out_fd, prev_end, plain_size - prev_end);
+        pending_pos += 4 + count * 16;
+        map_done = true;
+    }
+
+    ChunkWriter& writer;
+    int out_fd;
+    const Options& options;
+    uint64_t plain_size;
+    bool compressed;
+    bool map_done;
+    std::vector<file_io::Extent> extents;
+    size_t extent_index;
+    uint64_t extent_pos;
+    uint64_t emitted = 0;
+    std::vector<uint8_t> pending;
+    size_t pending_pos;
+    file_io::BufferPool::Lease plain;
+};
+
+// Карта участков из начала потока для продолжения расшифрования с контрольной
+// точки. Читается и расшифровывается заново, имитовставка по ней уже посчитана
+std::vector<uint8_t> readExtentMap(int in_fd, const file_format::Header& header, uint64_t stream_end,
+                                   const Key& key, const Options& options) {
+    std::vector<uint8_t> map;
+    if ((header.flags & file_format::FLAG_SPARSE) == 0) {
+        return map;
+    }
+    uint64_t offset = file_format::HEADER_SIZE;
+    if (stream_end - offset < counter_mode::BLOCK_SIZE) {
+        throw std::runtime_error("Файл поврежден");
+    }
+    counter_mode::Counter ctr;
+    ctr.setValue(header.iv);
+    map.resize(counter_mode::BLOCK_SIZE);
+    readChunk(in_fd, map.data(), map.size(), offset, options);
+    counter_mode::apply_ctr(map.data(), map.size(), ctr, key.round);
+
+    uint64_t count = byte_order::getLe(map.data(), 4);
+    if (count > MAX_EXTENTS) {
+        throw std::runtime_error("Файл поврежден");
+    }
+    uint64_t blocks = (4 + count * 16 + counter_mode::BLOCK_SIZE - 1) / counter_mode::BLOCK_SIZE;
+    uint64_t length = std::min<uint64_t>(blocks * counter_mode::BLOCK_SIZE, stream_end - offset);
+    map.resize(length);
+    readChunk(in_fd, map.data() + counter_mode::BLOCK_SIZE, length - counter_mode::BLOCK_SIZE,
+              offset + counter_mode::BLOCK_SIZE, options);
+    counter_mode::apply_ctr(map.data() + counter_mode::BLOCK_SIZE, length - counter_mode::BLOCK_SIZE, ctr, key.round);
+    return map;
+}
+
+// Расшифрование файла нового формата
+void decryptWithHeader(int in_fd, uint64_t file_size, const file_format::Header& header,
+                       const std::string& dest_file, const Key& key, const Options& options) {
+    if ((header.flags & ~file_format::KNOWN_FLAGS) != 0) {
+        throw std::runtime_error("Неподдерживаемый формат файла");
+    }
+    if (file_size < file_format::HEADER_SIZE + MAC_SIZE) {
+        throw std::runtime_error("Файл слишком мал для расшифровки");
+    }
+
+    uint8_t raw_header[file_format::HEADER_SIZE];
+    uint8_t stored_mac[MAC_SIZE];
+    if (file_io::readAt(in_fd, raw_header, sizeof(raw_header), 0) != sizeof(raw_header) ||
+        file_io::readAt(in_fd, stored_mac, sizeof(stored_mac), file_size - MAC_SIZE) != sizeof(stored_mac)) {
+        throw std::runtime_error("Не удалось прочитать заголовок файла");
+    }
+
+    cmac::Context mac_ctx(key.round);
+    mac_ctx.update(raw_header, sizeof(raw_header));
+    counter_mode::Counter ctr;
+    ctr.setValue(header.iv);
+
+    uint64_t stream_end = file_size - MAC_SIZE;
+
+    // Частично расшифрованный файл после сбоя дописывается с контрольной точки
+    const Checkpoint* resume = options.resume;
+    bool resuming = canResume(options, dest_file, stream_end, header.flags) &&
+                    resume->frame_offset >= file_format::HEADER_SIZE &&
+                    resume->frame_offset <= resume->input_offset;
+    if (resuming && !mac_ctx.restoreState(resume->mac_state)) {
+        throw std::runtime_error("Некорректная контрольная точка");
+    }
+    bool direct = useDirectIo(options, header.plain_size);
+    file_io::FileDescriptor out = resuming ? file_io::openForResume(dest_file, direct)
+                                           : file_io::openForWrite(dest_file, direct);
+    if (header.flags & file_format::FLAG_SPARSE) {
+        // Дыры получаются сами при расширении файла, место резервировать нельзя
+        file_io::truncate(out.get(), header.plain_size);
+    } else {
+        file_io::preallocate(out.get(), header.plain_size);
+    }
+
+    file_io::adviseSequential(in_fd);
+    ChunkWriter writer(out.get(), options);
+
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(chunk);
+    uint64_t offset = file_format::HEADER_SIZE;
+    bool checkpointed = resuming;
+
+    try {
+        StreamDecoder decoder(header, writer, out.get(), options);
+        if (resuming) {
+            auto map = readExtentMap(in_fd, header, stream_end, key, options);
+            decoder.restore(map.data(), map.size(), resume->output_offset);
+            if (options.progress) {
+                options.progress(resume->output_offset);
+            }
+
+            // Кадр, на который пришлась точка, расшифровывается заново
+            // с ближайшей границы блока гаммы
+            uint64_t block = (resume->frame_offset - file_format::HEADER_SIZE) / counter_mode::BLOCK_SIZE;
+            uint64_t from = file_format::HEADER_SIZE + block * counter_mode::BLOCK_SIZE;
+            ctr = counterAt(header.iv, block);
+            auto head = file_io::BufferPool::instance().acquire(resume->input_offset - from);
+            readChunk(in_fd, head.data(), resume->input_offset - from, from, options);
+            counter_mode::apply_ctr(head.data(), resume->input_offset - from, ctr, key.round);
+            if (std::memcmp(ctr.value, resume->counter, sizeof(ctr.value)) != 0) {
+                throw std::runtime_error("Некорректная контрольная точка");
+            }
+            decoder.consume(head.data() + (resume->frame_offset - from), resume->input_offset - resume->frame_offset);
+            offset = resume->input_offset;
+        }
+        uint64_t checkpoint_at = offset + CHECKPOINT_INTERVAL;
+        while (offset < stream_end) {
+            size_t length = std::min<uint64_t>(chunk, stream_end - offset);
+            if (buffer.size() < length) {
+                buffer = file_io::BufferPool::instance().acquire(length);
+            }
+            readChunk(in_fd, buffer.data(), length, offset, options);
+            counter_mode::apply_ctr(buffer.data(), length, ctr, key.round);
+            mac_ctx.update(buffer.data(), length);
+            file_io::dropCache(in_fd, offset, length);
+            offset += length;
+            chunk = chunkSize(options);
+
+            decoder.consume(buffer.data(), length);
+            if (options.on_checkpoint && offset >= checkpoint_at && offset < stream_end && decoder.mapped()) {
+                reportCheckpoint(writer, offset, decoder.dataOffset(), ctr, mac_ctx, options,
+                                 header.flags, offset - decoder.pendingBytes());
+                checkpoint_at = offset + CHECKPOINT_INTERVAL;
+                checkpointed = true;
+            }
+        }
+        decoder.finish();
+        writer.finish();
+    } catch (const std::exception&) {
+        out.close();
+        // С контрольной точки файл можно будет дописать
+        if (!checkpointed) {
+            std::filesystem::remove(dest_file);
+        }
+        throw;
+    }
+    out.close();
+
+    auto calculated_mac = mac_ctx.finalize();
+    if (!std::equal(calculated_mac.begin(), calculated_mac.end(), stored_mac)) {
+        std::filesystem::remove(dest_file);
+        throw std::runtime_error("MAC не совпадает");
+    }
+}
+
+} // namespace
+
+void encryptFile(const std::string& source_file, const std::string& dest_file, const Key& key,
+                 const Options& options) {
+    file_io::FileDescriptor in;
+    try {
+        in = file_io::openForRead(source_file);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось открыть исходный файл: " + source_file);
+    }
+    uint64_t file_size = file_io::fileSize(in.get());
+    uint32_t flags = 0;
+
+    // Дыры не читаются и не шифруются, если их достаточно много
+    auto extents = file_io::dataExtents(in.get(), file_size);
+    uint64_t data_bytes = dataBytes(extents);
+    if (file_size - data_bytes >= SPARSE_MIN_HOLE_BYTES && extents.size() <= MAX_EXTENTS) {
+        flags |= file_format::FLAG_SPARSE;
+    } else {
+        extents = {{0, file_size}};
+        data_bytes = file_size;
+    }
+
+    // Сжатие включается, только если выборка из начала данных хорошо сжимается
+    if (options.compress && compression::available() && data_bytes >= compression::MIN_FILE_SIZE) {
+        size_t sample_size = std::min<uint64_t>(compression::FRAME_SIZE, extents.front().length);
+        std::vector<uint8_t> sample(sample_size);
+        if (file_io::readAt(in.get(), sample.data(), sample_size, extents.front().offset) == sample_size &&
+            compression::worthCompressing(sample.data(), sample_size)) {
+            flags |= file_format::FLAG_COMPRESSED;
+        }
+    }
+
+    if (flags != 0) {
+        file_io::adviseSequential(in.get());
+        encryptWithHeader(in.get(), file_size, extents, flags, dest_file, key, options);
+        return;
+    }
+
+    // Создаем временный файл. После сбоя он остается и дописывается
+    // с контрольной точки
+    std::string temp_file = dest_file + ".tmp";
+    bool resuming = canResume(options, temp_file, file_size, 0);
+    file_io::FileDescriptor out;
+    try {
+        bool direct = useDirectIo(options, encryptedSize(file_size));
+        out = resuming ? file_io::openForResume(temp_file, direct) : file_io::openForWrite(temp_file, direct);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Не удалось создать временный файл: " + temp_file);
+    }
+
+    // Итоговый размер известен заранее: резервируем его целиком, чтобы
+    // цепочка кластеров на FAT/exFAT выделялась одним куском
+    file_io::preallocate(out.get(), encryptedSize(file_size));
+
+    // Имитовставка считается по мере чтения, файл целиком в памяти не держим
+    cmac::Context mac_ctx(key.round);
+    if (resuming && !mac_ctx.restoreState(options.resume->mac_state)) {
+        throw std::runtime_error("Некорректная контрольная точка");
+    }
+
+    // Исходные данные повторно не читаются: читаем с упреждением и сразу вытесняем из кэша
+    file_io::adviseSequential(in.get());
+    ChunkWriter writer(out.get(), options);
+
+    auto iv = counter_mode::generate_iv();
+    counter_mode::Counter ctr;
+    ctr.setValue(iv.data());
+
+    // Первая порция начинается с синхропосылки, поэтому все записи ложатся
+    // по выровненным смещениям. Запас в конце буфера — под имитовставку,
+    // которая дописывается к последней порции. Маленьким файлам большой
+    // буфер не нужен
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(
+        std::min<uint64_t>(chunk, encryptedSize(file_size)) + MAC_SIZE);
+    std::memcpy(buffer.data(), iv.data(), counter_mode::IV_SIZE);
+    size_t fill = counter_mode::IV_SIZE;
+    uint64_t total_read = 0;
+    uint64_t out_offset = 0;
+    if (resuming) {
+        // Синхропосылка уже записана, продолжаем с границы порции
+        ctr.setValue(options.resume->counter);
+        fill = 0;
+        total_read = options.resume->input_offset;
+        out_offset = options.resume->output_offset;
+        if (options.progress) {
+            options.progress(total_read);
+        }
+    }
+    uint64_t checkpoint_at = total_read + CHECKPOINT_INTERVAL;
+    bool checkpointed = resuming;
+
+    try {
+        while (true) {
+            size_t bytes_to_read = std::min<uint64_t>(chunk - fill, file_size - total_read);
+            if (bytes_to_read > 0) {
+                uint8_t* data = buffer.data() + fill;
+                readChunk(in.get(), data, bytes_to_read, total_read, options);
+                size_t bytes_read = bytes_to_read;
+
+                mac_ctx.update(data, bytes_read);
+                counter_mode::apply_ctr(data, bytes_read, ctr, key.round);
+
+                file_io::dropCache(in.get(), total_read, bytes_read);
+                fill += bytes_read;
+                total_read += bytes_read;
+                if (options.progress) {
+                    options.progress(bytes_read);
+                }
+            }
+            if (total_read == file_size) {
+                break;
+            }
+
+            writer.write(buffer.data(), fill, out_offset);
+            out_offset += fill;
+            fill = 0;
+            if (options.on_checkpoint && total_read >= checkpoint_at) {
+                reportCheckpoint(writer, total_read, out_offset, ctr, mac_ctx, options);
+                checkpoint_at = total_read + CHECKPOINT_INTERVAL;
+                checkpointed = true;
+            }
+
+            // После замеров размер следующей порции может измениться
+            chunk = chunkSize(options);
+            size_t needed = std::min<uint64_t>(chunk, file_size - total_read) + MAC_SIZE;
+            if (buffer.size() < needed) {
+                buffer = file_io::BufferPool::instance().acquire(needed);
+            }
+        }
+
+        // Дописываем CMAC к последней порции
+        auto mac = mac_ctx.finalize();
+        std::memcpy(buffer.data() + fill, mac.data(), mac.size());
+        fill += mac.size();
+        writer.write(buffer.data(), fill, out_offset);
+        writer.finish();
+    } catch (const std::exception&) {
+        out.close();
+        // С контрольной точки файл можно будет дописать
+        if (!checkpointed) {
+            std::filesystem::remove(temp_file);
+        }
+        throw;
+    }
+
+    // Закрываем файлы
+    in.close();
+    out.close();
+
+    // Проверяем размер временного файла
+    auto temp_size = std::filesystem::file_size(temp_file);
+    if (temp_size != encryptedSize(file_size)) {
+        std::filesystem::remove(temp_file);
+        throw std::runtime_error("Некорректный размер зашифрованного файла");
+    }
+
+    publishFile(temp_file, dest_file);
+
+    // Принудительно сбрасываем буферы файловой системы
+    if (options.sync_each_file) {
+        sync();
+    }
+}
+
+void decryptFile(const std::string& source_file, const std::string& dest_file, const Key& key,
+                 const Options& options) {
+    file_io::FileDescriptor in = file_io::openForRead(source_file);
+    uint64_t file_size = file_io::fileSize(in.get());
+
+    file_format::Header header;
+    if (file_format::probe(in.get(), header) == file_format::Format::HEADER) {
+        decryptWithHeader(in.get(), file_size, header, dest_file, key, options);
+        return;
+    }
+
+    // Проверяем минимальный размер (IV + MAC)
+    if (file_size < counter_mode::IV_SIZE + MAC_SIZE) {
+        throw std::runtime_error("Файл слишком мал для расшифровки");
+    }
+
+    // Читаем синхропосылку и MAC из конца файла
+    uint8_t iv[counter_mode::IV_SIZE];
+    uint8_t stored_mac[MAC_SIZE];
+    if (file_io::readAt(in.get(), iv, sizeof(iv), 0) != sizeof(iv) ||
+        file_io::readAt(in.get(), stored_mac, sizeof(stored_mac), file_size - MAC_SIZE) != sizeof(stored_mac)) {
+        throw std::runtime_error("Не удалось прочитать заголовок файла");
+    }
+
+    counter_mode::Counter ctr;
+    ctr.setValue(iv);
+
+    uint64_t plain_size = decryptedSize(file_size);
+
+    // Имитовставка считается по мере расшифрования
+    cmac::Context mac_ctx(key.round);
+
+    // Частично расшифрованный файл после сбоя дописывается с контрольной точки
+    bool resuming = canResume(options, dest_file, plain_size, 0);
+    if (resuming && !mac_ctx.restoreState(options.resume->mac_state)) {
+        throw std::runtime_error("Некорректная контрольная точка");
+    }
+    file_io::FileDescriptor out = resuming ? file_io::openForResume(dest_file, useDirectIo(options, plain_size))
+                                           : file_io::openForWrite(dest_file, useDirectIo(options, plain_size));
+    file_io::preallocate(out.get(), plain_size);
+
+    file_io::adviseSequential(in.get());
+    ChunkWriter writer(out.get(), options);
+
+    // Записи в выходной файл выровнены по размеру порции
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(std::min<uint64_t>(chunk, plain_size));
+    uint64_t total_read = 0;
+    if (resuming) {
+        ctr.setValue(options.resume->counter);
+        total_read = options.resume->input_offset;
+        if (options.progress) {
+            options.progress(total_read);
+        }
+    }
+    uint64_t checkpoint_at = total_read + CHECKPOINT_INTERVAL;
+    bool checkpointed = resuming;
+
+    try {
+        while (total_read < plain_size) {
+            size_t bytes_to_read = std::min<uint64_t>(chunk, plain_size - total_read);
+            if (buffer.size() < bytes_to_read) {
+                buffer = file_io::BufferPool::instance().acquire(bytes_to_read);
+            }
+            readChunk(in.get(), buffer.data(), bytes_to_read, counter_mode::IV_SIZE + total_read, options);
+            size_t bytes_read = bytes_to_read;
+
+            counter_mode::apply_ctr(buffer.data(), bytes_read, ctr, key.round);
+            mac_ctx.update(buffer.data(), bytes_read);
+
+            writer.write(buffer.data(), bytes_read, total_read);
+            file_io::dropCache(in.get(), counter_mode::IV_SIZE + total_read, bytes_read);
+            total_read += bytes_read;
+            chunk = chunkSize(options);
+            if (options.progress) {
+                options.progress(bytes_read);
+            }
+            if (options.on_checkpoint && total_read >= checkpoint_at && total_read < plain_size) {
+                reportCheckpoint(writer, total_read, total_read, ctr, mac_ctx, options);
+                checkpoint_at = total_read + CHECKPOINT_INTERVAL;
+                checkpointed = true;
+            }
+        }
+        writer.finish();
+    } catch (const std::exception&) {
+        out.close();
+        // С контрольной точки файл можно будет дописать
+        if (!checkpointed) {
+            std::filesystem::remove(dest_file);
+        }
+        throw;
+    }
+
+    out.close();
+
+    // Проверяем CMAC
+    auto calculated_mac = mac_ctx.finalize();
+    if (!std::equal(calculated_mac.begin(), calculated_mac.end(), stored_mac)) {
+        std::filesystem::remove(dest_file);
+        throw std::runtime_error("MAC не совпадает");
+    }
+}
+
+bool describeFile(const std::string& path, uint64_t& plain_size) {
+    uint64_t file_size;
+    file_format::Header header;
+    file_format::Format format;
+    try {
+        file_io::FileDescriptor in = file_io::openForRead(path);
+        file_size = file_io::fileSize(in.get());
+        format = file_format::probe(in.get(), header);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    if (format == file_format::Format::HEADER) {
+        if ((header.flags & ~file_format::KNOWN_FLAGS) != 0 || file_size < file_format::HEADER_SIZE + MAC_SIZE) {
+            return false;
+        }
+        plain_size = header.plain_size;
+        return true;
+    }
+
+    const std::string extension = ".enc";
+    if (path.size() <= extension.size() ||
+        path.compare(path.size() - extension.size(), extension.size(), extension) != 0 ||
+        file_size < counter_mode::IV_SIZE + MAC_SIZE) {
+        return false;
+    }
+    plain_size = decryptedSize(file_size);
+    return true;
+}
+
+uint64_t encryptStream(int in_fd, int out_fd, const Key& key, const Options& options) {
+    // Длина потока заранее неизвестна, поэтому используется исходный формат:
+    // размер в нем не хранится, а имитовставка дописывается по концу потока
+    cmac::Context mac_ctx(key.round);
+    ChunkWriter writer(out_fd, options);
+
+    auto iv = counter_mode::generate_iv();
+    counter_mode::Counter ctr;
+    ctr.setValue(iv.data());
+
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(chunk + MAC_SIZE);
+    std::memcpy(buffer.data(), iv.data(), counter_mode::IV_SIZE);
+    size_t fill = counter_mode::IV_SIZE;
+    uint64_t total_read = 0;
+    uint64_t out_offset = 0;
+
+    while (true) {
+        // Неполная порция означает конец потока
+        auto started = std::chrono::steady_clock::now();
+        uint8_t* data = buffer.data() + fill;
+        size_t bytes_read = file_io::readStream(in_fd, data, chunk - fill);
+        if (options.tuner && bytes_read > 0) {
+            options.tuner->recordRead(bytes_read, secondsSince(started));
+        }
+
+        mac_ctx.update(data, bytes_read);
+        counter_mode::apply_ctr(data, bytes_read, ctr, key.round);
+        fill += bytes_read;
+        total_read += bytes_read;
+        if (options.progress && bytes_read > 0) {
+            options.progress(bytes_read);
+        }
+        if (fill < chunk) {
+            break;
+        }
+
+        writer.write(buffer.data(), fill, out_offset);
+        out_offset += fill;
+        fill = 0;
+
+        chunk = chunkSize(options);
+        if (buffer.size() < chunk + MAC_SIZE) {
+            buffer = file_io::BufferPool::instance().acquire(chunk + MAC_SIZE);
+        }
+    }
+
+    auto mac = mac_ctx.finalize();
+    std::memcpy(buffer.data() + fill, mac.data(), mac.size());
+    writer.write(buffer.data(), fill + mac.size(), out_offset);
+    writer.finish();
+    return total_read;
+}
+
+uint64_t decryptStream(int in_fd, int out_fd, const Key& key, const Options& options) {
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(chunk + MAC_SIZE);
+
+    // Формат определяется по началу потока
+    size_t held = file_io::readStream(in_fd, buffer.data(), file_format::HEADER_SIZE);
+    file_format::Header header;
+    bool with_header = held == file_format::HEADER_SIZE && file_format::decodeHeader(buffer.data(), header);
+
+    cmac::Context mac_ctx(key.round);
+    counter_mode::Counter ctr;
+    ChunkWriter writer(out_fd, options);
+    std::optional<StreamDecoder> decoder;
+    if (with_header) {
+        mac_ctx.update(buffer.data(), file_format::HEADER_SIZE);
+        ctr.setValue(header.iv);
+        decoder.emplace(header, writer, out_fd, options);
+        held = 0;
+    } else {
+        if (held < counter_mode::IV_SIZE) {
+            throw std::runtime_error("Файл слишком мал для расшифровки");
+        }
+        ctr.setValue(buffer.data());
+        held -= counter_mode::IV_SIZE;
+        std::memmove(buffer.data(), buffer.data() + counter_mode::IV_SIZE, held);
+    }
+
+    // В буфере всегда придерживается хвост не короче имитовставки: пока
+    // поток не кончился, неизвестно, данные это или сама имитовставка.
+    // Расшифровываемые порции, кроме последней, кратны блоку шифра
+    uint64_t stream_offset = 0;
+    bool eof = false;
+    while (!eof) {
+        auto started = std::chrono::steady_clock::now();
+        size_t request = chunk + MAC_SIZE - held;
+        size_t bytes_read = file_io::readStream(in_fd, buffer.data() + held, request);
+        if (options.tuner && bytes_read > 0) {
+            options.tuner->recordRead(bytes_read, secondsSince(started));
+        }
+        eof = bytes_read < request;
+
+        size_t total = held + bytes_read;
+        if (total < MAC_SIZE) {
+            throw std::runtime_error("Файл слишком мал для расшифровки");
+        }
+        size_t length = total - MAC_SIZE;
+        if (!eof) {
+            length = length / counter_mode::BLOCK_SIZE * counter_mode::BLOCK_SIZE;
+        }
+
+        counter_mode::apply_ctr(buffer.data(), length, ctr, key.round);
+        mac_ctx.update(buffer.data(), length);
+        if (decoder) {
+            decoder->consume(buffer.data(), length);
+        } else {
+            writer.write(buffer.data(), length, stream_offset);
+            if (options.progress && length > 0) {
+                options.progress(length);
+            }
+        }
+        stream_offset += length;
+        held = total - length;
+        std::memmove(buffer.data(), buffer.data() + length, held);
+
+        chunk = chunkSize(options);
+        if (buffer.size() < chunk + MAC_SIZE) {
+            auto larger = file_io::BufferPool::instance().acquire(chunk + MAC_SIZE);
+            std::memcpy(larger.data(), buffer.data(), held);
+            buffer = std::move(larger);
+        }
+    }
+
+    if (decoder) {
+        decoder->finish();
+    }
+    writer.finish();
+
+    auto calculated_mac = mac_ctx.finalize();
+    if (!std::equal(calculated_mac.begin(), calculated_mac.end(), buffer.data())) {
+        throw std::runtime_error("MAC не совпадает");
+    }
+    return with_header ? header.plain_size : stream_offset;
+}
+
+void rekeyFile(const std::string& source_file, const std::string& dest_file,
+               const Key& old_key, const Key& new_key, const Options& options) {
+    file_io::FileDescriptor in = file_io::openForRead(source_file);
+    uint64_t file_size = file_io::fileSize(in.get());
+
+    // В формате с заголовком синхропосылка лежит внутри заголовка,
+    // а сам заголовок входит в имитовставку
+    file_format::Header header;
+    bool with_header = file_format::probe(in.get(), header) == file_format::Format::HEADER;
+    size_t header_size = with_header ? file_format::HEADER_SIZE : counter_mode::IV_SIZE;
+    size_t iv_offset = with_header ? file_format::IV_OFFSET : 0;
+    if (file_size < header_size + MAC_SIZE) {
+        throw std::runtime_error("Файл слишком мал для расшифровки");
+    }
+
+    uint8_t old_iv[counter_mode::IV_SIZE];
+    uint8_t stored_mac[MAC_SIZE];
+    if (file_io::readAt(in.get(), old_iv, sizeof(old_iv), iv_offset) != sizeof(old_iv) ||
+        file_io::readAt(in.get(), stored_mac, sizeof(stored_mac), file_size - MAC_SIZE) != sizeof(stored_mac)) {
+        throw std::runtime_error("Не удалось прочитать заголовок файла");
+    }
+
+    counter_mode::Counter old_ctr;
+    old_ctr.setValue(old_iv);
+    auto new_iv = counter_mode::generate_iv();
+    counter_mode::Counter new_ctr;
+    new_ctr.setValue(new_iv.data());
+
+    cmac::Context old_mac(old_key.round);
+    cmac::Context new_mac(new_key.round);
+
+    // Результат того же размера пишется во временный файл рядом с целевым,
+    // поэтому переименование атомарно и при dest_file == source_file
+    std::string temp_file = dest_file + ".tmp";
+    file_io::FileDescriptor out = file_io::openForWrite(temp_file, useDirectIo(options, file_size));
+    file_io::preallocate(out.get(), file_size);
+
+    file_io::adviseSequential(in.get());
+    ChunkWriter writer(out.get(), options);
+
+    // Раскладка входа и выхода совпадает (заголовок, данные, имитовставка),
+    // поэтому порция читается и пишется по одному и тому же смещению.
+    // Открытый текст существует только в буфере между двумя наложениями гаммы
+    uint64_t data_end = file_size - MAC_SIZE;
+    size_t chunk = chunkSize(options);
+    auto buffer = file_io::BufferPool::instance().acquire(std::min<uint64_t>(chunk, data_end) + MAC_SIZE);
+    uint64_t offset = 0;
+
+    try {
+        while (true) {
+            size_t length = std::min<uint64_t>(chunk, data_end - offset);
+            readChunk(in.get(), buffer.data(), length, offset, options);
+
+            size_t data_start = 0;
+            if (offset == 0) {
+                if (with_header) {
+                    old_mac.update(buffer.data(), header_size);
+                }
+                std::memcpy(buffer.data() + iv_offset, new_iv.data(), counter_mode::IV_SIZE);
+                if (with_header) {
+                    new_mac.update(buffer.data(), header_size);
+                }
+                data_start = header_size;
+            }
+            uint8_t* data = buffer.data() + data_start;
+            size_t data_length = length - data_start;
+
+            counter_mode::apply_ctr(data, data_length, old_ctr, old_key.round);
+            old_mac.update(data, data_length);
+            new_mac.update(data, data_length);
+            counter_mode::apply_ctr(data, data_length, new_ctr, new_key.round);
+
+            file_io::dropCache(in.get(), offset, length);
+            offset += length;
+            if (options.progress) {
+                options.progress(data_length);
+            }
+
+            if (offset == data_end) {
+                // Старая имитовставка проверяется до публикации результата
+                auto mac = old_mac.finalize();
+                if (!std::equal(mac.begin(), mac.end(), stored_mac)) {
+                    throw std::runtime_error("MAC не совпадает");
+                }
+                mac = new_mac.finalize();
+                std::memcpy(buffer.data() + length, mac.data(), MAC_SIZE);
+                writer.write(buffer.data(), length + MAC_SIZE, offset - length);
+                break;
+            }
+            writer.write(buffer.data(), length, offset - length);
+
+            chunk = chunkSize(options);
+            size_t needed = std::min<uint64_t>(chunk, data_end - offset) + MAC_SIZE;
+            if (buffer.size() < needed) {
+                buffer = file_io::BufferPool::instance().acquire(needed);
+            }
+        }
+        writer.finish();
+    } catch (const std::exception&) {
+        out.close();
+        std::filesystem::remove(temp_file);
+        throw;
+    }
+
+    in.close();
+    out.close();
+
+    if (std::filesystem::file_size(temp_file) != file_size) {
+        std::filesystem::remove(temp_file);
+        throw std::runtime_error("Некорректный размер зашифрованного файла");
+    }
+    publishFile(temp_file, dest_file);
+
+    if (options.sync_each_file) {
+        sync();
+    }
+}
+
+} // namespace file_engine
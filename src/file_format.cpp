@@ -0,0 +1,36 @@
+#include "file_format.h"
+#include "file_io.h"
+#include "byte_order.h"
+#include <cstring>
+
+namespace file_format {
+
+void encodeHeader(const Header& header, uint8_t* out) {
+    std::memset(out, 0, HEADER_SIZE);
+    std::memcpy(out, MAGIC, sizeof(MAGIC));
+    byte_order::putLe(out + 8, header.flags, 4);
+    byte_order::putLe(out + 16, header.plain_size, 8);
+    std::memcpy(out + IV_OFFSET, header.iv, counter_mode::IV_SIZE);
+}
+
+bool decodeHeader(const uint8_t* in, Header& header) {
+    if (std::memcmp(in, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    header.flags = static_cast<uint32_t>(byte_order::getLe(in + 8, 4));
+    header.plain_size = byte_order::getLe(in + 16, 8);
+    std::memcpy(header.iv, in + IV_OFFSET, counter_mode::IV_SIZE);
+    return true;
+}
+
+Format probe(int fd, Header& header) {
+    // Случайная синхропосылка исходного формата совпадает с MAGIC
+    // с вероятностью 2^-64
+    uint8_t raw[HEADER_SIZE];
+    if (file_io::readAt(fd, raw, sizeof(raw), 0) == sizeof(raw) && decodeHeader(raw, header)) {
+        return Format::HEADER;
+    }
+    return Format::LEGACY;
+}
+
+} // namespace file_format
@@ -0,0 +1,430 @@
+#include "file_io.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace file_io {
+
+FileDescriptor::~FileDescriptor() {
+    close();
+}
+
+FileDescriptor::FileDescriptor(FileDescriptor&& other) noexcept : fd(other.fd) {
+    other.fd = -1;
+}
+
+FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = other.fd;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+void FileDescriptor::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+FileDescriptor openForRead(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Не удалось открыть файл: " + path);
+    }
+    return FileDescriptor(fd);
+}
+
+FileDescriptor openForWrite(const std::string& path, bool direct) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = -1;
+    if (direct) {
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    }
+    if (fd < 0) {
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Не удалось создать файл: " + path);
+    }
+    return FileDescriptor(fd);
+}
+
+FileDescriptor openForResume(const std::string& path, bool direct) {
+    int flags = O_WRONLY | O_CLOEXEC;
+    int fd = -1;
+    if (direct) {
+        fd = ::open(path.c_str(), flags | O_DIRECT);
+    }
+    if (fd < 0) {
+        fd = ::open(path.c_str(), flags);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Не удалось открыть файл: " + path);
+    }
+    return FileDescriptor(fd);
+}
+
+FileDescriptor reopenReadWrite(int fd) {
+    std::string path = "/proc/self/fd/" + std::to_string(fd);
+    int new_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (new_fd < 0) {
+        throw std::runtime_error("Не удалось открыть файл повторно: " + std::string(strerror(errno)));
+    }
+    return FileDescriptor(new_fd);
+}
+
+bool setDirect(int fd, bool enable) {
+    int flags = ::fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return false;
+    }
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return ::fcntl(fd, F_SETFL, flags) == 0;
+}
+
+bool isDirect(int fd) {
+    int flags = ::fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_DIRECT) != 0;
+}
+
+uint64_t fileSize(int fd) {
+    struct ::stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw std::runtime_error("Не удалось получить размер файла");
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+bool preallocate(int fd, uint64_t size) {
+    if (size == 0) {
+        return true;
+    }
+
+    // posix_fallocate не используем: при отсутствии поддержки glibc
+    // эмулирует его записью нулей, что удваивает объем записи на флешку
+    if (::fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0) {
+        return true;
+    }
+    if (errno == EOPNOTSUPP &&
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0) {
+        return true;
+    }
+    return false;
+}
+
+void truncate(int fd, uint64_t size) {
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        throw std::runtime_error("Ошибка изменения размера файла: " + std::string(strerror(errno)));
+    }
+}
+
+std::vector<Extent> dataExtents(int fd, uint64_t size) {
+    std::vector<Extent> extents;
+    uint64_t offset = 0;
+    while (offset < size) {
+        off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                break;  // Дальше только дыра до конца файла
+            }
+            return {{0, size}};
+        }
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            return {{0, size}};
+        }
+        uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(hole), size);
+        if (end > static_cast<uint64_t>(data)) {
+            extents.push_back({static_cast<uint64_t>(data), end - static_cast<uint64_t>(data)});
+        }
+        offset = end;
+    }
+    return extents;
+}
+
+bool punchHole(int fd, uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return true;
+    }
+    return ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       static_cast<off_t>(offset), static_cast<off_t>(length)) == 0;
+}
+
+size_t readAt(int fd, void* buffer, size_t length, uint64_t offset) {
+    char* ptr = static_cast<char*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, ptr + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка чтения: " + std::string(strerror(errno)));
+        }
+        if (n == 0) break;
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+void writeAt(int fd, const void* buffer, size_t length, uint64_t offset) {
+    const char* ptr = static_cast<const char*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, ptr + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка записи в файл: " + std::string(strerror(errno)));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+bool isSeekable(int fd) {
+    return ::lseek(fd, 0, SEEK_CUR) != -1;
+}
+
+size_t readStream(int fd, void* buffer, size_t length) {
+    char* ptr = static_cast<char*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::read(fd, ptr + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка чтения: " + std::string(strerror(errno)));
+        }
+        if (n == 0) break;
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+void writeStream(int fd, const void* buffer, size_t length) {
+    const char* ptr = static_cast<const char*>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::write(fd, ptr + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка записи: " + std::string(strerror(errno)));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void syncData(int fd) {
+    if (::fdatasync(fd) != 0) {
+        throw std::runtime_error("Ошибка сброса данных на носитель: " + std::string(strerror(errno)));
+    }
+}
+
+void adviseSequential(int fd) {
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void readAhead(int fd, uint64_t offset, uint64_t length) {
+    ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+}
+
+void dropCache(int fd, uint64_t offset, uint64_t length) {
+    ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+}
+
+void WriteBehind::written(uint64_t offset, uint64_t length) {
+    // Запускаем сброс новой порции, не дожидаясь его окончания
+    ::sync_file_range(fd, static_cast<off64_t>(offset), static_cast<off64_t>(length),
+                      SYNC_FILE_RANGE_WRITE);
+    in_flight.emplace_back(offset, length);
+    while (in_flight.size() > depth) {
+        retire();
+    }
+}
+
+void WriteBehind::finish() {
+    while (!in_flight.empty()) {
+        retire();
+    }
+}
+
+void WriteBehind::retire() {
+    auto range = in_flight.front();
+    in_flight.pop_front();
+    ::sync_file_range(fd, static_cast<off64_t>(range.first), static_cast<off64_t>(range.second),
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    dropCache(fd, range.first, range.second);
+}
+
+AlignedBuffer::AlignedBuffer(size_t size) : ptr(nullptr), length(size) {
+    void* memory = nullptr;
+    if (::posix_memalign(&memory, DIRECT_IO_ALIGNMENT, size) != 0) {
+        throw std::bad_alloc();
+    }
+    ptr = static_cast<uint8_t*>(memory);
+}
+
+AlignedBuffer::~AlignedBuffer() {
+    ::free(ptr);
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept : ptr(other.ptr), length(other.length) {
+    other.ptr = nullptr;
+    other.length = 0;
+}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+    if (this != &other) {
+        ::free(ptr);
+        ptr = other.ptr;
+        length = other.length;
+        other.ptr = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+BufferPool::Lease::~Lease() {
+    if (pool && buffer.data()) {
+        pool->release(std::move(buffer));
+    }
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        if (pool && buffer.data()) {
+            pool->release(std::move(buffer));
+        }
+        pool = other.pool;
+        buffer = std::move(other.buffer);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::Lease BufferPool::acquire(size_t size) {
+    size = (size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+            if (it->size() >= size) {
+                AlignedBuffer buffer = std::move(*it);
+                free_buffers.erase(it);
+                return Lease(*this, std::move(buffer));
+            }
+        }
+    }
+    return Lease(*this, AlignedBuffer(size));
+}
+
+void BufferPool::release(AlignedBuffer buffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_buffers.size() < MAX_CACHED) {
+        free_buffers.push_back(std::move(buffer));
+    }
+}
+
+ReadBackVerifier::ReadBackVerifier(int fd, size_t depth)
+    : file(reopenReadWrite(fd)), depth(std::max<size_t>(depth, 1)), busy(false), stopping(false),
+      rewrite_count(0), worker(&ReadBackVerifier::run, this) {}
+
+ReadBackVerifier::~ReadBackVerifier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+void ReadBackVerifier::submit(const void* data, size_t length, uint64_t offset) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return queue.size() + (busy ? 1 : 0) < depth || !error.empty(); });
+    }
+    throwIfFailed();
+
+    Range range{offset, length, BufferPool::instance().acquire(length)};
+    std::memcpy(range.data.data(), data, length);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(range));
+    }
+    changed.notify_all();
+}
+
+void ReadBackVerifier::finish() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return (queue.empty() && !busy) || !error.empty(); });
+    }
+    throwIfFailed();
+}
+
+void ReadBackVerifier::throwIfFailed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+void ReadBackVerifier::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        Range range = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        lock.unlock();
+
+        std::string failure;
+        try {
+            check(range);
+        } catch (const std::exception& e) {
+            failure = e.what();
+        }
+
+        lock.lock();
+        busy = false;
+        if (!failure.empty() && error.empty()) {
+            error = failure;
+            queue.clear();
+        }
+        changed.notify_all();
+    }
+}
+
+void ReadBackVerifier::check(Range& range) {
+    auto read_back = BufferPool::instance().acquire(range.length);
+    for (int attempt = 0; ; attempt++) {
+        // Чтение должно идти с носителя, а не из страничного кэша
+        ::sync_file_range(file.get(), static_cast<off64_t>(range.offset), static_cast<off64_t>(range.length),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        dropCache(file.get(), range.offset, range.length);
+        if (readAt(file.get(), read_back.data(), range.length, range.offset) == range.length &&
+            std::memcmp(read_back.data(), range.data.data(), range.length) == 0) {
+            return;
+        }
+        if (attempt == MAX_REWRITES) {
+            throw std::runtime_error("Записанные данные не совпадают с исходными (сбой носителя)");
+        }
+        writeAt(file.get(), range.data.data(), range.length, range.offset);
+        rewrite_count++;
+    }
+}
+
+} // namespace file_io
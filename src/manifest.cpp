@@ -0,0 +1,219 @@
+#include "manifest.h"
+#include "file_io.h"
+#include "byte_order.h"
+#include <filesystem>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace manifest {
+
+namespace {
+
+constexpr uint32_t VERSION = 1;
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+bool statFile(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+void appendString(std::vector<uint8_t>& out, const std::string& value) {
+    byte_order::appendLe(out, value.size(), 2);
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+bool readString(const std::vector<uint8_t>& data, size_t& pos, std::string& value) {
+    if (data.size() - pos < 2) {
+        return false;
+    }
+    size_t length = byte_order::getLe(data.data() + pos, 2);
+    pos += 2;
+    if (data.size() - pos < length) {
+        return false;
+    }
+    value.assign(reinterpret_cast<const char*>(data.data() + pos), length);
+    pos += length;
+    return true;
+}
+
+std::string manifestPath(const std::string& dest_dir) {
+    return dest_dir + "/" + FILE_NAME;
+}
+
+} // namespace
+
+uint64_t fastHash(const std::string& path) {
+    file_io::FileDescriptor fd = file_io::openForRead(path);
+    uint64_t size = file_io::fileSize(fd.get());
+
+    uint8_t size_bytes[8];
+    byte_order::putLe(size_bytes, size, sizeof(size_bytes));
+    uint64_t hash = fnv1a(FNV_OFFSET, size_bytes, sizeof(size_bytes));
+
+    // Мелкие файлы хешируются целиком, у крупных — три выборки
+    std::vector<uint8_t> sample(HASH_SAMPLE_SIZE);
+    uint64_t offsets[] = {0, size / 2, size > HASH_SAMPLE_SIZE ? size - HASH_SAMPLE_SIZE : 0};
+    size_t samples = size > 3 * HASH_SAMPLE_SIZE ? 3 : 1;
+    for (size_t i = 0; i < samples; i++) {
+        size_t length = samples == 1 ? size : HASH_SAMPLE_SIZE;
+        for (size_t done = 0; done < length; ) {
+            size_t part = std::min(length - done, sample.size());
+            size_t bytes_read = file_io::readAt(fd.get(), sample.data(), part, offsets[i] + done);
+            hash = fnv1a(hash, sample.data(), bytes_read);
+            if (bytes_read < part) {
+                break;
+            }
+            done += part;
+        }
+    }
+    return hash;
+}
+
+Entry describe(const std::string& name, const std::string& source_path, const std::string& output) {
+    Entry entry;
+    entry.name = name;
+    entry.output = output;
+    if (!statFile(source_path, entry.size, entry.mtime)) {
+        throw std::runtime_error("Исходный файл не найден: " + source_path);
+    }
+    entry.hash = fastHash(source_path);
+    return entry;
+}
+
+Manifest::Manifest(const std::string& dest_dir, const file_engine::Key& key)
+    : dest_dir(dest_dir), key(key) {
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(manifestPath(dest_dir), ec);
+    if (ec) {
+        return;
+    }
+
+    std::vector<uint8_t> encrypted(file_size);
+    std::vector<uint8_t> data;
+    try {
+        file_io::FileDescriptor fd = file_io::openForRead(manifestPath(dest_dir));
+        if (file_io::readAt(fd.get(), encrypted.data(), encrypted.size(), 0) != encrypted.size()) {
+            return;
+        }
+    } catch (const std::exception&) {
+        return;
+    }
+    if (!file_engine::decryptBuffer(encrypted, key, data) || data.size() < 8 ||
+        byte_order::getLe(data.data(), 4) != VERSION) {
+        return;
+    }
+
+    size_t count = byte_order::getLe(data.data() + 4, 4);
+    size_t pos = 8;
+    std::map<std::string, Entry> loaded;
+    for (size_t i = 0; i < count; i++) {
+        Entry entry;
+        if (!readString(data, pos, entry.name) || data.size() - pos < 24) {
+            return;
+        }
+        entry.size = byte_order::getLe(data.data() + pos, 8);
+        entry.mtime = static_cast<int64_t>(byte_order::getLe(data.data() + pos + 8, 8));
+        entry.hash = byte_order::getLe(data.data() + pos + 16, 8);
+        pos += 24;
+        if (!readString(data, pos, entry.output)) {
+            return;
+        }
+        loaded[entry.name] = entry;
+    }
+    entries = std::move(loaded);
+}
+
+bool Manifest::find(const std::string& name, Entry& entry) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(name);
+    if (it == entries.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+bool Manifest::isUnchanged(const std::string& name, const std::string& source_path) const {
+    Entry entry;
+    if (!find(name, entry)) {
+        return false;
+    }
+
+    uint64_t size;
+    int64_t mtime;
+    if (!statFile(source_path, size, mtime) || size != entry.size || mtime != entry.mtime) {
+        return false;
+    }
+    if (!std::filesystem::exists(dest_dir + "/" + entry.output)) {
+        return false;
+    }
+
+    try {
+        return fastHash(source_path) == entry.hash;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool Manifest::references(const std::string& output) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& item : entries) {
+        if (item.second.output == output) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Manifest::record(const Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[entry.name] = entry;
+}
+
+void Manifest::save() const {
+    std::vector<uint8_t> data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        byte_order::appendLe(data, VERSION, 4);
+        byte_order::appendLe(data, entries.size(), 4);
+        for (const auto& item : entries) {
+            const Entry& entry = item.second;
+            appendString(data, entry.name);
+            byte_order::appendLe(data, entry.size, 8);
+            byte_order::appendLe(data, static_cast<uint64_t>(entry.mtime), 8);
+            byte_order::appendLe(data, entry.hash, 8);
+            appendString(data, entry.output);
+        }
+    }
+    auto encrypted = file_engine::encryptBuffer(data, key);
+
+    // Пишем во временный файл, сбрасываем на носитель и переименовываем,
+    // чтобы при отключении питания не остаться с пустым манифестом
+    std::string temp_path = manifestPath(dest_dir) + ".tmp";
+    {
+        file_io::FileDescriptor fd = file_io::openForWrite(temp_path);
+        file_io::writeAt(fd.get(), encrypted.data(), encrypted.size(), 0);
+        file_io::syncData(fd.get());
+    }
+    std::filesystem::rename(temp_path, manifestPath(dest_dir));
+}
+
+} // namespace manifest
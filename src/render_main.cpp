@@ -0,0 +1,129 @@
+#include "display_pi.h"
+#include "virtual_panel.h"
+#include "cyrillic_font.h"
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Отрисовка типичных экранов на виртуальной панели без дисплея с учетом
+// RenderProfiler: вызовы примитивов, кадры, окна адресации и обмен с
+// панелью по каждому экрану. С каталогом в аргументе в нем сохраняются
+// итоговое изображение каждого экрана (PPM) и трасса отрисовки trace.json
+//   shifro-render [КАТАЛОГ]
+
+namespace {
+
+struct Scene {
+    const char* name;
+    std::function<void(TFTDisplay&)> draw;
+};
+
+// Строка списка файлов в разметке экрана выбора
+void drawListRow(TFTDisplay& display, int index, int slot, bool current) {
+    int16_t y = 35 + slot * (CYRILLIC_FONT.height + 10);
+    display.fillRect(10, y - 2, display.getWidth() - 20, CYRILLIC_FONT.height + 4,
+                     current ? COLOR_BLUE : COLOR_BLACK);
+    display.drawText(15, y, "[ ] FILE_" + std::to_string(index) + ".DAT", current ? COLOR_WHITE : COLOR_GREEN);
+}
+
+const std::vector<Scene> SCENES = {
+    {"clear", [](TFTDisplay& display) {
+        display.clearScreen(COLOR_BLACK);
+        display.flush();
+    }},
+    {"menu", [](TFTDisplay& display) {
+        display.clearScreen(COLOR_BLACK);
+        display.drawRect(55, 10, 50, CYRILLIC_FONT.height + 10, COLOR_GREEN);
+        display.drawText(70, 15, "STC", COLOR_GREEN);
+        display.drawLine(10, 33, display.getWidth() - 10, 33, COLOR_GREEN);
+        display.drawLine(10, 35, display.getWidth() - 10, 35, COLOR_GREEN);
+        display.fillRect(20, 55, 120, CYRILLIC_FONT.height + 10, COLOR_BLUE);
+        display.drawRect(20, 55, 120, CYRILLIC_FONT.height + 10, COLOR_WHITE);
+        display.drawText(30, 60, "1 - ENCRYPT", COLOR_WHITE);
+        display.drawRect(20, 78, 120, CYRILLIC_FONT.height + 10, COLOR_GREEN);
+        display.drawText(30, 83, "2 - DECRYPT", COLOR_GREEN);
+        display.flush();
+    }},
+    {"list-scroll", [](TFTDisplay& display) {
+        // Прокрутка списка на 20 строк вниз
+        display.clearScreen(COLOR_BLACK);
+        for (int slot = 0; slot < 4; slot++) {
+            drawListRow(display, slot, slot, slot == 0);
+        }
+        display.flush();
+        int16_t row_height = CYRILLIC_FONT.height + 10;
+        for (int current = 1; current < 24; current++) {
+            int top = current < 4 ? 0 : current - 3;
+            if (current >= 4) {
+                display.scrollRect(10, 33, display.getWidth() - 20, 4 * row_height, -row_height, COLOR_BLACK);
+            }
+            drawListRow(display, current - 1, current - 1 - top, false);
+            drawListRow(display, current, current - top, true);
+            display.flush();
+            display.waitPresented();
+        }
+    }},
+    {"progress", [](TFTDisplay& display) {
+        // Полоса прогресса за 100 обновлений
+        display.clearScreen(COLOR_BLACK);
+        display.drawRect(20, 90, display.getWidth() - 40, 10, COLOR_GREEN);
+        for (int percent = 1; percent <= 100; percent++) {
+            int filled = (display.getWidth() - 42) * percent / 100;
+            display.fillRect(21, 91, filled, 8, COLOR_GREEN);
+            display.fillRect(10, 104, display.getWidth() - 20, 14, COLOR_BLACK);
+            display.drawText(60, 105, std::to_string(percent) + "%", COLOR_GREEN);
+            display.flush();
+            display.waitPresented();
+        }
+    }},
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string dump_dir = argc > 1 ? argv[1] : "";
+
+    auto panel_owner = std::make_unique<VirtualPanel>();
+    VirtualPanel* panel = panel_owner.get();
+    TFTDisplay display(std::move(panel_owner), ST7735_HEIGHT, ST7735_WIDTH);
+    if (!display.init()) {
+        std::cerr << "Ошибка инициализации виртуальной панели" << std::endl;
+        return 1;
+    }
+    display.setRotation(DisplayRotation::ROTATION_0);
+    display.setFont(CYRILLIC_FONT);
+    display.flush();
+    display.waitPresented();
+    display.profiler().setEnabled(true);
+
+    for (const Scene& scene : SCENES) {
+        {
+            RenderProfiler::Screen screen(display.profiler(), scene.name);
+            scene.draw(display);
+        }
+        display.waitPresented();
+
+        if (!dump_dir.empty()) {
+            std::string path = dump_dir + "/" + scene.name + ".ppm";
+            if (!panel->dumpPpm(path)) {
+                std::cerr << "Не удалось записать " << path << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    display.profiler().writeReport(std::cout);
+    if (!dump_dir.empty()) {
+        std::string path = dump_dir + "/trace.json";
+        std::ofstream trace(path);
+        display.profiler().writeTrace(trace);
+        if (!trace) {
+            std::cerr << "Не удалось записать " << path << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include "render_profiler.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+
+constexpr size_t PRIMITIVE_COUNT = static_cast<size_t>(RenderPrimitive::COUNT);
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void accumulate(SinkStats& total, const SinkStats& delta) {
+    total.submits += delta.submits;
+    total.transfers += delta.transfers;
+    total.dc_switches += delta.dc_switches;
+    total.command_bytes += delta.command_bytes;
+    total.data_bytes += delta.data_bytes;
+    total.busy_ns += delta.busy_ns;
+}
+
+// Текст, дополненный пробелами до width символов (UTF-8): printf
+// выравнивает по байтам, и русские заголовки сдвигали бы колонки
+std::string padded(const char* text, size_t width, bool right = false) {
+    size_t length = 0;
+    for (const char* c = text; *c; c++) {
+        if ((*c & 0xC0) != 0x80) {
+            length++;
+        }
+    }
+    std::string spaces(length < width ? width - length : 0, ' ');
+    return right ? spaces + text : text + spaces;
+}
+
+// Строка для JSON: имена экранов — литералы из кода, но кавычки и
+// обратная косая черта все равно экранируются
+void writeJsonString(std::ostream& out, const char* text) {
+    out << '"';
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+
+RenderProfiler::Screen::Screen(RenderProfiler& profiler, const char* name)
+    : profiler(profiler.enabled() ? &profiler : nullptr) {
+    if (!this->profiler) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    profiler.screen_stack.push_back(profiler.screenIndex(name));
+    start = std::chrono::steady_clock::now();
+}
+
+RenderProfiler::Screen::~Screen() {
+    if (!profiler) {
+        return;
+    }
+    uint64_t ns = elapsedNs(start);
+    std::lock_guard<std::mutex> lock(profiler->mutex);
+    // Учет мог быть сброшен внутри экрана
+    if (profiler->screen_stack.empty()) {
+        return;
+    }
+    uint16_t screen = profiler->screen_stack.back();
+    profiler->screen_stack.pop_back();
+    profiler->screens[screen].calls++;
+    profiler->screens[screen].ns += ns;
+    profiler->addTrace({screen, false, profiler->sinceOrigin(start), ns, 0, 0, SinkStats()});
+}
+
+RenderProfiler::Timer::Timer(RenderProfiler& profiler, RenderPrimitive primitive)
+    : profiler(profiler.enabled() ? &profiler : nullptr),
+      primitive(primitive) {
+    if (this->profiler) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+RenderProfiler::Timer::~Timer() {
+    if (!profiler) {
+        return;
+    }
+    uint64_t ns = elapsedNs(start);
+    std::lock_guard<std::mutex> lock(profiler->mutex);
+    uint16_t screen = profiler->screen_stack.empty() ? 0 : profiler->screen_stack.back();
+    PrimitiveStats& stats = profiler->screens[screen].primitives[static_cast<size_t>(primitive)];
+    stats.calls++;
+    stats.ns += ns;
+}
+
+RenderProfiler::RenderProfiler()
+    : active(false),
+      origin(std::chrono::steady_clock::now()),
+      dropped_events(0) {
+    screens.push_back(ScreenStats("-"));
+}
+
+void RenderProfiler::setEnabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (enabled && !active.load(std::memory_order_relaxed)) {
+        origin = std::chrono::steady_clock::now();
+    }
+    active.store(enabled, std::memory_order_relaxed);
+}
+
+uint16_t RenderProfiler::currentScreen() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return screen_stack.empty() ? 0 : screen_stack.back();
+}
+
+void RenderProfiler::framePublished(uint16_t screen) {
+    std::lock_guard<std::mutex> lock(mutex);
+    screens[screen].frames_published++;
+}
+
+void RenderProfiler::framePresented(const FrameRecord& record) {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(record.end - record.start).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    ScreenStats& stats = screens[record.screen];
+    stats.frames_presented++;
+    stats.windows += record.windows;
+    stats.pixels += record.pixels;
+    accumulate(stats.traffic, record.traffic);
+    addTrace({record.screen, true, sinceOrigin(record.start), ns, record.windows, record.pixels, record.traffic});
+}
+
+void RenderProfiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (ScreenStats& stats : screens) {
+        stats = ScreenStats(stats.name);
+    }
+    screen_stack.clear();
+    trace.clear();
+    dropped_events = 0;
+    origin = std::chrono::steady_clock::now();
+}
+
+void RenderProfiler::writeReport(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    char line[256];
+
+    out << "Экраны (время — мс; кадры: переданы flush() / выведены)\n";
+    out << padded("экран", 24);
+    const char* screen_columns[] = {"вызовов", "время", "кадров", "выведено", "окон", "точек",
+                                    "ioctl", "DC", "байт", "SPI"};
+    const size_t screen_widths[] = {8, 10, 8, 9, 8, 10, 8, 8, 11, 10};
+    for (size_t i = 0; i < sizeof(screen_widths) / sizeof(screen_widths[0]); i++) {
+        out << padded(screen_columns[i], screen_widths[i], true);
+    }
+    out << "\n";
+    PrimitiveStats totals[PRIMITIVE_COUNT];
+    for (const ScreenStats& stats : screens) {
+        bool drawn = false;
+        for (size_t i = 0; i < PRIMITIVE_COUNT; i++) {
+            totals[i].calls += stats.primitives[i].calls;
+            totals[i].ns += stats.primitives[i].ns;
+            drawn = drawn || stats.primitives[i].calls != 0;
+        }
+        if (stats.calls == 0 && stats.frames_published == 0 && stats.frames_presented == 0 && !drawn) {
+            continue;
+        }
+
+        out << padded(stats.name, 24);
+        std::snprintf(line, sizeof(line), "%8llu%10.2f%8llu%9llu%8llu%10llu%8llu%8llu%11llu%10.2f\n",
+                      (unsigned long long)stats.calls, stats.ns / 1e6,
+                      (unsigned long long)stats.frames_published, (unsigned long long)stats.frames_presented,
+                      (unsigned long long)stats.windows, (unsigned long long)stats.pixels,
+                      (unsigned long long)stats.traffic.transfers, (unsigned long long)stats.traffic.dc_switches,
+                      (unsigned long long)(stats.traffic.command_bytes + stats.traffic.data_bytes),
+                      stats.traffic.busy_ns / 1e6);
+        out << line;
+
+        // Вызовы примитивов экрана: здесь виден, например, цикл по точкам
+        if (drawn) {
+            out << "    ";
+            const char* separator = "";
+            for (size_t i = 0; i < PRIMITIVE_COUNT; i++) {
+                if (stats.primitives[i].calls != 0) {
+                    out << separator << primitiveName(static_cast<RenderPrimitive>(i))
+                        << " " << stats.primitives[i].calls;
+                    separator = ", ";
+                }
+            }
+            out << "\n";
+        }
+    }
+
+    out << "\nПримитивы (время включает вложенные вызовы)\n";
+    out << padded("примитив", 24) << padded("вызовов", 10, true)
+        << padded("время, мс", 11, true) << padded("среднее, мкс", 14, true) << "\n";
+    for (size_t i = 0; i < PRIMITIVE_COUNT; i++) {
+        if (totals[i].calls == 0) {
+            continue;
+        }
+        out << padded(primitiveName(static_cast<RenderPrimitive>(i)), 24);
+        std::snprintf(line, sizeof(line), "%10llu%11.2f%14.2f\n", (unsigned long long)totals[i].calls,
+                      totals[i].ns / 1e6, totals[i].ns / 1e3 / totals[i].calls);
+        out << line;
+    }
+    if (dropped_events != 0) {
+        out << "\nВ трассу не попало событий: " << dropped_events << "\n";
+    }
+}
+
+void RenderProfiler::writeTrace(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    char number[64];
+
+    // Время в Trace Event — в микросекундах
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"рисование\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"вывод\"}}";
+    for (const TraceEvent& event : trace) {
+        out << ",\n{\"name\":";
+        writeJsonString(out, screens[event.screen].name);
+        std::snprintf(number, sizeof(number), "%.3f", event.start_ns / 1e3);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.frame ? 2 : 1) << ",\"ts\":" << number;
+        std::snprintf(number, sizeof(number), "%.3f", event.duration_ns / 1e3);
+        out << ",\"dur\":" << number;
+        if (event.frame) {
+            out << ",\"args\":{\"windows\":" << event.windows
+                << ",\"pixels\":" << event.pixels
+                << ",\"ioctl\":" << event.traffic.transfers
+                << ",\"dc\":" << event.traffic.dc_switches
+                << ",\"bytes\":" << event.traffic.command_bytes + event.traffic.data_bytes << "}";
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+const char* RenderProfiler::primitiveName(RenderPrimitive primitive) {
+    switch (primitive) {
+        case RenderPrimitive::CLEAR_SCREEN: return "clearScreen";
+        case RenderPrimitive::DRAW_PIXEL:   return "drawPixel";
+        case RenderPrimitive::DRAW_LINE:    return "drawLine";
+        case RenderPrimitive::DRAW_RECT:    return "drawRect";
+        case RenderPrimitive::FILL_RECT:    return "fillRect";
+        case RenderPrimitive::DRAW_CIRCLE:  return "drawCircle";
+        case RenderPrimitive::FILL_CIRCLE:  return "fillCircle";
+        case RenderPrimitive::SCROLL_RECT:  return "scrollRect";
+        case RenderPrimitive::DRAW_CHAR:    return "drawChar";
+        case RenderPrimitive::DRAW_TEXT:    return "drawText";
+        case RenderPrimitive::DRAW_IMAGE:   return "drawImage";
+        case RenderPrimitive::FLUSH:        return "flush";
+        case RenderPrimitive::COUNT:        break;
+    }
+    return "?";
+}
+
+uint16_t RenderProfiler::screenIndex(const char* name) {
+    for (size_t i = 0; i < screens.size(); i++) {
+        if (screens[i].name == name || std::strcmp(screens[i].name, name) == 0) {
+            return static_cast<uint16_t>(i);
+        }
+    }
+    screens.push_back(ScreenStats(name));
+    return static_cast<uint16_t>(screens.size() - 1);
+}
+
+uint64_t RenderProfiler::sinceOrigin(std::chrono::steady_clock::time_point time) const {
+    return time < origin ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin).count();
+}
+
+void RenderProfiler::addTrace(const TraceEvent& event) {
+    if (trace.size() >= PROFILER_MAX_TRACE_EVENTS) {
+        dropped_events++;
+        return;
+    }
+    trace.push_back(event);
+}
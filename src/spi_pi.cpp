@@ -7,16 +7,23 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <algorithm>
+#include <fstream>
 
 
 #define DC_PIN 24
 #define RST_PIN 25
 
+// Размер буфера spidev по умолчанию; фактический читается из параметра модуля
+#define SPIDEV_DEFAULT_BUFSIZ 4096
+#define SPIDEV_BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+
 SPIDevice::SPIDevice(int channel, uint32_t speed) 
     : spi_channel(channel), spi_speed(speed), spi_fd(-1),
       chip_name("gpiochip0"), chip(nullptr), 
       dc_line(nullptr), rst_line(nullptr),
-      dc_pin(DC_PIN), rst_pin(RST_PIN) {
+      dc_pin(DC_PIN), rst_pin(RST_PIN),
+      dc_state(-1), max_transfer(SPIDEV_DEFAULT_BUFSIZ) {
 }
 
 SPIDevice::~SPIDevice() {
@@ -107,6 +114,13 @@ bool SPIDevice::init() {
         }
         
         
+        // Больший буфер (spidev.bufsiz=... в cmdline.txt) — меньше ioctl на кадр
+        std::ifstream bufsiz(SPIDEV_BUFSIZ_PARAM);
+        size_t value = 0;
+        if (bufsiz >> value && value > 0) {
+            max_transfer = value;
+        }
+        
         return true;
     }
     
@@ -127,13 +141,11 @@ void SPIDevice::write(uint8_t* data, size_t length) {
         tr.rx_buf = 0;
         tr.len = static_cast<__u32>(length);
         tr.speed_hz = spi_speed;
-        tr.delay_usecs = 1; 
+        tr.delay_usecs = 0; 
         tr.bits_per_word = 8;
         tr.cs_change = 0;    
         
         if (ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr) >= 0) {
-            // Successful transfer
-            std::this_thread::sleep_for(std::chrono::microseconds(10));  
             return;
         }
         
@@ -148,7 +160,7 @@ void SPIDevice::setDC(bool state) {
     int retries = 3;
     while (retries > 0) {
         if (gpiod_line_set_value(dc_line, state ? 1 : 0) == 0) {
-            std::this_thread::sleep_for(std::chrono::microseconds(1));
+            dc_state = state ? 1 : 0;
             return;
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -156,6 +168,96 @@ void SPIDevice::setDC(bool state) {
     }
 }
 
+void SPIDevice::queueCommand(uint8_t cmd) {
+    segments.push_back({false, nullptr, staging.size(), 1});
+    staging.push_back(cmd);
+}
+
+void SPIDevice::queueData(const uint8_t* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (length > SPI_COPY_THRESHOLD) {
+        segments.push_back({true, data, 0, length});
+        return;
+    }
+    segments.push_back({true, nullptr, staging.size(), length});
+    staging.insert(staging.end(), data, data + length);
+}
+
+void SPIDevice::submit() {
+    auto started = std::chrono::steady_clock::now();
+    counters.submits++;
+    try {
+        size_t i = 0;
+        while (i < segments.size()) {
+            bool data = segments[i].data;
+            if (dc_state != (data ? 1 : 0)) {
+                setDC(data);
+                counters.dc_switches++;
+            }
+
+            // Участки с тем же DC — цепочкой, не больше max_transfer за ioctl
+            transfers.clear();
+            size_t batch_bytes = 0;
+            for (; i < segments.size() && segments[i].data == data; i++) {
+                const Segment& segment = segments[i];
+                const uint8_t* bytes = segment.external ? segment.external : staging.data() + segment.offset;
+                (data ? counters.data_bytes : counters.command_bytes) += segment.length;
+                for (size_t offset = 0; offset < segment.length;) {
+                    if (batch_bytes == max_transfer) {
+                        transfer(transfers.data(), transfers.size());
+                        transfers.clear();
+                        batch_bytes = 0;
+                    }
+                    size_t length = std::min(segment.length - offset, max_transfer - batch_bytes);
+                    struct spi_ioc_transfer tr = {};
+                    tr.tx_buf = (unsigned long)(bytes + offset);
+                    tr.len = static_cast<__u32>(length);
+                    tr.speed_hz = spi_speed;
+                    tr.bits_per_word = 8;
+                    transfers.push_back(tr);
+                    batch_bytes += length;
+                    offset += length;
+                }
+            }
+            if (!transfers.empty()) {
+                transfer(transfers.data(), transfers.size());
+            }
+        }
+    } catch (...) {
+        // Очередь очищается и при ошибке, чтобы не отправить ее повторно
+        segments.clear();
+        staging.clear();
+        throw;
+    }
+    segments.clear();
+    staging.clear();
+    counters.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - started).count();
+}
+
+void SPIDevice::transfer(struct spi_ioc_transfer* batch, size_t count) {
+    if (spi_fd < 0) {
+        throw std::runtime_error("SPI device not initialized");
+    }
+
+    // В одном сообщении spidev не больше 255 передач (поле размера в ioctl)
+    while (count > 0) {
+        size_t n = std::min<size_t>(count, 255);
+        int retry_count = 0;
+        while (ioctl(spi_fd, SPI_IOC_MESSAGE(n), batch) < 0) {
+            if (++retry_count == 3) {
+                throw std::runtime_error("SPI write failed after all retries");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        counters.transfers++;
+        batch += n;
+        count -= n;
+    }
+}
+
 void SPIDevice::setRST(bool state) {
     int retries = 3;
     while (retries > 0) {
@@ -0,0 +1,108 @@
+#include "transfer_plan.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+namespace transfer_plan {
+
+uint64_t freeSpace(const std::string& path) {
+    struct statvfs st;
+    if (statvfs(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+}
+
+uint64_t allocatedSpace(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+Plan make(std::vector<transfer_scheduler::Job> jobs, const std::string& dest_path,
+          const device_profile::Profile& source, const device_profile::Profile& dest,
+          uint64_t allocated_bytes) {
+    Plan plan;
+    plan.allocated_bytes = allocated_bytes;
+    for (const auto& job : jobs) {
+        plan.input_bytes += job.size;
+        plan.output_bytes += job.output_size;
+    }
+    plan.jobs = std::move(jobs);
+    plan.free_bytes = freeSpace(dest_path);
+
+    // Чтение и запись идут конвейером, поэтому время определяет более
+    // медленная сторона. К записи добавляются постоянные затраты на порцию
+    double read_seconds = source.read_bandwidth > 0 ? plan.input_bytes / source.read_bandwidth : 0;
+    double write_seconds = 0;
+    if (dest.write_bandwidth > 0) {
+        double chunks = std::ceil(static_cast<double>(plan.output_bytes) / std::max<size_t>(dest.chunk_size, 1));
+        write_seconds = plan.output_bytes / dest.write_bandwidth + chunks * dest.write_latency;
+    }
+    plan.estimated_seconds = std::max(read_seconds, write_seconds);
+    return plan;
+}
+
+double remainingSeconds(const Plan& plan, const transfer_scheduler::Progress& progress, double elapsed_seconds) {
+    if (progress.bytes_total == 0) {
+        return -1;
+    }
+    uint64_t remaining = progress.bytes_total > progress.bytes_done ? progress.bytes_total - progress.bytes_done : 0;
+    if (elapsed_seconds >= MEASURED_RATE_AFTER && progress.bytes_done > 0) {
+        return remaining * elapsed_seconds / progress.bytes_done;
+    }
+    if (plan.estimated_seconds > 0) {
+        return plan.estimated_seconds * remaining / progress.bytes_total;
+    }
+    return -1;
+}
+
+std::string formatDuration(double seconds) {
+    char text[32];
+    long total = static_cast<long>(std::ceil(std::max(seconds, 0.0)));
+    if (total < 60) {
+        std::snprintf(text, sizeof(text), "%ld с", total);
+    } else if (total < 3600) {
+        std::snprintf(text, sizeof(text), "%ld мин", (total + 59) / 60);
+    } else {
+        long minutes = (total + 59) / 60;
+        std::snprintf(text, sizeof(text), "%ld ч %02ld мин", minutes / 60, minutes % 60);
+    }
+    return text;
+}
+
+void RateMeter::add(double seconds, uint64_t bytes_done) {
+    samples.emplace_back(seconds, bytes_done);
+    // Самый старый отсчет внутри окна остается началом отсчета скорости
+    while (samples.size() > 2 && samples[1].first <= seconds - RATE_WINDOW) {
+        samples.pop_front();
+    }
+}
+
+double RateMeter::bytesPerSecond() const {
+    if (samples.size() < 2) {
+        return -1;
+    }
+    double seconds = samples.back().first - samples.front().first;
+    if (seconds < RATE_WINDOW / 2) {
+        return -1;
+    }
+    return (samples.back().second - samples.front().second) / seconds;
+}
+
+std::string formatRate(double bytes_per_second) {
+    char text[32];
+    double megabytes = std::max(bytes_per_second, 0.0) / (1024 * 1024);
+    if (megabytes < 10) {
+        std::snprintf(text, sizeof(text), "%.1f МБ/с", megabytes);
+    } else {
+        std::snprintf(text, sizeof(text), "%.0f МБ/с", megabytes);
+    }
+    return text;
+}
+
+} // namespace transfer_plan
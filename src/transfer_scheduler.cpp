@@ -0,0 +1,153 @@
+#include "transfer_scheduler.h"
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+
+namespace transfer_scheduler {
+
+size_t workerCount(size_t queue_depth) {
+    size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    return std::clamp<size_t>(std::min(cores, queue_depth + 1), 1, MAX_WORKERS);
+}
+
+std::vector<std::vector<Job>> orderJobs(std::vector<Job> jobs) {
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return a.size > b.size;
+    });
+
+    auto first_small = std::find_if(jobs.begin(), jobs.end(), [](const Job& job) {
+        return job.size < SMALL_FILE_LIMIT;
+    });
+    std::vector<Job> large(jobs.begin(), first_small);
+    std::vector<Job> small(first_small, jobs.end());
+
+    // Пачки мелких файлов примерно одинакового объема
+    std::vector<std::vector<Job>> small_batches;
+    uint64_t batch_bytes = 0;
+    for (auto& job : small) {
+        if (small_batches.empty() || small_batches.back().size() >= SMALL_BATCH_FILES ||
+            batch_bytes >= SMALL_FILE_LIMIT) {
+            small_batches.emplace_back();
+            batch_bytes = 0;
+        }
+        batch_bytes += job.size;
+        small_batches.back().push_back(std::move(job));
+    }
+
+    // Чередуем: крупный файл, пачка мелких, крупный файл...
+    std::vector<std::vector<Job>> tasks;
+    size_t li = 0;
+    size_t si = 0;
+    while (li < large.size() || si < small_batches.size()) {
+        if (li < large.size()) {
+            tasks.push_back({std::move(large[li++])});
+        }
+        if (si < small_batches.size()) {
+            tasks.push_back(std::move(small_batches[si++]));
+        }
+    }
+    return tasks;
+}
+
+Scheduler::Scheduler(std::vector<Job> jobs, size_t workers)
+    : worker_count(std::max<size_t>(1, workers)),
+      files_total(jobs.size()), bytes_total(0),
+      next_task(0), files_done(0), bytes_done(0) {
+    for (const auto& job : jobs) {
+        bytes_total += job.size;
+    }
+    tasks = orderJobs(std::move(jobs));
+    worker_count = std::min(worker_count, std::max<size_t>(1, tasks.size()));
+}
+
+void Scheduler::run(const Processor& process, const file_engine::Options& options,
+                    const TickCallback& on_tick, std::chrono::milliseconds tick_interval) {
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t running = worker_count;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; i++) {
+        workers.emplace_back([&]() {
+            workerLoop(process, options);
+            std::lock_guard<std::mutex> lock(done_mutex);
+            running--;
+            done_cv.notify_all();
+        });
+    }
+
+    // Поток вызывающего только отображает ход выполнения
+    while (true) {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        bool finished = done_cv.wait_for(lock, tick_interval, [&]() { return running == 0; });
+        lock.unlock();
+        if (on_tick) {
+            on_tick(progress());
+        }
+        if (finished) {
+            break;
+        }
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void Scheduler::workerLoop(const Processor& process, const file_engine::Options& options) {
+    file_engine::Options job_options = options;
+
+    while (true) {
+        size_t index = next_task.fetch_add(1);
+        if (index >= tasks.size()) {
+            return;
+        }
+
+        for (const auto& job : tasks[index]) {
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                current_file = job.name;
+            }
+
+            uint64_t reported = 0;
+            job_options.progress = [&](uint64_t bytes) {
+                reported += bytes;
+                bytes_done += bytes;
+                if (options.progress) {
+                    options.progress(bytes);
+                }
+            };
+
+            try {
+                process(job, job_options);
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                error_list.push_back(job.name + ": " + e.what());
+            }
+
+            // Остаток (заголовок, имитовставка или необработанная часть при ошибке)
+            if (reported < job.size) {
+                bytes_done += job.size - reported;
+            }
+            files_done++;
+        }
+    }
+}
+
+Progress Scheduler::progress() const {
+    Progress p;
+    p.files_done = files_done.load();
+    p.files_total = files_total;
+    p.bytes_done = bytes_done.load();
+    p.bytes_total = bytes_total;
+    std::lock_guard<std::mutex> lock(state_mutex);
+    p.current_file = current_file;
+    return p;
+}
+
+std::vector<std::string> Scheduler::errors() const {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return error_list;
+}
+
+} // namespace transfer_scheduler
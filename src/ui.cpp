@@ -0,0 +1,414 @@
+#include "ui.h"
+#include "cyrillic_font.h"
+#include "utf8_helper.h"
+#include <algorithm>
+#include <list>
+#include <string_view>
+#include <unordered_map>
+
+namespace ui {
+
+namespace {
+
+// Не больше стольких разметок хранят кэши одного шрифта. Давно не
+// выводившиеся разметки вытесняются первыми
+constexpr size_t STABLE_CACHE_SIZE = 256;
+constexpr size_t TRANSIENT_CACHE_SIZE = 16;
+
+// Отметки строк CheckList
+const std::string CHECKED = "[X] ";
+const std::string UNCHECKED = "[ ] ";
+
+// Особенности начертания символов шрифта
+enum GlyphStyle : uint8_t {
+    STYLE_BOLD = 0,  // С утолщением
+    STYLE_THIN = 1,  // Широкие буквы Ш, Щ, Ф рисуются без утолщения
+    STYLE_TAIL = 2   // Буквам Ц, ц, ь дорисовывается хвостик справа внизу
+};
+
+struct StyleTable {
+    uint8_t style[256];
+};
+
+constexpr StyleTable makeStyleTable() {
+    StyleTable table{};
+    constexpr uint8_t A = utf8::CYRILLIC_FIRST_INDEX;
+    // Порядок букв: А=0 ... Я=31, а=32 ... я=63
+    for (uint8_t letter : {20, 24, 25, 52, 56, 57}) {  // Ф Ш Щ ф ш щ
+        table.style[A + letter] = STYLE_THIN;
+    }
+    for (uint8_t letter : {22, 54, 60}) {  // Ц ц ь
+        table.style[A + letter] = STYLE_TAIL;
+    }
+    return table;
+}
+
+constexpr StyleTable GLYPH_STYLES = makeStyleTable();
+
+static_assert(GLYPH_STYLES.style[utf8::russian_char_to_index(0xD0, 0xA8)] == STYLE_THIN, "Ш");
+static_assert(GLYPH_STYLES.style[utf8::russian_char_to_index(0xD1, 0x86)] == STYLE_TAIL, "ц");
+
+// Разметка строки: символы шрифта со смещениями от начала и ширина.
+// Строится один раз на строку, повторный вывод не разбирает UTF-8
+struct TextLayout {
+    struct Glyph {
+        int16_t x;
+        uint8_t index;
+        uint8_t style;
+    };
+
+    std::vector<Glyph> glyphs;
+    int16_t width = 0;
+};
+
+int16_t glyphWidth(const AppFont& font, uint8_t style) {
+    return static_cast<int16_t>(font.width + (style == STYLE_TAIL ? 1 : 0));
+}
+
+TextLayout buildLayout(const std::string& text, const AppFont& font) {
+    TextLayout layout;
+    int16_t x = 0;
+    for (size_t pos = 0; pos < text.length();) {
+        utf8::Glyph glyph = utf8::decode(text.data(), text.length(), pos);
+        pos += glyph.length;
+        if (glyph.index == utf8::NO_GLYPH) {
+            continue;
+        }
+        uint8_t style = GLYPH_STYLES.style[glyph.index];
+        layout.glyphs.push_back({x, glyph.index, style});
+        x += glyphWidth(font, style) + LETTER_SPACING;
+    }
+    layout.width = x > 0 ? x - LETTER_SPACING : 0;
+    return layout;
+}
+
+// Кэш разметок одного шрифта с вытеснением давно не использованных.
+// Только что выданная разметка вытесняется последней, поэтому ссылка на
+// нее действительна по крайней мере до следующего вызова get()
+class LayoutCache {
+public:
+    explicit LayoutCache(size_t capacity) : capacity(capacity) {}
+
+    const TextLayout& get(const std::string& text, const AppFont& font) {
+        auto it = index.find(text);
+        if (it != index.end()) {
+            // Перенос узла в начало списка не выделяет память
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->layout;
+        }
+        if (entries.size() >= capacity) {
+            index.erase(entries.back().text);
+            entries.pop_back();
+        }
+        entries.push_front({text, buildLayout(text, font)});
+        index.emplace(entries.front().text, entries.begin());
+        return entries.front().layout;
+    }
+
+private:
+    struct Entry {
+        std::string text;
+        TextLayout layout;
+    };
+
+    size_t capacity;
+    std::list<Entry> entries;  // От недавно использованных к давним
+    // Ключи указывают на строки в узлах списка, узлы при переносе не меняются
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+};
+
+// Разметка строки из кэша шрифта. Часто меняющиеся строки идут в отдельный
+// небольшой кэш и не вытесняют постоянные
+const TextLayout& layoutText(const std::string& text, TextCache kind, const AppFont& font = CYRILLIC_FONT) {
+    static std::unordered_map<const uint8_t*, LayoutCache> stable;
+    static std::unordered_map<const uint8_t*, LayoutCache> transient;
+    bool is_stable = kind == TextCache::STABLE;
+    auto& caches = is_stable ? stable : transient;
+    auto it = caches.find(font.data);
+    if (it == caches.end()) {
+        it = caches.emplace(font.data, LayoutCache(is_stable ? STABLE_CACHE_SIZE : TRANSIENT_CACHE_SIZE)).first;
+    }
+    return it->second.get(text, font);
+}
+
+// Разметка «...» хранится отдельно от кэша и не вытесняется из него
+const TextLayout& ellipsis() {
+    static const TextLayout layout = buildLayout("...", CYRILLIC_FONT);
+    return layout;
+}
+
+// Символов строки, которые помещаются в max_width вместе с «...»;
+// glyphs.size() — строка помещается целиком
+size_t fittedGlyphs(const TextLayout& layout, int16_t max_width) {
+    if (layout.width <= max_width) {
+        return layout.glyphs.size();
+    }
+    int16_t limit = max_width - ellipsis().width - LETTER_SPACING;
+    size_t count = 0;
+    while (count < layout.glyphs.size() &&
+           layout.glyphs[count].x + glyphWidth(CYRILLIC_FONT, layout.glyphs[count].style) <= limit) {
+        count++;
+    }
+    return count;
+}
+
+// Вывод символов [0, count) разметки с x; возвращает x после последнего
+int16_t drawGlyphs(TFTDisplay& display, const TextLayout& layout, size_t count,
+                   int16_t x, int16_t y, uint16_t color) {
+    for (size_t i = 0; i < count; i++) {
+        const TextLayout::Glyph& glyph = layout.glyphs[i];
+        int16_t glyph_x = x + glyph.x;
+        // Проверяем, не выходим ли за пределы экрана
+        if (glyph_x + CYRILLIC_FONT.width > display.getWidth()) {
+            break;
+        }
+        display.drawChar(glyph_x, y, glyph.index, color, glyph.style != STYLE_THIN);
+        if (glyph.style == STYLE_TAIL) {
+            display.drawPixel(glyph_x + CYRILLIC_FONT.width, y + CYRILLIC_FONT.height - 1, color);
+        }
+    }
+    return count < layout.glyphs.size() ? x + layout.glyphs[count].x : x + layout.width + LETTER_SPACING;
+}
+
+} // namespace
+
+int16_t textWidth(const std::string& text, TextCache cache) {
+    return layoutText(text, cache).width;
+}
+
+int16_t textWidth(const std::string& text, int16_t max_width, TextCache cache) {
+    const TextLayout& layout = layoutText(text, cache);
+    size_t count = fittedGlyphs(layout, max_width);
+    if (count == layout.glyphs.size()) {
+        return layout.width;
+    }
+    return (count > 0 ? layout.glyphs[count].x : 0) + ellipsis().width;
+}
+
+void drawText(TFTDisplay& display, const std::string& text, int16_t x, int16_t y, uint16_t color,
+              int16_t max_width, TextCache cache) {
+    const TextLayout& layout = layoutText(text, cache);
+    size_t count = fittedGlyphs(layout, max_width);
+    int16_t end = drawGlyphs(display, layout, count, x, y, color);
+    if (count < layout.glyphs.size()) {
+        drawGlyphs(display, ellipsis(), ellipsis().glyphs.size(), end, y, color);
+    }
+}
+
+void Widget::render(TFTDisplay& display) {
+    if (!damaged && !changed) {
+        return;
+    }
+    draw(display, damaged);
+    damaged = false;
+    changed = false;
+}
+
+Label::Label(const Rect& bounds, const std::string& text, uint16_t color, Align align, uint16_t background)
+    : Widget(bounds), content(text), text_color(color), alignment(align), background(background) {
+}
+
+void Label::draw(TFTDisplay& display, bool) {
+    const Rect& area = bounds();
+    display.fillRect(area.x, area.y, area.w, area.h, background);
+    int16_t x = area.x + 1;
+    if (alignment == Align::CENTER) {
+        x = area.x + (area.w - textWidth(content, area.w - 2, cache)) / 2;
+    }
+    drawText(display, content, x, area.y + (area.h - CYRILLIC_FONT.height) / 2, text_color, area.w - 2, cache);
+}
+
+void Box::draw(TFTDisplay& display, bool) {
+    const Rect& area = bounds();
+    display.drawRect(area.x, area.y, area.w, area.h, color);
+}
+
+void Line::draw(TFTDisplay& display, bool) {
+    const Rect& area = bounds();
+    display.drawLine(area.x, area.y, area.x + area.w - 1, area.y, color);
+}
+
+void Button::draw(TFTDisplay& display, bool) {
+    const Rect& area = bounds();
+    uint16_t text_color = selected ? COLOR_WHITE : COLOR_GREEN;
+    display.fillRect(area.x, area.y, area.w, area.h, selected ? COLOR_BLUE : COLOR_BLACK);
+    display.drawRect(area.x, area.y, area.w, area.h, text_color);
+    drawText(display, text, area.x + (area.w - textWidth(text)) / 2,
+             area.y + (area.h - CYRILLIC_FONT.height) / 2, text_color);
+}
+
+CheckList::CheckList(const Rect& bounds, int16_t row_height)
+    : Widget(bounds), row_height(row_height) {
+}
+
+size_t CheckList::visibleRows() const {
+    return static_cast<size_t>(std::max<int16_t>(bounds().h / row_height, 1));
+}
+
+void CheckList::setItems(std::vector<Item> items) {
+    rows = std::move(items);
+    current_row = 0;
+    top = 0;
+    touched.clear();
+    invalidate();
+}
+
+void CheckList::setChecked(size_t index, bool checked) {
+    if (index < rows.size() && rows[index].checked != checked) {
+        rows[index].checked = checked;
+        touch(index);
+    }
+}
+
+void CheckList::setCurrent(size_t index) {
+    if (index >= rows.size() || index == current_row) {
+        return;
+    }
+    touch(current_row);
+    touch(index);
+    current_row = index;
+
+    // Видимая часть сдвигается ровно до текущей строки
+    if (current_row < top) {
+        top = current_row;
+    } else if (current_row >= top + visibleRows()) {
+        top = current_row - visibleRows() + 1;
+    }
+}
+
+void CheckList::touch(size_t index) {
+    touched.push_back(index);
+    markChanged();
+}
+
+void CheckList::draw(TFTDisplay& display, bool full) {
+    const Rect& area = bounds();
+    size_t visible = visibleRows();
+
+    bool redraw_all = full || (top != drawn_top && top + 1 != drawn_top && drawn_top + 1 != top);
+    if (redraw_all) {
+        display.fillRect(area.x, area.y, area.w, area.h, COLOR_BLACK);
+        for (size_t i = top; i < top + visible && i < rows.size(); i++) {
+            drawRow(display, i);
+        }
+    } else {
+        // Сдвиг на строку: строки переносятся в буфере кадра, открывшаяся
+        // строка рисуется вместе с изменившимися
+        if (top != drawn_top) {
+            int16_t dy = drawn_top > top ? row_height : -row_height;
+            display.scrollRect(area.x, area.y, area.w, static_cast<int16_t>(visible * row_height), dy, COLOR_BLACK);
+            touched.push_back(top > drawn_top ? top + visible - 1 : top);
+        }
+        for (size_t index : touched) {
+            drawRow(display, index);
+        }
+    }
+    drawn_top = top;
+    touched.clear();
+}
+
+void CheckList::drawRow(TFTDisplay& display, size_t index) {
+    if (index < top || index >= top + visibleRows() || index >= rows.size()) {
+        return;
+    }
+    const Rect& area = bounds();
+    int16_t y = area.y + static_cast<int16_t>(index - top) * row_height;
+    bool is_current = index == current_row;
+    uint16_t text_color = is_current ? COLOR_WHITE : COLOR_GREEN;
+    display.fillRect(area.x, y, area.w, CYRILLIC_FONT.height + 4, is_current ? COLOR_BLUE : COLOR_BLACK);
+    // Отметка и имя выводятся по отдельности: строка не собирается заново
+    const std::string& mark = rows[index].checked ? CHECKED : UNCHECKED;
+    int16_t text_x = area.x + 5 + textWidth(mark) + LETTER_SPACING;
+    drawText(display, mark, area.x + 5, y + 2, text_color);
+    drawText(display, rows[index].text, text_x, y + 2, text_color, area.x + area.w - 3 - text_x);
+}
+
+void ProgressBar::setProgress(uint64_t done, uint64_t total) {
+    int16_t inner = bounds().w - 2;
+    int16_t value = total > 0 ? static_cast<int16_t>(std::min(done, total) * inner / total) : 0;
+    update(filled, value);
+}
+
+void ProgressBar::draw(TFTDisplay& display, bool full) {
+    const Rect& area = bounds();
+    if (full) {
+        display.drawRect(area.x, area.y, area.w, area.h, color);
+        display.fillRect(area.x + 1, area.y + 1, area.w - 2, area.h - 2, COLOR_BLACK);
+        drawn = 0;
+    }
+    // Дорисовывается только изменившийся отрезок полосы
+    if (filled > drawn) {
+        display.fillRect(area.x + 1 + drawn, area.y + 1, filled - drawn, area.h - 2, color);
+    } else if (filled < drawn) {
+        display.fillRect(area.x + 1 + filled, area.y + 1, drawn - filled, area.h - 2, COLOR_BLACK);
+    }
+    drawn = filled;
+}
+
+void Screen::invalidate() {
+    for (Widget* widget : widgets) {
+        widget->invalidate();
+    }
+}
+
+void Screen::invalidate(const Rect& area) {
+    for (Widget* widget : widgets) {
+        if (widget->bounds().intersects(area)) {
+            widget->invalidate();
+        }
+    }
+}
+
+void Screen::render(TFTDisplay& display) {
+    for (Widget* widget : widgets) {
+        widget->render(display);
+    }
+}
+
+void Stage::show(Screen& screen) {
+    if (&screen != active) {
+        display.clearScreen(screen.background());
+        screen.invalidate();
+        active = &screen;
+    } else if (message_shown) {
+        // Сообщение закрывается: восстанавливаются только закрытые им виджеты
+        display.fillRect(message_area.x, message_area.y, message_area.w, message_area.h, screen.background());
+        screen.invalidate(message_area);
+    }
+    message_shown = false;
+    screen.render(display);
+    display.flush();
+}
+
+void Stage::showMessage(const std::vector<std::string>& lines, uint16_t color) {
+    int16_t line_height = CYRILLIC_FONT.height + 5;
+    int16_t width = 0;
+    for (const auto& line : lines) {
+        width = std::max(width, textWidth(line));
+    }
+    width = std::min<int16_t>(width + 20, display.getWidth() - 10);
+    int16_t height = static_cast<int16_t>(lines.size()) * line_height + 15;
+    Rect area{static_cast<int16_t>((display.getWidth() - width) / 2),
+              static_cast<int16_t>((display.getHeight() - height) / 2), width, height};
+
+    // Прежнее сообщение могло быть больше нового
+    if (message_shown && active) {
+        display.fillRect(message_area.x, message_area.y, message_area.w, message_area.h, active->background());
+        active->invalidate(message_area);
+        active->render(display);
+    }
+
+    display.fillRect(area.x, area.y, area.w, area.h, COLOR_BLACK);
+    display.drawRect(area.x, area.y, area.w, area.h, color);
+    int16_t y = area.y + 8;
+    for (const auto& line : lines) {
+        drawText(display, line, area.x + (area.w - textWidth(line, area.w - 6)) / 2, y, color, area.w - 6);
+        y += line_height;
+    }
+    display.flush();
+
+    message_shown = true;
+    message_area = area;
+}
+
+} // namespace ui
@@ -0,0 +1,172 @@
+#include "virtual_panel.h"
+#include "display_pi.h"
+#include <fstream>
+#include <algorithm>
+
+VirtualPanel::VirtualPanel(uint32_t clock_hz)
+    : clock_hz(clock_hz),
+      dc_state(-1),
+      panel_width(ST7735_WIDTH),
+      panel_height(ST7735_HEIGHT),
+      memory(ST7735_WIDTH * ST7735_HEIGHT, 0),
+      current_command(CMD_NOP),
+      column_start(0), column_end(ST7735_WIDTH - 1),
+      row_start(0), row_end(ST7735_HEIGHT - 1),
+      column(0), row(0),
+      high_byte(true),
+      pending_byte(0) {
+}
+
+bool VirtualPanel::init() {
+    return true;
+}
+
+void VirtualPanel::setRST(bool) {
+}
+
+void VirtualPanel::queueCommand(uint8_t cmd) {
+    queue.push_back({false, {cmd}});
+}
+
+void VirtualPanel::queueData(const uint8_t* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    queue.push_back({true, std::vector<uint8_t>(data, data + length)});
+}
+
+void VirtualPanel::submit() {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.submits++;
+
+    // Подсчет как в SPIDevice::submit(): участки подряд с одним DC
+    // уходят ioctl по VIRTUAL_PANEL_BUFSIZ байт
+    size_t i = 0;
+    while (i < queue.size()) {
+        bool is_data = queue[i].data;
+        if (dc_state != (is_data ? 1 : 0)) {
+            dc_state = is_data ? 1 : 0;
+            counters.dc_switches++;
+        }
+        size_t run_bytes = 0;
+        for (; i < queue.size() && queue[i].data == is_data; i++) {
+            for (uint8_t byte : queue[i].bytes) {
+                if (is_data) {
+                    data(byte);
+                } else {
+                    command(byte);
+                }
+            }
+            run_bytes += queue[i].bytes.size();
+        }
+        (is_data ? counters.data_bytes : counters.command_bytes) += run_bytes;
+        counters.transfers += (run_bytes + VIRTUAL_PANEL_BUFSIZ - 1) / VIRTUAL_PANEL_BUFSIZ;
+        counters.busy_ns += run_bytes * 8 * 1000000000ull / clock_hz;
+    }
+    queue.clear();
+}
+
+void VirtualPanel::command(uint8_t cmd) {
+    current_command = cmd;
+    arguments.clear();
+    if (cmd == CMD_RAMWR) {
+        column = column_start;
+        row = row_start;
+        high_byte = true;
+    }
+}
+
+void VirtualPanel::data(uint8_t byte) {
+    switch (current_command) {
+        case CMD_CASET:
+        case CMD_RASET:
+            arguments.push_back(byte);
+            if (arguments.size() == 4) {
+                int start = (arguments[0] << 8) | arguments[1];
+                int end = (arguments[2] << 8) | arguments[3];
+                if (current_command == CMD_CASET) {
+                    column_start = start;
+                    column_end = end;
+                } else {
+                    row_start = start;
+                    row_end = end;
+                }
+            }
+            break;
+
+        case CMD_MADCTL: {
+            // Смена осей меняет размеры памяти в текущей ориентации
+            bool swapped = (byte & 0x20) != 0;
+            int new_width = swapped ? ST7735_HEIGHT : ST7735_WIDTH;
+            if (new_width != panel_width) {
+                panel_width = new_width;
+                panel_height = swapped ? ST7735_WIDTH : ST7735_HEIGHT;
+                std::fill(memory.begin(), memory.end(), 0);
+            }
+            break;
+        }
+
+        case CMD_RAMWR:
+            if (high_byte) {
+                pending_byte = byte;
+                high_byte = false;
+                break;
+            }
+            high_byte = true;
+            if (row > row_end) {
+                break;  // Окно заполнено, лишние данные контроллер отбрасывает
+            }
+            if (column < panel_width && row < panel_height) {
+                memory[row * panel_width + column] = (pending_byte << 8) | byte;
+            }
+            if (++column > column_end) {
+                column = column_start;
+                row++;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+SinkStats VirtualPanel::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+int VirtualPanel::width() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return panel_width;
+}
+
+int VirtualPanel::height() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return panel_height;
+}
+
+uint16_t VirtualPanel::pixel(int x, int y) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (x < 0 || x >= panel_width || y < 0 || y >= panel_height) {
+        return 0;
+    }
+    return memory[y * panel_width + x];
+}
+
+bool VirtualPanel::dumpPpm(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream out(path, std::ios::binary);
+    out << "P6\n" << panel_width << " " << panel_height << "\n255\n";
+    for (int i = 0; i < panel_width * panel_height; i++) {
+        uint16_t color = memory[i];
+        // Расширение RGB565 до 8 бит на канал с заполнением младших бит
+        uint8_t r = (color >> 11) & 0x1F;
+        uint8_t g = (color >> 5) & 0x3F;
+        uint8_t b = color & 0x1F;
+        char rgb[3] = {static_cast<char>((r << 3) | (r >> 2)),
+                       static_cast<char>((g << 2) | (g >> 4)),
+                       static_cast<char>((b << 3) | (b >> 2))};
+        out.write(rgb, sizeof(rgb));
+    }
+    return static_cast<bool>(out);
+}